@@ -0,0 +1,15 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <stddef.h>
+
+// shared by the benchmarks that count allocations. alloc_count.c wraps the
+// allocator, link it with -Wl,--wrap=malloc,--wrap=realloc (see
+// ALLOC_COUNT_LDFLAGS in the Makefile) and every malloc/realloc is counted
+
+extern size_t allocations;
+
+// monotonic clock, in seconds
+double now_sec(void);
+
+#endif /* ALLOC_COUNT_H */
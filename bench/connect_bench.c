@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+// connect storm benchmark: opens all connections at once against a running
+// server and measures, for each one, the time from connect() to the reply
+// of a PING sent as soon as it is established. reports the percentiles of
+// that latency and how many connections never got a reply. run the server
+// in the eventloop model with tcp-backlog at least as large as the storm
+// to measure the accept path rather than the kernel's SYN retries.
+//   ./bin/crimsoncache crimsoncache.conf &
+//   make bench
+//   ./bin/bench/connect_bench [connections] [port] [host]
+
+#define TIMEOUT_SEC 30.0
+
+typedef struct conn {
+    int fd;
+    int state;        // 0 connecting, 1 waiting for the reply, 2 done
+    double start;
+    double latency;
+    size_t got;       // bytes of "+PONG\r\n" received
+} conn;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int resolve(const char *host, int port, struct sockaddr_in *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1;
+}
+
+// whether anything is listening, so make bench passes without a server
+static int server_up(const struct sockaddr_in *addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) return 0;
+    int up = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(fd);
+    return up;
+}
+
+// every connection needs an fd on both ends, raise our limit as far as we may
+static void raise_fd_limit(int n) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+    if (rl.rlim_cur >= (rlim_t)n + 64) return;
+    rl.rlim_cur = rl.rlim_max == RLIM_INFINITY || rl.rlim_max > (rlim_t)n + 64 ? (rlim_t)n + 64 : rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0) perror("setrlimit");
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 5000;
+    int port = argc > 2 ? atoi(argv[2]) : 6379;
+    const char *host = argc > 3 ? argv[3] : "127.0.0.1";
+
+    struct sockaddr_in addr;
+    if (n < 1 || !resolve(host, port, &addr)) {
+        fprintf(stderr, "usage: connect_bench [connections] [port] [host]\n");
+        return 1;
+    }
+    printf("connect_bench connections=%d server=%s:%d\n", n, host, port);
+    if (!server_up(&addr)) {
+        printf("  no server listening, skipped\n");
+        return 0;
+    }
+    raise_fd_limit(n);
+
+    conn *conns = calloc(n, sizeof(conn));
+    int epfd = epoll_create1(0);
+    if (!conns || epfd == -1) {
+        perror("setup failed");
+        return 1;
+    }
+
+    // fire every connect before waiting on any of them
+    int opened = 0;
+    double storm_start = now_sec();
+    for (; opened < n; opened++) {
+        conn *c = &conns[opened];
+        c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (c->fd == -1) {
+            perror("socket");
+            break;
+        }
+        c->start = now_sec();
+        if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+            perror("connect");
+            close(c->fd);
+            break;
+        }
+        struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = c};
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    }
+
+    int done = 0, failed = 0;
+    struct epoll_event events[256];
+    while (done + failed < opened && now_sec() - storm_start < TIMEOUT_SEC) {
+        int ready = epoll_wait(epfd, events, 256, 100);
+        for (int i = 0; i < ready; i++) {
+            conn *c = events[i].data.ptr;
+            if (c->state == 0) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err || send(c->fd, "PING\r\n", 6, MSG_NOSIGNAL) != 6) {
+                    c->state = 2;
+                    failed++;
+                    close(c->fd);
+                    continue;
+                }
+                c->state = 1;
+                struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+                epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+            } else if (c->state == 1) {
+                char buf[64];
+                ssize_t r = recv(c->fd, buf, sizeof(buf), 0);
+                if (r <= 0) {
+                    c->state = 2;
+                    failed++;
+                    close(c->fd);
+                    continue;
+                }
+                c->got += r;
+                if (c->got >= 7) {
+                    c->latency = now_sec() - c->start;
+                    c->state = 2;
+                    done++;
+                }
+            }
+        }
+    }
+    double secs = now_sec() - storm_start;
+
+    double *lat = malloc((done ? done : 1) * sizeof(double));
+    int k = 0;
+    for (int i = 0; i < opened; i++) {
+        if (conns[i].state == 2 && conns[i].latency > 0) lat[k++] = conns[i].latency * 1000;
+    }
+    qsort(lat, k, sizeof(double), cmp_double);
+
+    printf("  %d of %d connections served in %.3f sec (%.0f conns/sec), %d failed, %d timed out\n",
+           done, n, secs, done / secs, failed, opened - done - failed);
+    if (k > 0) {
+        printf("  connect to reply: p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+               lat[k / 2], lat[(int)(k * 0.90)], lat[(int)(k * 0.99)], lat[k - 1]);
+    }
+
+    for (int i = 0; i < opened; i++) {
+        if (conns[i].state != 2 || conns[i].latency > 0) close(conns[i].fd);
+    }
+    free(lat);
+    free(conns);
+    close(epfd);
+    return 0;
+}
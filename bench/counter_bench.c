@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+#include "alloc_count.h"
+#include "dict.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// counter benchmark: increments/sec and allocations per increment for an
+// INCR-heavy workload. values are CC_INT and updated in place like INCR
+// does; the second pass overwrites them with SET-style numeric strings,
+// which are converted back to integers.
+//   make bench
+//   ./bin/bench/counter_bench [counters] [increments]
+
+int main(int argc, char *argv[]) {
+    size_t ncounters = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+    size_t nincr = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000000;
+
+    char **keys = malloc(ncounters * sizeof(char*));
+    size_t *order = malloc(nincr * sizeof(size_t));
+    char buf[64];
+    for (size_t i = 0; i < ncounters; i++) {
+        snprintf(buf, sizeof(buf), "counter:%zu", i);
+        keys[i] = strdup(buf);
+    }
+    srand(42);
+    for (size_t i = 0; i < nincr; i++) {
+        order[i] = (size_t)rand() % ncounters;
+    }
+
+    dict *d = dict_create(4);
+    for (size_t i = 0; i < ncounters; i++) {
+        dict_set_int(d, keys[i], 0, 0);
+    }
+    while (dict_rehash(d, 1000)) {}
+
+    printf("counter_bench counters=%zu increments=%zu\n", ncounters, nincr);
+
+    // in place, like incr_by() in commands.c
+    size_t allocs_before = allocations;
+    double start = now_sec();
+    for (size_t i = 0; i < nincr; i++) {
+        cc_obj *obj = dict_get(d, keys[order[i]]);
+        obj->ival++;
+    }
+    double secs = now_sec() - start;
+    printf("  in place:  %10.0f incr/sec %6.2f allocs/incr\n",
+           nincr / secs, (double)(allocations - allocs_before) / nincr);
+
+    // format and store the new value as a string
+    allocs_before = allocations;
+    start = now_sec();
+    for (size_t i = 0; i < nincr; i++) {
+        const char *key = keys[order[i]];
+        cc_obj *obj = dict_get(d, key);
+        int len = snprintf(buf, sizeof(buf), "%lld", obj->ival + 1);
+        dict_set(d, key, buf, len, 0);
+    }
+    secs = now_sec() - start;
+    printf("  via set:   %10.0f incr/sec %6.2f allocs/incr\n",
+           nincr / secs, (double)(allocations - allocs_before) / nincr);
+
+    dict_free(d);
+    for (size_t i = 0; i < ncounters; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    free(order);
+    return 0;
+}
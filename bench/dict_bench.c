@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+#include "dict.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+
+// dict engine benchmark: insert rate, lookup rate (hits and misses) and heap
+// bytes per key. run it once per engine to compare:
+//   make bench && make bench DICT_ENGINE=swiss
+//   ./bin/bench/dict_bench [keys] [lookups]
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// large tables are mmapped, so count those blocks too
+static size_t heap_in_use(void) {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+int main(int argc, char *argv[]) {
+    size_t nkeys = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t nlookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 5000000;
+
+    // build keys up front so formatting stays out of the timed loops
+    char **keys = malloc(nkeys * sizeof(char*));
+    char **missing = malloc(nkeys * sizeof(char*));
+    size_t *order = malloc(nlookups * sizeof(size_t));
+    char buf[64];
+    for (size_t i = 0; i < nkeys; i++) {
+        snprintf(buf, sizeof(buf), "user:%zu:session", i);
+        keys[i] = strdup(buf);
+        snprintf(buf, sizeof(buf), "user:%zu:missing", i);
+        missing[i] = strdup(buf);
+    }
+    srand(42);
+    for (size_t i = 0; i < nlookups; i++) {
+        order[i] = ((size_t)rand() * RAND_MAX + rand()) % nkeys;
+    }
+
+    size_t heap_before = heap_in_use();
+    dict *d = dict_create(4);
+
+    double start = now_sec();
+    for (size_t i = 0; i < nkeys; i++) {
+        dict_set(d, keys[i], "value", 5, 0);
+    }
+    while (dict_rehash(d, 1000)) {}
+    double insert_time = now_sec() - start;
+    size_t heap_after = heap_in_use();
+
+    size_t found = 0;
+    start = now_sec();
+    for (size_t i = 0; i < nlookups; i++) {
+        if (dict_get(d, keys[order[i]])) found++;
+    }
+    double hit_time = now_sec() - start;
+
+    size_t misses = 0;
+    start = now_sec();
+    for (size_t i = 0; i < nlookups; i++) {
+        if (!dict_get(d, missing[order[i]])) misses++;
+    }
+    double miss_time = now_sec() - start;
+
+    printf("dict_bench engine=%s keys=%zu\n", DICT_ENGINE_NAME, nkeys);
+    printf("  insert:        %10.0f keys/sec\n", nkeys / insert_time);
+    printf("  lookup (hit):  %10.0f lookups/sec (%zu found)\n", nlookups / hit_time, found);
+    printf("  lookup (miss): %10.0f lookups/sec (%zu missed)\n", nlookups / miss_time, misses);
+    printf("  memory:        %10.1f bytes/key (table %zu slots)\n",
+           (double)(heap_after - heap_before) / nkeys, d->ht[0].size);
+
+    dict_free(d);
+    for (size_t i = 0; i < nkeys; i++) {
+        free(keys[i]);
+        free(missing[i]);
+    }
+    free(keys);
+    free(missing);
+    free(order);
+    return 0;
+}
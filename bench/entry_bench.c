@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include "alloc_count.h"
+#include "dict.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+// entry layout benchmark: heap bytes and allocations per key for many small
+// keys, comparing the single-allocation dict entry with the old layout of
+// four separate allocations (entry, key copy, cc_obj, value copy).
+//   make bench
+//   ./bin/bench/entry_bench [keys]
+
+// the layout before values were embedded in the entry
+typedef struct legacy_obj {
+    void *ptr;
+    cc_type type;
+    uint64_t expire;
+    size_t size;
+    uint64_t last_access;
+} legacy_obj;
+
+typedef struct legacy_entry {
+    char *key;
+    legacy_obj *val;
+    struct legacy_entry *next;
+} legacy_entry;
+
+// strdup allocates inside libc where the wrapper can't see it
+static char *copy_string(const char *s) {
+    size_t len = strlen(s) + 1;
+    return memcpy(malloc(len), s, len);
+}
+
+// large tables are mmapped, so count those blocks too
+static size_t heap_in_use(void) {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static void report(const char *name, size_t nkeys, size_t heap, size_t allocs, double secs) {
+    printf("  %-8s %8.1f bytes/key %6.2f allocs/key %10.0f keys/sec\n",
+           name, (double)heap / nkeys, (double)allocs / nkeys, nkeys / secs);
+}
+
+int main(int argc, char *argv[]) {
+    size_t nkeys = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+    char key[32], val[32];
+
+    printf("entry_bench engine=%s keys=%zu\n", DICT_ENGINE_NAME, nkeys);
+
+    // old layout, in a chained table sized like the dict's
+    size_t buckets = 4;
+    while (buckets < nkeys) buckets *= 2;
+
+    size_t heap_before = heap_in_use();
+    size_t allocs_before = allocations;
+    double start = now_sec();
+
+    legacy_entry **table = calloc(buckets, sizeof(legacy_entry*));
+    for (size_t i = 0; i < nkeys; i++) {
+        snprintf(key, sizeof(key), "key:%08zu", i);
+        snprintf(val, sizeof(val), "v%zu", i % 1000);
+
+        legacy_entry *entry = malloc(sizeof(legacy_entry));
+        entry->key = copy_string(key);
+        entry->val = malloc(sizeof(legacy_obj));
+        entry->val->ptr = copy_string(val);
+        entry->val->type = CC_STRING;
+        entry->val->expire = 0;
+        entry->val->size = strlen(val) + 1;
+        entry->val->last_access = 0;
+
+        size_t idx = dict_hash(key) & (buckets - 1);
+        entry->next = table[idx];
+        table[idx] = entry;
+    }
+
+    report("separate", nkeys, heap_in_use() - heap_before,
+           allocations - allocs_before, now_sec() - start);
+
+    for (size_t i = 0; i < buckets; i++) {
+        legacy_entry *entry = table[i];
+        while (entry) {
+            legacy_entry *next = entry->next;
+            free(entry->val->ptr);
+            free(entry->val);
+            free(entry->key);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(table);
+
+    // current layout
+    heap_before = heap_in_use();
+    allocs_before = allocations;
+    start = now_sec();
+
+    dict *d = dict_create(4);
+    for (size_t i = 0; i < nkeys; i++) {
+        snprintf(key, sizeof(key), "key:%08zu", i);
+        int len = snprintf(val, sizeof(val), "v%zu", i % 1000);
+        dict_set(d, key, val, len, 0);
+    }
+    while (dict_rehash(d, 1000)) {}
+
+    report("embedded", nkeys, heap_in_use() - heap_before,
+           allocations - allocs_before, now_sec() - start);
+    printf("  dict accounting: %.1f bytes/key (%.1f payload)\n",
+           (double)dict_used_memory(d) / nkeys, (double)d->payload_memory / nkeys);
+
+    dict_free(d);
+    return 0;
+}
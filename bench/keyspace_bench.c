@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include "keyspace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// keyspace scaling benchmark: operations/sec against the number of client
+// threads, with a single shard (one global lock) and with the sharded
+// keyspace. every operation takes its shard lock the way execute_command
+// does, reads with a shared lock and dict_find, writes with an exclusive
+// lock and dict_set.
+//   make bench
+//   ./bin/bench/keyspace_bench [keys] [ops per thread] [write percent] [shards]
+
+#define MAX_THREADS 16
+
+typedef struct worker {
+    pthread_t thread;
+    keyspace *ks;
+    char **keys;
+    size_t nkeys;
+    size_t ops;
+    int write_pct;
+    uint64_t seed;
+    size_t hits;
+} worker;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void *run_worker(void *arg) {
+    worker *w = arg;
+    char val[16];
+
+    for (size_t i = 0; i < w->ops; i++) {
+        uint64_t r = next_random(&w->seed);
+        const char *key = w->keys[r % w->nkeys];
+        int write = (int)((r >> 40) % 100) < w->write_pct;
+
+        keyspace_lockset locks;
+        keyspace_lockset_init(&locks, write);
+        keyspace_lockset_add(w->ks, &locks, key);
+        keyspace_lock(w->ks, &locks);
+
+        dict *d = keyspace_dict(w->ks, key);
+        if (write) {
+            int len = snprintf(val, sizeof(val), "v%zu", i & 1023);
+            dict_set(d, key, val, len, 0);
+        } else if (dict_find(d, key)) {
+            w->hits++;
+        }
+
+        keyspace_unlock(w->ks, &locks);
+    }
+    return NULL;
+}
+
+static double run(keyspace *ks, char **keys, size_t nkeys, int nthreads, size_t ops, int write_pct) {
+    worker workers[MAX_THREADS];
+
+    double start = now_sec();
+    for (int t = 0; t < nthreads; t++) {
+        workers[t] = (worker){.ks = ks, .keys = keys, .nkeys = nkeys, .ops = ops,
+                              .write_pct = write_pct, .seed = 88172645463325252ULL + t * 7919};
+        pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    double secs = now_sec() - start;
+    return (double)ops * nthreads / secs;
+}
+
+int main(int argc, char *argv[]) {
+    size_t nkeys = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    size_t ops = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    int write_pct = argc > 3 ? atoi(argv[3]) : 10;
+    int shards = argc > 4 ? atoi(argv[4]) : KEYSPACE_DEFAULT_SHARDS;
+
+    char **keys = malloc(nkeys * sizeof(char*));
+    char buf[32];
+    for (size_t i = 0; i < nkeys; i++) {
+        snprintf(buf, sizeof(buf), "key:%zu", i);
+        keys[i] = strdup(buf);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("keyspace_bench engine=%s keys=%zu ops/thread=%zu writes=%d%% cpus=%ld\n",
+           DICT_ENGINE_NAME, nkeys, ops, write_pct, cpus);
+    printf("  %-8s %14s %14s\n", "threads", "1 shard", "sharded");
+
+    keyspace *single = keyspace_create(1, nkeys);
+    keyspace *sharded = keyspace_create(shards, nkeys);
+    for (size_t i = 0; i < nkeys; i++) {
+        dict_set(keyspace_dict(single, keys[i]), keys[i], "v", 1, 0);
+        dict_set(keyspace_dict(sharded, keys[i]), keys[i], "v", 1, 0);
+    }
+    keyspace_rehash_ms(single, 1000);
+    keyspace_rehash_ms(sharded, 1000);
+
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        double a = run(single, keys, nkeys, threads, ops, write_pct);
+        double b = run(sharded, keys, nkeys, threads, ops, write_pct);
+        printf("  %-8d %10.0f/sec %10.0f/sec  (%d shards)\n", threads, a, b, sharded->nshards);
+    }
+
+    keyspace_free(single);
+    keyspace_free(sharded);
+    for (size_t i = 0; i < nkeys; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+// request/response throughput with many open connections: every connection
+// sends a PING, waits for the PONG and sends the next one, for a fixed time.
+// reports requests/sec and the PING latency percentiles for each port
+// given, so two servers (or two models of the same server) can be compared
+// side by side under the same load, e.g. epoll against io_uring:
+//   ./bin/crimsoncache epoll.conf &     (concurrency eventloop, port 6379)
+//   ./bin/crimsoncache uring.conf &     (concurrency uring, port 6380)
+//   ./bin/bench/net_bench 1000 5 6379 6380
+//   ./bin/bench/net_bench 10000 5 6379 6380
+// the servers need maxClients and tcp-backlog above the connection count
+
+#define CLIENT_THREADS 4
+#define BUCKET_US      10          // latency histogram resolution
+#define BUCKETS        100000      // up to a second, slower goes in the last
+
+static const char ping[] = "PING\r\n";
+#define PONG_LEN 7                 // "+PONG\r\n"
+
+typedef struct conn {
+    int fd;
+    int got;          // bytes of the current PONG received
+    double sent_at;
+} conn;
+
+typedef struct worker {
+    pthread_t thread;
+    conn *conns;
+    int count;
+    int epfd;
+    double deadline;
+    long requests;
+    long failed;
+    unsigned *histogram;
+} worker;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int server_up(const struct sockaddr_in *addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) return 0;
+    int up = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(fd);
+    return up;
+}
+
+static void raise_fd_limit(int n) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+    if (rl.rlim_cur >= (rlim_t)n + 64) return;
+    rl.rlim_cur = rl.rlim_max == RLIM_INFINITY || rl.rlim_max > (rlim_t)n + 64 ? (rlim_t)n + 64 : rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0) perror("setrlimit");
+}
+
+static int send_ping(conn *c) {
+    c->sent_at = now_sec();
+    c->got = 0;
+    return send(c->fd, ping, sizeof(ping) - 1, MSG_NOSIGNAL) == (ssize_t)(sizeof(ping) - 1);
+}
+
+static void drop_conn(worker *w, conn *c) {
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    w->failed++;
+}
+
+static void *run_worker(void *arg) {
+    worker *w = arg;
+    struct epoll_event events[256];
+
+    for (int i = 0; i < w->count; i++) {
+        if (w->conns[i].fd != -1 && !send_ping(&w->conns[i])) drop_conn(w, &w->conns[i]);
+    }
+    while (now_sec() < w->deadline) {
+        int ready = epoll_wait(w->epfd, events, 256, 10);
+        for (int i = 0; i < ready; i++) {
+            conn *c = events[i].data.ptr;
+            char buf[64];
+            ssize_t r = recv(c->fd, buf, sizeof(buf), 0);
+            if (r < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            if (r <= 0) {
+                drop_conn(w, c);
+                continue;
+            }
+            c->got += r;
+            if (c->got < PONG_LEN) continue;
+
+            double us = (now_sec() - c->sent_at) * 1e6;
+            long bucket = (long)(us / BUCKET_US);
+            w->histogram[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+            w->requests++;
+            if (!send_ping(c)) drop_conn(w, c);
+        }
+    }
+    return NULL;
+}
+
+// latency below which a fraction of the requests completed, in ms
+static double percentile(const unsigned *histogram, long total, double fraction) {
+    long target = (long)(total * fraction);
+    long seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen > target) return (i + 1) * BUCKET_US / 1000.0;
+    }
+    return BUCKETS * BUCKET_US / 1000.0;
+}
+
+static void bench_port(int port, int n, double seconds) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    printf("  port %d: ", port);
+    fflush(stdout);
+    if (!server_up(&addr)) {
+        printf("no server listening, skipped\n");
+        return;
+    }
+
+    worker workers[CLIENT_THREADS];
+    memset(workers, 0, sizeof(workers));
+    int opened = 0;
+    for (int t = 0; t < CLIENT_THREADS; t++) {
+        worker *w = &workers[t];
+        w->count = n / CLIENT_THREADS + (t < n % CLIENT_THREADS);
+        w->conns = calloc(w->count, sizeof(conn));
+        w->histogram = calloc(BUCKETS, sizeof(unsigned));
+        w->epfd = epoll_create1(0);
+        if (!w->conns || !w->histogram || w->epfd == -1) {
+            perror("setup failed");
+            exit(1);
+        }
+        for (int i = 0; i < w->count; i++) {
+            conn *c = &w->conns[i];
+            c->fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (c->fd == -1 || connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                if (c->fd != -1) close(c->fd);
+                c->fd = -1;
+                continue;
+            }
+            int one = 1;
+            setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+            epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+            opened++;
+        }
+    }
+
+    double start = now_sec();
+    for (int t = 0; t < CLIENT_THREADS; t++) {
+        workers[t].deadline = start + seconds;
+        pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+    }
+
+    unsigned *histogram = calloc(BUCKETS, sizeof(unsigned));
+    long requests = 0, failed = 0;
+    for (int t = 0; t < CLIENT_THREADS; t++) {
+        worker *w = &workers[t];
+        pthread_join(w->thread, NULL);
+        requests += w->requests;
+        failed += w->failed;
+        for (int i = 0; i < BUCKETS; i++) {
+            histogram[i] += w->histogram[i];
+        }
+        for (int i = 0; i < w->count; i++) {
+            if (w->conns[i].fd != -1) close(w->conns[i].fd);
+        }
+        close(w->epfd);
+        free(w->conns);
+        free(w->histogram);
+    }
+    double secs = now_sec() - start;
+
+    printf("%d of %d connected, %.0f requests/sec", opened, n, requests / secs);
+    if (requests > 0) {
+        printf("  p50 %.2f ms  p99 %.2f ms  p99.9 %.2f ms",
+               percentile(histogram, requests, 0.50), percentile(histogram, requests, 0.99),
+               percentile(histogram, requests, 0.999));
+    }
+    if (failed > 0) printf("  (%ld connections dropped)", failed);
+    printf("\n");
+    free(histogram);
+
+    // let the server finish closing them before the next port is measured
+    sleep(1);
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+    double seconds = argc > 2 ? atof(argv[2]) : 5;
+    if (n < 1 || seconds <= 0) {
+        fprintf(stderr, "usage: net_bench [connections] [seconds] [port...]\n");
+        return 1;
+    }
+    raise_fd_limit(n);
+
+    printf("net_bench connections=%d seconds=%.0f\n", n, seconds);
+    if (argc <= 3) {
+        bench_port(6379, n, seconds);
+    }
+    for (int i = 3; i < argc; i++) {
+        bench_port(atoi(argv[i]), n, seconds);
+    }
+    return 0;
+}
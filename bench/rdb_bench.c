@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+#include "persistence.h"
+#include "config.h"
+#include "crc64.h"
+#include "lz4.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// rdb loading benchmark: seconds to load a dump of counters and short
+// json-like values (a tenth of them with a TTL) into an empty keyspace.
+// "stdio" is the loader load_rdb_from_file replaced: a fread per field,
+// tables growing from their initial size by doubling, the clock read per
+// key. the others map the file, size the tables from the file's hint and
+// decode its sections with 1 to 8 threads (rdb-load-threads). the file is
+// in the page cache for every run, so this is decoding and inserting only
+//   make bench
+//   ./bin/bench/rdb_bench [keys] [shards]
+
+#define MAX_THREADS 8
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t current_time_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// the old loader, checksumming every field it reads
+typedef struct old_reader {
+    FILE *fp;
+    uint64_t crc;
+} old_reader;
+
+static int old_bytes(old_reader *r, void *data, size_t n) {
+    if (n > 0 && fread(data, n, 1, r->fp) != 1) return 0;
+    r->crc = crc64(r->crc, data, n);
+    return 1;
+}
+
+static int old_varint(old_reader *r, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char b;
+        if (!old_bytes(r, &b, 1)) return 0;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return 1;
+    }
+    return 0;
+}
+
+static int old_string(old_reader *r, char **buf, size_t *cap, size_t *len) {
+    uint64_t n;
+    if (!old_varint(r, &n)) return 0;
+    if (n + 1 > *cap) {
+        *cap = n + 1;
+        *buf = realloc(*buf, *cap);
+    }
+    if (!old_bytes(r, *buf, n)) return 0;
+    (*buf)[n] = '\0';
+    *len = n;
+    return 1;
+}
+
+static int old_load(keyspace *db, const char *filename) {
+    old_reader r = {fopen(filename, "rb"), 0};
+    char header[8];
+    char *key = NULL, *val = NULL, *packed = NULL;
+    size_t key_cap = 0, val_cap = 0, packed_cap = 0;
+    int ok = 0;
+    if (!r.fp || !old_bytes(&r, header, 8)) goto done;
+
+    uint64_t expire = 0;
+    while (1) {
+        unsigned char type;
+        uint64_t n;
+        size_t key_len, len, packed_len;
+        if (!old_bytes(&r, &type, 1)) goto done;
+        if (type == RDB_END) break;
+        if (type == RDB_OPCODE_RESIZE) {
+            if (!old_varint(&r, &n)) goto done;
+            continue;
+        }
+        if (type == RDB_OPCODE_SECTIONS) {
+            unsigned char skip[8];
+            if (!old_varint(&r, &n)) goto done;
+            for (uint64_t i = 0; i <= n; i++) {
+                if (!old_bytes(&r, skip, 8)) goto done;
+            }
+            continue;
+        }
+        if (type == RDB_OPCODE_EXPIRE_MS) {
+            unsigned char bytes[8];
+            if (!old_bytes(&r, bytes, 8)) goto done;
+            expire = 0;
+            for (int i = 0; i < 8; i++) expire |= (uint64_t)bytes[i] << (8 * i);
+            continue;
+        }
+
+        if (!old_string(&r, &key, &key_cap, &key_len)) goto done;
+        long long ival = 0;
+        if (type == RDB_TYPE_INT) {
+            if (!old_varint(&r, &n)) goto done;
+            ival = (long long)(n >> 1) ^ -(long long)(n & 1);
+        } else if (type == RDB_TYPE_STRING) {
+            if (!old_string(&r, &val, &val_cap, &len)) goto done;
+        } else {
+            if (!old_varint(&r, &n) || !old_string(&r, &packed, &packed_cap, &packed_len)) goto done;
+            len = n;
+            if (len + 1 > val_cap) {
+                val_cap = len + 1;
+                val = realloc(val, val_cap);
+            }
+            if (!lz4_decompress(packed, packed_len, val, len)) goto done;
+        }
+
+        if (expire == 0 || expire >= current_time_ms()) {
+            dict *d = keyspace_dict(db, key);
+            if (type == RDB_TYPE_INT) {
+                dict_set_int(d, key, ival, expire);
+            } else {
+                dict_set(d, key, val, len, expire);
+            }
+        }
+        expire = 0;
+    }
+    unsigned char stored[8];
+    uint64_t crc = r.crc;
+    if (fread(stored, 8, 1, r.fp) != 1) goto done;
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)stored[i] << (8 * i);
+    ok = v == crc;
+
+done:
+    if (r.fp) fclose(r.fp);
+    free(key);
+    free(val);
+    free(packed);
+    return ok;
+}
+
+static size_t keyspace_keys(keyspace *ks) {
+    size_t keys = 0;
+    for (int i = 0; i < ks->nshards; i++) keys += ks->shards[i].d->used;
+    return keys;
+}
+
+// load the file into a fresh keyspace, threads 0 for the old loader
+static double run(const char *filename, int shards, int threads, size_t expected) {
+    keyspace *ks = keyspace_create(shards, 1024);
+    double start = now_sec();
+    int ok;
+    if (threads == 0) {
+        ok = old_load(ks, filename);
+    } else {
+        config.rdb_load_threads = threads;
+        ok = load_rdb_from_file(ks, filename);
+    }
+    double secs = now_sec() - start;
+    size_t keys = keyspace_keys(ks);
+    if (!ok || keys != expected) {
+        fprintf(stderr, "load failed: %zu of %zu keys\n", keys, expected);
+        exit(1);
+    }
+    keyspace_free(ks);
+    return secs;
+}
+
+int main(int argc, char *argv[]) {
+    size_t nkeys = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    int shards = argc > 2 ? atoi(argv[2]) : KEYSPACE_DEFAULT_SHARDS;
+
+    load_default_config();
+    keyspace *ks = keyspace_create(shards, nkeys);
+    uint64_t now = current_time_ms();
+    char key[64], val[128];
+    for (size_t i = 0; i < nkeys; i++) {
+        uint64_t expire = i % 10 == 0 ? now + 3600 * 1000 : 0;
+        if (i % 3 == 0) {
+            snprintf(key, sizeof(key), "counter:%zu", i);
+            dict_set_int(keyspace_dict(ks, key), key, (long long)(i * 7919 % 100000), expire);
+        } else {
+            snprintf(key, sizeof(key), "user:%zu:session", i);
+            int len = snprintf(val, sizeof(val),
+                               "{\"id\":%zu,\"name\":\"user%zu\",\"roles\":[\"reader\",\"writer\"]}", i, i);
+            dict_set(keyspace_dict(ks, key), key, val, len, expire);
+        }
+    }
+
+    char filename[] = "/tmp/rdb_bench.XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1 || !save_rdb_to_file(ks, filename)) {
+        fprintf(stderr, "could not write %s\n", filename);
+        return 1;
+    }
+    close(fd);
+    keyspace_free(ks);
+
+    FILE *fp = fopen(filename, "rb");
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("rdb_bench engine=%s keys=%zu shards=%d file=%.1fMB cpus=%ld\n",
+           DICT_ENGINE_NAME, nkeys, shards, size / 1e6, cpus);
+
+    // once untimed, to have the file in the page cache
+    run(filename, shards, 1, nkeys);
+
+    double base = run(filename, shards, 0, nkeys);
+    printf("  %-20s %8.3fs %10.0f keys/sec\n", "stdio, growing", base, nkeys / base);
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        double secs = run(filename, shards, threads, nkeys);
+        char label[32];
+        snprintf(label, sizeof(label), "mmap, %d thread%s", threads, threads > 1 ? "s" : "");
+        printf("  %-20s %8.3fs %10.0f keys/sec  (%.2fx)\n", label, secs, nkeys / secs, base / secs);
+    }
+
+    unlink(filename);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+#include "alloc_count.h"
+#include "resp.h"
+#include "dict.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// request parsing benchmark: commands/sec and allocations per command for
+// a pipelined buffer of RESP commands, parsed in place into a reused argv
+// the way process_client_buffer does. "copied" additionally makes the
+// copies the old tokenizer made (the input, the token array and every
+// token), "+ dict" stores SET values like set_command does.
+//   make bench
+//   ./bin/bench/resp_bench [commands]
+
+typedef enum { PARSE_ONLY, PARSE_COPIED, PARSE_DICT } mode;
+
+// a pipeline of n commands with nargs arguments after the name
+static char *build_pipeline(size_t n, const char *name, int nargs, size_t *len) {
+    char *buf = NULL;
+    size_t cap = 0, used = 0;
+    char line[256];
+
+    for (size_t i = 0; i < n; i++) {
+        int l = snprintf(line, sizeof(line), "*%d\r\n$%zu\r\n%s\r\n", nargs + 1, strlen(name), name);
+        for (int a = 0; a < nargs; a++) {
+            char arg[32];
+            int al = snprintf(arg, sizeof(arg), a == 0 ? "key:%zu" : "value:%zu", i % 10000);
+            l += snprintf(line + l, sizeof(line) - l, "$%d\r\n%s\r\n", al, arg);
+        }
+        if (used + l > cap) {
+            cap = cap ? cap * 2 : 1 << 20;
+            buf = realloc(buf, cap);
+        }
+        memcpy(buf + used, line, l);
+        used += l;
+    }
+    *len = used;
+    return buf;
+}
+
+static void run(const char *label, const char *name, int nargs, size_t n, mode m) {
+    size_t len;
+    char *pipeline = build_pipeline(n, name, nargs, &len);
+    char *buf = malloc(len);
+    memcpy(buf, pipeline, len);
+
+    resp_command cmd;
+    resp_command_init(&cmd);
+    dict *d = dict_create(16384);
+
+    size_t allocs_before = allocations;
+    double start = now_sec();
+    size_t pos = 0, commands = 0;
+    while (pos < len) {
+        size_t consumed;
+        const char *error;
+        if (resp_parse_command(buf + pos, len - pos, &consumed, &cmd, &error) != RESP_PARSE_OK) break;
+
+        if (m == PARSE_COPIED) {
+            char *input = malloc(consumed + 1);
+            memcpy(input, buf + pos, consumed);
+            char **tokens = malloc(cmd.argc * sizeof(char*));
+            for (int i = 0; i < cmd.argc; i++) {
+                tokens[i] = malloc(cmd.argv_len[i] + 1);
+                memcpy(tokens[i], cmd.argv[i], cmd.argv_len[i] + 1);
+            }
+            for (int i = 0; i < cmd.argc; i++) {
+                free(tokens[i]);
+            }
+            free(tokens);
+            free(input);
+        } else if (m == PARSE_DICT) {
+            dict_set(d, cmd.argv[1], cmd.argv[2], cmd.argv_len[2], 0);
+        }
+        pos += consumed;
+        commands++;
+    }
+    double secs = now_sec() - start;
+
+    printf("  %-22s %10.0f cmds/sec %6.2f allocs/cmd\n", label,
+           commands / secs, (double)(allocations - allocs_before) / commands);
+
+    dict_free(d);
+    resp_command_free(&cmd);
+    free(buf);
+    free(pipeline);
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    printf("resp_bench commands=%zu\n", n);
+    run("GET parsed", "GET", 1, n, PARSE_ONLY);
+    run("GET copied", "GET", 1, n, PARSE_COPIED);
+    run("SET parsed", "SET", 2, n, PARSE_ONLY);
+    run("SET copied", "SET", 2, n, PARSE_COPIED);
+    run("SET parsed + dict", "SET", 2, n, PARSE_DICT);
+    run("10 args parsed", "EXISTS", 10, n, PARSE_ONLY);
+    run("10 args copied", "EXISTS", 10, n, PARSE_COPIED);
+    return 0;
+}
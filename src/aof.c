@@ -0,0 +1,699 @@
+#define _GNU_SOURCE // for fdatasync
+#include "aof.h"
+#include "commands.h"
+#include "config.h"
+#include "resp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define AOF_READ_CHUNK (64 * 1024)       // replay reads the file this much at a time
+#define AOF_BUFFER_MIN (16 * 1024)
+#define AOF_BUFFER_IDLE (1024 * 1024)    // larger buffers are freed once written, not reused
+#define AOF_REWRITE_LAST_BATCH (64 * 1024) // writes left over when a rewrite swaps the files
+#define AOF_REWRITE_RETRY_SEC 10         // after a failed rewrite, before the next automatic one
+
+static pthread_mutex_t aof_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aof_work = PTHREAD_COND_INITIALIZER;     // wakes the aof thread
+static pthread_cond_t aof_done = PTHREAD_COND_INITIALIZER;     // wakes aof_wait_synced
+static pthread_t aof_thread;
+static int aof_fd = -1;
+static int aof_on = 0;              // logging, checked by aof_feed_command without the lock
+static int aof_stopping = 0;
+static int aof_flush_requested = 0;
+static int aof_write_ok = 1;        // the last write (and fsync) worked, read without the lock
+
+// records logged since the aof thread last took them
+static char *aof_buf = NULL;
+static size_t aof_len = 0;
+static size_t aof_cap = 0;
+
+// positions in the stream of everything logged since the start, in bytes.
+// updated under aof_lock, read without it on the fast paths
+static uint64_t aof_appended = 0;   // logged
+static uint64_t aof_taken = 0;      // taken by the aof thread
+static uint64_t aof_written = 0;    // written to the file
+static uint64_t aof_synced = 0;     // on disk (just written with appendfsync no)
+static off_t aof_size = 0;          // of the file
+static off_t aof_base_size = 0;     // of the file when logging started or it was last rewritten
+
+// a rewrite replaces the file with the dataset's current contents: a child
+// process writes the dataset as of the fork to a new file while the writes
+// made since are also kept in rewrite_buf. once the child is done the aof
+// thread appends them to the new file, a batch per round, and when little
+// is left it appends the rest and swaps the files
+typedef enum {
+    REWRITE_NONE,
+    REWRITE_CHILD,  // the child is writing the dataset
+    REWRITE_DIFF,   // the child is done, writes made since go to the new file
+    REWRITE_SWAP    // every write made since is in the new file or rewrite_buf
+} rewrite_state_t;
+
+static keyspace *aof_db = NULL;
+static rewrite_state_t rewrite_state = REWRITE_NONE;
+static pid_t rewrite_pid = -1;
+static int rewrite_fd = -1;         // the new file, once the child is done with it
+static char *rewrite_buf = NULL;    // writes made since the fork, not in the new file yet
+static size_t rewrite_len = 0;
+static size_t rewrite_cap = 0;
+static int rewrite_lost = 0;        // a write made meanwhile didn't fit in rewrite_buf
+static int rewrite_ok = 1;          // the last rewrite worked
+static double rewrite_failed_at = 0;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *fsync_policy_name(aof_fsync_t policy) {
+    switch (policy) {
+        case AOF_FSYNC_ALWAYS: return "always";
+        case AOF_FSYNC_NO: return "no";
+        default: return "everysec";
+    }
+}
+
+// wait on cond for at most a second
+static void wait_a_second(pthread_cond_t *cond) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    pthread_cond_timedwait(cond, &aof_lock, &deadline);
+}
+
+static void rewrite_step(void);
+
+// writes the records handed to it, and fsyncs them as appendfsync says.
+// whatever every thread logged during a round goes out in one write, and
+// with appendfsync always everyone waiting meanwhile shares one fsync
+static void *aof_thread_main(void *arg) {
+    (void)arg;
+    char *buf = NULL;   // records being written
+    size_t len = 0, cap = 0, done = 0;
+    uint64_t end = 0;   // stream position at the end of buf
+    double last_fsync = now_sec();
+
+    pthread_mutex_lock(&aof_lock);
+    while (1) {
+        // a second at most, so everysec syncs and the records of the
+        // replication link (no event loop flushes those) get written
+        if (!aof_flush_requested && !aof_stopping) wait_a_second(&aof_work);
+        aof_flush_requested = 0;
+        int stopping = aof_stopping;
+
+        if (done == len) {
+            // swap buffers: new records go to the one just written
+            if (cap > AOF_BUFFER_IDLE) {
+                free(buf);
+                buf = NULL;
+                cap = 0;
+            }
+            char *spare = buf;
+            size_t spare_cap = cap;
+            buf = aof_buf;
+            len = aof_len;
+            cap = aof_cap;
+            done = 0;
+            aof_buf = spare;
+            aof_cap = spare_cap;
+            aof_len = 0;
+            end = aof_appended;
+            __atomic_store_n(&aof_taken, end, __ATOMIC_RELEASE);
+        }
+        uint64_t synced = aof_synced;
+        pthread_mutex_unlock(&aof_lock);
+
+        while (done < len) {
+            ssize_t n = write(aof_fd, buf + done, len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        int ok = done == len;
+        if (ok && end > synced) {
+            double now = now_sec();
+            if (config.appendfsync == AOF_FSYNC_NO) {
+                synced = end; // the kernel writes it back when it sees fit
+            } else if (config.appendfsync == AOF_FSYNC_ALWAYS || stopping || now - last_fsync >= 1) {
+                ok = fdatasync(aof_fd) == 0;
+                if (ok) {
+                    synced = end;
+                    last_fsync = now;
+                }
+            }
+        }
+
+        pthread_mutex_lock(&aof_lock);
+        if (ok) {
+            aof_size += end - aof_written;
+            __atomic_store_n(&aof_written, end, __ATOMIC_RELEASE);
+            __atomic_store_n(&aof_synced, synced, __ATOMIC_RELEASE);
+            __atomic_store_n(&aof_write_ok, 1, __ATOMIC_RELEASE);
+            pthread_cond_broadcast(&aof_done);
+        } else {
+            if (aof_write_ok) {
+                fprintf(stderr, "aof: writing %s failed: %s, retrying every second, "
+                        "write commands are refused meanwhile\n", config.aof_filename, strerror(errno));
+            }
+            // nobody waits for a write that may never make it, see aof_wait_synced
+            __atomic_store_n(&aof_write_ok, 0, __ATOMIC_RELEASE);
+            pthread_cond_broadcast(&aof_done);
+        }
+        if (stopping && (!ok || aof_len == 0)) break;
+        // a failing disk is retried once a second, not on every request
+        if (!ok) wait_a_second(&aof_work);
+        else if (!stopping) rewrite_step();
+    }
+    pthread_mutex_unlock(&aof_lock);
+    free(buf);
+    return NULL;
+}
+
+// make room for len more bytes in a buffer
+static int reserve(char **buf, size_t used, size_t *cap, size_t len) {
+    if (used + len <= *cap) return 1;
+    size_t grown_cap = *cap ? *cap : AOF_BUFFER_MIN;
+    while (grown_cap < used + len) grown_cap *= 2;
+    char *grown = realloc(*buf, grown_cap);
+    if (!grown) return 0;
+    *buf = grown;
+    *cap = grown_cap;
+    return 1;
+}
+
+// add a command to aof_buf, and to rewrite_buf while a rewrite needs the
+// writes made since it started. called with aof_lock held
+static void append_locked(int argc, char **argv, const size_t *argv_len) {
+    size_t len = resp_command_size(argc, argv_len);
+    if (!reserve(&aof_buf, aof_len, &aof_cap, len)) {
+        fprintf(stderr, "aof: out of memory, a %s command was not logged\n", argv[0]);
+        return;
+    }
+    resp_encode_command(aof_buf + aof_len, argc, argv, argv_len);
+    if ((rewrite_state == REWRITE_CHILD || rewrite_state == REWRITE_DIFF) && !rewrite_lost) {
+        if (reserve(&rewrite_buf, rewrite_len, &rewrite_cap, len)) {
+            memcpy(rewrite_buf + rewrite_len, aof_buf + aof_len, len);
+            rewrite_len += len;
+        } else {
+            // the new file would miss the write, the aof thread gives up on it
+            rewrite_lost = 1;
+        }
+    }
+    aof_len += len;
+    __atomic_store_n(&aof_appended, aof_appended + len, __ATOMIC_RELEASE);
+}
+
+static int is_name(const char *arg, size_t len, const char *name) {
+    return len == strlen(name) && strncasecmp(arg, name, len) == 0;
+}
+
+// relative expire times would start over every time the file is loaded,
+// so EXPIRE and SET with EX/PX are logged with the time they set instead:
+// PEXPIREAT with the key's expire, or DEL when it has passed already
+void aof_feed_command(keyspace *db, int argc, char **argv, const size_t *argv_len) {
+    if (!__atomic_load_n(&aof_on, __ATOMIC_ACQUIRE)) return;
+
+    int logged = argc;   // arguments logged as they came
+    int expire = 0;      // the key's expire follows
+    if (is_name(argv[0], argv_len[0], "expire")) {
+        logged = 0;
+        expire = 1;
+    } else if (argc >= 5 && is_name(argv[0], argv_len[0], "set") &&
+               (is_name(argv[3], argv_len[3], "ex") || is_name(argv[3], argv_len[3], "px"))) {
+        logged = 3;
+        expire = 1;
+    }
+
+    char when[24];
+    char *tail[3] = {"PEXPIREAT", argv[1], when};
+    size_t tail_len[3] = {9, argv_len[1], 0};
+    int tail_argc = 0;
+    if (expire) {
+        // the command's shard is still locked, the key is as it left it
+        cc_obj *obj = dict_find(keyspace_dict(db, argv[1]), argv[1]);
+        if (obj && obj->expire) {
+            tail_len[2] = snprintf(when, sizeof(when), "%llu", (unsigned long long)obj->expire);
+            tail_argc = 3;
+        } else if (!obj) {
+            tail[0] = "DEL";
+            tail_len[0] = 3;
+            tail_argc = 2;
+        }
+    }
+
+    pthread_mutex_lock(&aof_lock);
+    if (logged > 0) append_locked(logged, argv, argv_len);
+    if (tail_argc > 0) append_locked(tail_argc, tail, tail_len);
+    pthread_mutex_unlock(&aof_lock);
+}
+
+void aof_flush(void) {
+    if (__atomic_load_n(&aof_appended, __ATOMIC_ACQUIRE) == __atomic_load_n(&aof_taken, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    pthread_mutex_lock(&aof_lock);
+    aof_flush_requested = 1;
+    pthread_cond_signal(&aof_work);
+    pthread_mutex_unlock(&aof_lock);
+}
+
+int aof_unsynced(void) {
+    return config.appendfsync == AOF_FSYNC_ALWAYS && __atomic_load_n(&aof_write_ok, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&aof_synced, __ATOMIC_ACQUIRE) < __atomic_load_n(&aof_appended, __ATOMIC_ACQUIRE);
+}
+
+int aof_write_failing(void) {
+    return __atomic_load_n(&aof_on, __ATOMIC_ACQUIRE) && !__atomic_load_n(&aof_write_ok, __ATOMIC_ACQUIRE);
+}
+
+void aof_wait_synced(void) {
+    if (!aof_unsynced()) return;
+    uint64_t target = __atomic_load_n(&aof_appended, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&aof_lock);
+    aof_flush_requested = 1;
+    pthread_cond_signal(&aof_work);
+    while (aof_synced < target && aof_on && aof_write_ok) {
+        pthread_cond_wait(&aof_done, &aof_lock);
+    }
+    pthread_mutex_unlock(&aof_lock);
+}
+
+// write the dataset as SET commands, with a PEXPIREAT for keys with a ttl.
+// with lock set each shard is read-locked while it is written; a rewrite's
+// child runs without them, its parent holds all the locks across the fork
+static int write_dataset(FILE *fp, keyspace *db, int lock) {
+    for (int i = 0; i < db->nshards; i++) {
+        if (lock) keyspace_lock_shard(db, i, 0);
+        dict_iterator it;
+        dict_entry *entry;
+        int ok = 1;
+        dict_iter_init(&it, db->shards[i].d);
+        while (ok && (entry = dict_iter_next(&it)) != NULL) {
+            if (entry->val.type != CC_STRING && entry->val.type != CC_INT) continue;
+
+            char buf[CC_INT_STR_SIZE];
+            size_t len;
+            const char *str = cc_obj_str(&entry->val, buf, &len);
+            size_t key_len = strlen(entry->key);
+            ok = fprintf(fp, "*3\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%zu\r\n", key_len, entry->key, len) > 0 &&
+                 (len == 0 || fwrite(str, len, 1, fp) == 1) && fputs("\r\n", fp) >= 0;
+            if (ok && entry->val.expire) {
+                char when[24];
+                int when_len = snprintf(when, sizeof(when), "%llu", (unsigned long long)entry->val.expire);
+                ok = fprintf(fp, "*3\r\n$9\r\nPEXPIREAT\r\n$%zu\r\n%s\r\n$%d\r\n%s\r\n",
+                             key_len, entry->key, when_len, when) > 0;
+            }
+        }
+        dict_iter_release(&it);
+        if (lock) keyspace_unlock_shard(db, i);
+        if (!ok) return 0;
+    }
+    return 1;
+}
+
+// write the dataset to filename and fsync it
+static int write_dataset_file(keyspace *db, const char *filename, int lock) {
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) return 0;
+    int ok = write_dataset(fp, db, lock) && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) ok = 0;
+    return ok;
+}
+
+// a new append-only file starts with the dataset it is logging the writes to
+static int write_base(keyspace *db, const char *filename) {
+    char temp_filename[512];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
+
+    int ok = write_dataset_file(db, temp_filename, 1);
+    if (ok && rename(temp_filename, filename) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "aof: could not write %s: %s\n", filename, strerror(errno));
+        unlink(temp_filename);
+    }
+    return ok;
+}
+
+static void rewrite_filename(char *buf, size_t size) {
+    snprintf(buf, size, "%s.rewrite", config.aof_filename);
+}
+
+int aof_rewrite_start(keyspace *db, const char **error) {
+    // no write may be half done when the child's copy of memory is taken,
+    // and every write after that goes to rewrite_buf
+    for (int i = 0; i < db->nshards; i++) {
+        keyspace_lock_shard(db, i, 0);
+    }
+    pthread_mutex_lock(&aof_lock);
+    int started = 0;
+    if (!aof_on) {
+        *error = "ERR append only file is not enabled";
+    } else if (rewrite_state != REWRITE_NONE) {
+        *error = "ERR background append only file rewriting already in progress";
+    } else {
+        char filename[512];
+        rewrite_filename(filename, sizeof(filename));
+        pid_t pid = fork();
+        if (pid == 0) {
+            // the child's copies of the locks are held, it doesn't take them
+            _exit(write_dataset_file(db, filename, 0) ? 0 : 1);
+        } else if (pid == -1) {
+            fprintf(stderr, "aof: fork for rewrite failed: %s\n", strerror(errno));
+            *error = "ERR could not start append only file rewriting";
+        } else {
+            rewrite_state = REWRITE_CHILD;
+            rewrite_pid = pid;
+            rewrite_lost = 0;
+            started = 1;
+            printf("aof: rewrite started with pid %d\n", pid);
+        }
+    }
+    pthread_mutex_unlock(&aof_lock);
+    for (int i = 0; i < db->nshards; i++) {
+        keyspace_unlock_shard(db, i);
+    }
+    return started;
+}
+
+// give up on a rewrite, the old file stays. called with aof_lock held
+static void rewrite_fail(const char *reason) {
+    fprintf(stderr, "aof: rewrite failed: %s\n", reason);
+    if (rewrite_state == REWRITE_CHILD) {
+        kill(rewrite_pid, SIGKILL);
+        waitpid(rewrite_pid, NULL, 0);
+    }
+    if (rewrite_fd != -1) close(rewrite_fd);
+    char filename[512];
+    rewrite_filename(filename, sizeof(filename));
+    unlink(filename);
+
+    rewrite_state = REWRITE_NONE;
+    rewrite_pid = -1;
+    rewrite_fd = -1;
+    free(rewrite_buf);
+    rewrite_buf = NULL;
+    rewrite_len = rewrite_cap = 0;
+    rewrite_ok = 0;
+    rewrite_failed_at = now_sec();
+}
+
+// the file grew by auto-aof-rewrite-percentage since its last rewrite
+static int rewrite_due(void) {
+    if (config.auto_aof_rewrite_percentage <= 0 || aof_size < (off_t)config.auto_aof_rewrite_min_size) {
+        return 0;
+    }
+    if (!rewrite_ok && now_sec() - rewrite_failed_at < AOF_REWRITE_RETRY_SEC) return 0;
+    off_t base = aof_base_size > 0 ? aof_base_size : 1;
+    return aof_size >= base + base * config.auto_aof_rewrite_percentage / 100;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// run by the aof thread between rounds, with aof_lock held and everything
+// it took written: starts a rewrite when the file grew enough, and moves a
+// running one on. drops aof_lock while writing the new file
+static void rewrite_step(void) {
+    if (rewrite_state == REWRITE_NONE) {
+        if (rewrite_due()) {
+            const char *error;
+            printf("aof: %s grew to %lld bytes, rewriting it\n", config.aof_filename, (long long)aof_size);
+            pthread_mutex_unlock(&aof_lock);
+            aof_rewrite_start(aof_db, &error);
+            pthread_mutex_lock(&aof_lock);
+        }
+        return;
+    }
+    if (rewrite_lost) {
+        rewrite_fail("out of memory for the writes made meanwhile");
+        return;
+    }
+
+    char filename[512];
+    rewrite_filename(filename, sizeof(filename));
+    if (rewrite_state == REWRITE_CHILD) {
+        int status;
+        pid_t pid = waitpid(rewrite_pid, &status, WNOHANG);
+        if (pid == 0) return; // still writing
+        if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            rewrite_state = REWRITE_NONE; // nothing to kill
+            rewrite_fail("the child could not write the dataset");
+            return;
+        }
+        rewrite_fd = open(filename, O_WRONLY | O_APPEND);
+        if (rewrite_fd == -1) {
+            rewrite_fail(strerror(errno));
+            return;
+        }
+        rewrite_state = REWRITE_DIFF;
+    }
+
+    // the writes made since the last batch
+    char *diff = rewrite_buf;
+    size_t diff_len = rewrite_len;
+    rewrite_buf = NULL;
+    rewrite_len = rewrite_cap = 0;
+
+    // few enough to finish with: the diff ends here. the records not taken
+    // by the aof thread yet are in it, they go to the new file only
+    int last = diff_len <= AOF_REWRITE_LAST_BATCH;
+    char *held = NULL;
+    size_t held_len = 0;
+    uint64_t end = aof_appended;
+    if (last) {
+        rewrite_state = REWRITE_SWAP;
+        held = aof_buf;
+        held_len = aof_len;
+        aof_buf = NULL;
+        aof_len = aof_cap = 0;
+        __atomic_store_n(&aof_taken, end, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&aof_lock);
+
+    int ok = write_all(rewrite_fd, diff, diff_len);
+    free(diff);
+    struct stat st;
+    if (ok && last) {
+        ok = fdatasync(rewrite_fd) == 0 && fstat(rewrite_fd, &st) == 0 &&
+             rename(filename, config.aof_filename) == 0;
+    }
+    const char *reason = strerror(errno);
+
+    pthread_mutex_lock(&aof_lock);
+    if (!ok) {
+        if (last && write_all(aof_fd, held, held_len)) {
+            // the held records go where they would have gone
+            aof_size += end - aof_written;
+            __atomic_store_n(&aof_written, end, __ATOMIC_RELEASE);
+        } else if (last) {
+            fprintf(stderr, "aof: writing %s failed, %zu bytes of writes are lost\n",
+                    config.aof_filename, held_len);
+        }
+        free(held);
+        rewrite_fail(reason);
+        return;
+    }
+    if (!last) return;
+
+    close(aof_fd);
+    aof_fd = rewrite_fd;
+    aof_size = aof_base_size = st.st_size;
+    __atomic_store_n(&aof_written, end, __ATOMIC_RELEASE);
+    __atomic_store_n(&aof_synced, end, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&aof_done);
+    free(held);
+    rewrite_state = REWRITE_NONE;
+    rewrite_pid = -1;
+    rewrite_fd = -1;
+    rewrite_ok = 1;
+    printf("aof: rewrite done, %s is down to %lld bytes\n", config.aof_filename, (long long)aof_size);
+}
+
+int aof_load(keyspace *db, const char *filename) {
+    int fd = open(filename, O_RDWR);
+    if (fd == -1) {
+        if (errno == ENOENT) return 1;
+        fprintf(stderr, "aof: could not open %s: %s\n", filename, strerror(errno));
+        return 0;
+    }
+
+    size_t capacity = AOF_READ_CHUNK;
+    char *buf = malloc(capacity);
+    resp_command cmd;
+    resp_command_init(&cmd);
+    size_t len = 0;         // bytes in buf
+    off_t start = 0;        // file offset of buf[0]
+    size_t commands = 0;
+    int result = 0;
+    if (!buf) goto cleanup;
+
+    while (1) {
+        ssize_t n = read(fd, buf + len, capacity - len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            fprintf(stderr, "aof: reading %s failed: %s\n", filename, strerror(errno));
+            goto cleanup;
+        }
+        len += n;
+        buf[len] = '\0';
+
+        // run every complete command, writes go through the usual handlers
+        size_t pos = 0;
+        while (pos < len) {
+            size_t consumed;
+            const char *error;
+            resp_parse_result parsed = resp_parse_command(buf + pos, len - pos, &consumed, &cmd, &error);
+            if (parsed == RESP_PARSE_INCOMPLETE) break;
+            if (parsed == RESP_PARSE_ERROR) {
+                fprintf(stderr, "aof: %s is corrupt at offset %lld: %s\n",
+                        filename, (long long)(start + pos), error);
+                goto cleanup;
+            }
+            if (cmd.argc > 0) {
+                execute_command_argv(NULL, cmd.argc, cmd.argv, cmd.argv_len, db);
+                commands++;
+            }
+            pos += consumed;
+        }
+
+        memmove(buf, buf + pos, len - pos);
+        start += pos;
+        len -= pos;
+
+        if (n == 0) {
+            if (len > 0) {
+                // the server died while writing the last command, drop it
+                fprintf(stderr, "aof: %s ends with %zu bytes of an incomplete command, truncating it\n",
+                        filename, len);
+                if (ftruncate(fd, start) != 0) {
+                    fprintf(stderr, "aof: could not truncate %s: %s\n", filename, strerror(errno));
+                    goto cleanup;
+                }
+            }
+            break;
+        }
+
+        // room for the rest of a command larger than the buffer
+        size_t needed = cmd.needed > len ? cmd.needed : len;
+        if (needed + AOF_READ_CHUNK / 2 >= capacity) {
+            size_t grown_capacity = capacity * 2;
+            while (grown_capacity < needed + AOF_READ_CHUNK) grown_capacity *= 2;
+            char *grown = realloc(buf, grown_capacity);
+            if (!grown) goto cleanup;
+            buf = grown;
+            capacity = grown_capacity;
+        }
+    }
+
+    printf("aof: loaded %zu commands from %s\n", commands, filename);
+    result = 1;
+
+cleanup:
+    resp_command_free(&cmd);
+    free(buf);
+    close(fd);
+    return result;
+}
+
+int aof_start(keyspace *db, const char *filename) {
+    // a rewrite the server died during left its new file behind
+    char rewrite_file[512];
+    rewrite_filename(rewrite_file, sizeof(rewrite_file));
+    unlink(rewrite_file);
+
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "aof: could not stat %s: %s\n", filename, strerror(errno));
+            return 0;
+        }
+        // first start with appendonly: the log starts from the rdb's dataset
+        if (!write_base(db, filename)) return 0;
+    }
+
+    aof_fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (aof_fd == -1 || fstat(aof_fd, &st) != 0) {
+        fprintf(stderr, "aof: could not open %s: %s\n", filename, strerror(errno));
+        if (aof_fd != -1) close(aof_fd);
+        aof_fd = -1;
+        return 0;
+    }
+    aof_size = aof_base_size = st.st_size;
+    aof_db = db;
+    aof_stopping = 0;
+    if (pthread_create(&aof_thread, NULL, aof_thread_main, NULL) != 0) {
+        perror("failed to create aof thread");
+        close(aof_fd);
+        aof_fd = -1;
+        return 0;
+    }
+    __atomic_store_n(&aof_on, 1, __ATOMIC_RELEASE);
+    printf("aof: logging writes to %s, appendfsync %s\n", filename, fsync_policy_name(config.appendfsync));
+    return 1;
+}
+
+void aof_stop(void) {
+    if (aof_fd == -1) return;
+
+    pthread_mutex_lock(&aof_lock);
+    __atomic_store_n(&aof_on, 0, __ATOMIC_RELEASE);
+    aof_stopping = 1;
+    pthread_cond_signal(&aof_work);
+    pthread_mutex_unlock(&aof_lock);
+    pthread_join(aof_thread, NULL);
+
+    pthread_mutex_lock(&aof_lock);
+    if (rewrite_state != REWRITE_NONE) rewrite_fail("shutting down");
+    pthread_cond_broadcast(&aof_done);
+    pthread_mutex_unlock(&aof_lock);
+    close(aof_fd);
+    aof_fd = -1;
+    free(aof_buf);
+    aof_buf = NULL;
+    aof_len = aof_cap = 0;
+}
+
+void aof_info_append(char *info, size_t *len) {
+    char buf[512];
+    pthread_mutex_lock(&aof_lock);
+    snprintf(buf, sizeof(buf),
+             "# Persistence\r\n"
+             "aof_enabled:%d\r\n"
+             "aof_fsync:%s\r\n"
+             "aof_current_size:%lld\r\n"
+             "aof_base_size:%lld\r\n"
+             "aof_buffer_length:%llu\r\n"
+             "aof_last_write_status:%s\r\n"
+             "aof_rewrite_in_progress:%d\r\n"
+             "aof_last_bgrewrite_status:%s\r\n"
+             "\r\n",
+             aof_on,
+             fsync_policy_name(config.appendfsync),
+             (long long)aof_size,
+             (long long)aof_base_size,
+             (unsigned long long)(aof_appended - aof_written),
+             aof_write_ok ? "ok" : "err",
+             rewrite_state != REWRITE_NONE,
+             rewrite_ok ? "ok" : "err");
+    pthread_mutex_unlock(&aof_lock);
+    strncat(info, buf, *len - strlen(info) - 1);
+}
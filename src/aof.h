@@ -0,0 +1,50 @@
+#ifndef AOF_H
+#define AOF_H
+
+#include "keyspace.h"
+#include <stddef.h>
+
+// append-only file: every write command that changes the dataset is
+// logged as RESP and replayed at startup. commands append to a buffer in
+// memory, which the event loops hand to the aof thread once per round;
+// that thread does the write() and, depending on appendfsync, the fsync,
+// so neither ever happens on a thread serving clients. records appended
+// by all threads meanwhile go out with the same write and fsync
+
+// replay filename into db. a missing file is not an error, a file whose
+// last command was cut short (a crash while writing it) is truncated after
+// the last complete one. returns 0 if it can't be read or is corrupt
+int aof_load(keyspace *db, const char *filename);
+// start logging to filename. when the file doesn't exist yet it is first
+// written with the dataset as loaded from the rdb file, so it is complete
+// on its own. returns 0 on failure
+int aof_start(keyspace *db, const char *filename);
+// write and fsync what is left, then stop logging
+void aof_stop(void);
+
+// log a write command that was just applied. called with the command's
+// shards still locked, so records of a key are in the order of the writes
+void aof_feed_command(keyspace *db, int argc, char **argv, const size_t *argv_len);
+// end of an event loop round: have the aof thread write what was logged
+void aof_flush(void);
+// with appendfsync always: wait until everything logged so far is on disk,
+// so no reply goes out before the write it acknowledges is durable. gives
+// up when writing the file fails, rather than stalling every client
+void aof_wait_synced(void);
+// with appendfsync always: 1 while something logged is not on disk yet
+int aof_unsynced(void);
+// 1 while the last write or fsync of the file failed. write commands are
+// refused until the aof thread's retry succeeds
+int aof_write_failing(void);
+
+// rewrite the file in the background: a forked child writes the dataset as
+// it is now, the writes made meanwhile are appended and the new file takes
+// the old one's place. also started by the aof thread once the file grew
+// by auto-aof-rewrite-percentage. returns 0 with *error set if it can't
+// start, or one is running already
+int aof_rewrite_start(keyspace *db, const char **error);
+
+// append the persistence section of INFO
+void aof_info_append(char *info, size_t *len);
+
+#endif /* AOF_H */
@@ -12,27 +12,19 @@
 #include <sys/time.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <malloc.h>
+#include <limits.h>
 #include "crimsoncache.h"
 #include "transaction.h" 
 #include "pubsub.h"
+#include "resp.h"
+#include "reply.h"
+#include "aof.h"
 
 extern void track_command_change(void);
 extern volatile sig_atomic_t server_running;
-extern client_t *get_client_by_socket(int socket);
 
 // fallback implementations if not available
-#ifndef HAVE_STRDUP
-static char* my_strdup(const char* s) {
-    size_t len = strlen(s) + 1;
-    char* new_str = malloc(len);
-    if (new_str) {
-        memcpy(new_str, s, len);
-    }
-    return new_str;
-}
-#define strdup my_strdup
-#endif
-
 #ifndef HAVE_STRCASECMP
 static int my_strcasecmp(const char* s1, const char* s2) {
     while (*s1 && (tolower((unsigned char)*s1) == tolower((unsigned char)*s2))) {
@@ -44,30 +36,93 @@ static int my_strcasecmp(const char* s1, const char* s2) {
 #define strcasecmp my_strcasecmp
 #endif
 
-// command table
+// command table. execute_command locks the shards of the keys at
+// first_key..last_key (shared for reads, exclusive for CMD_WRITE) around
+// the handler, unless EXEC holds them already; commands without keys that
+// reach into the keyspace lock what they need themselves. commands are found through command_slots
 static command_def commands[] = {
-    {"ping", ping_command, 1, 2},
-    {"set", set_command, 3, -1},
-    {"get", get_command, 2, 2},
-    {"del", del_command, 2, -1},
-    {"exists", exists_command, 2, -1},
-    {"expire", expire_command, 3, 3},
-    {"ttl", ttl_command, 2, 2},
-    {"save", save_command, 1, 1},
-    {"bgsave", bgsave_command, 1, 1},
-    {"replicaof", replicaof_command, 3, 3},
-    {"role", role_command, 1, 1},
-    {"incr", incr_command, 2, 2},
-    {"replconf", replconf_command, 2, -1},
-    {"multi", multi_command, 1, 1},
-    {"exec", exec_command, 1, 1},
-    {"discard", discard_command, 1, 1},
-    {"subscribe", subscribe_command, 2, -1},
-    {"unsubscribe", unsubscribe_command, 1, -1},
-    {"publish", publish_command, 3, 3},  
-    {NULL, NULL, 0, 0}  // sentinel to mark end of array
+    {"ping", ping_command, 1, 2, 0, 0, 0, 0},
+    {"set", set_command, 3, -1, 1, 1, 1, CMD_WRITE | CMD_DENYOOM},
+    {"get", get_command, 2, 2, 1, 1, 1, CMD_READONLY},
+    {"del", del_command, 2, -1, 1, -1, 1, CMD_WRITE},
+    {"exists", exists_command, 2, -1, 1, -1, 1, CMD_READONLY},
+    {"expire", expire_command, 3, 3, 1, 1, 1, CMD_WRITE},
+    {"pexpireat", pexpireat_command, 3, 3, 1, 1, 1, CMD_WRITE},
+    {"ttl", ttl_command, 2, 2, 1, 1, 1, CMD_READONLY},
+    {"save", save_command, 1, 1, 0, 0, 0, CMD_ADMIN},
+    {"bgsave", bgsave_command, 1, 1, 0, 0, 0, CMD_ADMIN},
+    {"bgrewriteaof", bgrewriteaof_command, 1, 1, 0, 0, 0, CMD_ADMIN},
+    {"replicaof", replicaof_command, 3, 3, 0, 0, 0, CMD_ADMIN},
+    {"role", role_command, 1, 1, 0, 0, 0, 0},
+    {"incr", incr_command, 2, 2, 1, 1, 1, CMD_WRITE | CMD_DENYOOM},
+    {"decr", decr_command, 2, 2, 1, 1, 1, CMD_WRITE | CMD_DENYOOM},
+    {"incrby", incrby_command, 3, 3, 1, 1, 1, CMD_WRITE | CMD_DENYOOM},
+    {"decrby", decrby_command, 3, 3, 1, 1, 1, CMD_WRITE | CMD_DENYOOM},
+    {"replconf", replconf_command, 2, -1, 0, 0, 0, CMD_ADMIN},
+    {"multi", multi_command, 1, 1, 0, 0, 0, CMD_NOQUEUE},
+    {"exec", exec_command, 1, 1, 0, 0, 0, CMD_NOQUEUE},
+    {"discard", discard_command, 1, 1, 0, 0, 0, CMD_NOQUEUE},
+    {"subscribe", subscribe_command, 2, -1, 0, 0, 0, CMD_PUBSUB},
+    {"unsubscribe", unsubscribe_command, 1, -1, 0, 0, 0, CMD_PUBSUB},
+    {"publish", publish_command, 3, 3, 0, 0, 0, CMD_PUBSUB},
+    {"info", info_command, 1, 2, 0, 0, 0, 0},
+    {"memory", memory_command, 2, 3, 0, 0, 0, 0},
+    {NULL, NULL, 0, 0, 0, 0, 0, 0}  // sentinel to mark end of array
 };
 
+// perfect hash over the case-folded command names: a name has a single
+// slot it can be in, so finding a command costs one hash and one compare
+// whatever the case it was sent in. commands_init picks the seed that
+// gives every command a slot of its own
+#define COMMAND_SLOTS 64  // power of two, keep it at least twice the commands
+#define COMMAND_SEED_TRIES (1 << 20)
+
+typedef struct command_slot {
+    const command_def *cmd;  // NULL for a free slot
+    size_t name_len;
+} command_slot;
+
+static command_slot command_slots[COMMAND_SLOTS];
+static uint32_t command_seed;
+
+// fnv-1a, with ascii letters folded to lowercase
+static uint32_t command_hash(const char *name, size_t len, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i] | 0x20;
+        hash *= 16777619u;
+    }
+    return (hash ^ (hash >> 15)) & (COMMAND_SLOTS - 1);
+}
+
+// build command_slots, before any command runs
+void commands_init(void) {
+    for (uint32_t seed = 0; seed < COMMAND_SEED_TRIES; seed++) {
+        memset(command_slots, 0, sizeof(command_slots));
+        int i;
+        for (i = 0; commands[i].name != NULL; i++) {
+            size_t len = strlen(commands[i].name);
+            command_slot *slot = &command_slots[command_hash(commands[i].name, len, seed)];
+            if (slot->cmd) break;
+            slot->cmd = &commands[i];
+            slot->name_len = len;
+        }
+        if (commands[i].name == NULL) {
+            command_seed = seed;
+            return;
+        }
+    }
+    fprintf(stderr, "no perfect hash for the command table, raise COMMAND_SLOTS\n");
+    exit(EXIT_FAILURE);
+}
+
+// the command called name (len bytes, any case), NULL if there is none
+const command_def *command_lookup(const char *name, size_t len) {
+    const command_slot *slot = &command_slots[command_hash(name, len, command_seed)];
+    if (!slot->cmd || slot->name_len != len || strncasecmp(name, slot->cmd->name, len) != 0) return NULL;
+    return slot->cmd;
+}
+
 // get current time in milliseconds
 static uint64_t current_time_ms() {
     struct timeval tv;
@@ -75,287 +130,322 @@ static uint64_t current_time_ms() {
     return (uint64_t)(tv.tv_sec) * 1000 + (tv.tv_usec / 1000);
 }
 
-// tokenize the input command
-char** tokenize_command(char *input, int *argc) {
-    char **tokens = NULL;
-    int max_tokens = 10;  // start with space for 10 tokens
-    int count = 0;
-    
-    // remove trailing \r\n if present
-    size_t len = strlen(input);
-    if (len >= 2 && input[len-2] == '\r' && input[len-1] == '\n') {
-        input[len-2] = '\0';
-    } else if (len >= 1 && input[len-1] == '\n') {
-        input[len-1] = '\0';
-    }
-    
-    // allocate initial token array
-    tokens = malloc(sizeof(char*) * max_tokens);
-    if (!tokens) {
-        *argc = 0;
-        return NULL;
-    }
-    
-    char *p = input;
-    int state = 0;  // 0: skipping spaces, 1: in token, 2: in quoted token
-    char *start = NULL;
-    
-    while (*p) {
-        char c = *p;
-        
-        switch (state) {
-            case 0:  
-                if (isspace((unsigned char)c)) {
-                    p++;
-                } else if (c == '"') {
-                    start = p + 1;
-                    state = 2;
-                    p++;
-                } else {
-                    start = p;
-                    state = 1;
-                    p++;
-                }
-                break;
-                
-            case 1:  
-                if (isspace((unsigned char)c)) {
-                    // end of token
-                    *p = '\0';
-                    
-                    // Resize array if needed
-                    if (count >= max_tokens) {
-                        max_tokens *= 2;
-                        char **new_tokens = realloc(tokens, sizeof(char*) * max_tokens);
-                        if (!new_tokens) goto cleanup;
-                        tokens = new_tokens;
-                    }
-                    
-                    
-                    tokens[count] = strdup(start);
-                    if (!tokens[count]) goto cleanup;
-                    count++;
-                    
-                    state = 0;
-                    p++;
-                } else {
-                    p++;
-                }
-                break;
-                
-            case 2:  
-                if (c == '"' && (p == input || *(p-1) != '\\')) {
-                    // end of quoted token
-                    *p = '\0';
-                    
-                    // resize array if needed
-                    if (count >= max_tokens) {
-                        max_tokens *= 2;
-                        char **new_tokens = realloc(tokens, sizeof(char*) * max_tokens);
-                        if (!new_tokens) goto cleanup;
-                        tokens = new_tokens;
-                    }
-
-                    tokens[count] = strdup(start);
-                    if (!tokens[count]) goto cleanup;
-                    count++;
-                    
-                    state = 0;
-                    p++;
-                } else {
-                    p++;
-                }
-                break;
-        }
-    }
-    
-    if (state == 1) {
-        // resize array if needed
-        if (count >= max_tokens) {
-            max_tokens++;
-            char **new_tokens = realloc(tokens, sizeof(char*) * max_tokens);
-            if (!new_tokens) goto cleanup;
-            tokens = new_tokens;
-        }
-        
-        tokens[count] = strdup(start);
-        if (!tokens[count]) goto cleanup;
-        count++;
+extern void track_command_change();
+
+// query buffers at least this large shrink back to buffer_size once empty
+#define QUERY_BUFFER_SHRINK_MIN (32 * 1024)
+
+// add the shards of the command's keys to ls
+static void add_command_keys(keyspace *db, const command_def *cmd, int argc, char **argv,
+                             keyspace_lockset *ls) {
+    if (cmd->first_key == 0) return;
+
+    int last = cmd->last_key < 0 ? argc + cmd->last_key : cmd->last_key;
+    for (int i = cmd->first_key; i <= last && i < argc; i += cmd->key_step) {
+        keyspace_lockset_add(db, ls, argv[i]);
     }
-    
-    *argc = count;
-    return tokens;
-    
-cleanup:
-    for (int i = 0; i < count; i++) {
-        free(tokens[i]);
+}
+
+// add what a queued command needs to its transaction's locks: the shards
+// of its keys, exclusive if it writes. a keyless command may lock shards
+// itself (INFO, SAVE, MEMORY), with one of those queued every shard is
+// held, so nothing gets locked out of the ascending order. pubsub commands
+// never touch the dataset
+static void add_queued_keys(keyspace *db, const command_def *cmd, int argc, char **argv,
+                            keyspace_lockset *ls) {
+    if (!cmd) return;  // fails when run
+    if (cmd->flags & CMD_WRITE) ls->write = 1;
+    if (cmd->first_key == 0 && !(cmd->flags & CMD_PUBSUB)) {
+        keyspace_lockset_add_all(db, ls);
+    } else {
+        add_command_keys(db, cmd, argc, argv, ls);
     }
-    free(tokens);
-    *argc = 0;
-    return NULL;
 }
 
-void free_tokens(char **tokens, int count) {
-    if (!tokens) return;
-    
-    for (int i = 0; i < count; i++) {
-        free(tokens[i]);
+// the single shard every key of the command maps to, or -1 when it takes
+// no keys, spans several shards or is not a known command. used by the
+// multi-reactor event loop to send a command to the owner of its keys
+int command_shard(keyspace *db, int argc, char **argv) {
+    if (argc == 0) return -1;
+
+    const command_def *cmd = command_lookup(argv[0], strlen(argv[0]));
+    if (!cmd || cmd->first_key == 0 || argc <= cmd->first_key) return -1;
+
+    int last = cmd->last_key < 0 ? argc + cmd->last_key : cmd->last_key;
+    int shard = keyspace_shard_index(db, argv[cmd->first_key]);
+    for (int k = cmd->first_key + cmd->key_step; k <= last && k < argc; k += cmd->key_step) {
+        if (keyspace_shard_index(db, argv[k]) != shard) return -1;
     }
-    free(tokens);
+    return shard;
 }
 
-extern void track_command_change();
+// run a command whose arguments have been checked, with its keys locked
+static cmd_result call_command(int client_sock, const command_def *cmd, int argc, char **argv,
+                               size_t *argv_len, keyspace *db, client_t *client) {
+    keyspace_lockset locks;
+    keyspace_lockset_init(&locks, cmd->flags & CMD_WRITE);
+    add_command_keys(db, cmd, argc, argv, &locks);
+    keyspace_lock(db, &locks);
 
-// this is where we figure out what the client wants to do
-cmd_result execute_command(int client_sock, char *input, dict *db) {
-    int argc = 0; // to count how many parts the command has
-    char *input_copy = strdup(input); // make a copy so strtok doesn't mess up the original
-    if (!input_copy) {
-        // oops, couldn't make a copy, something's wrong
-        if (client_sock >= 0) {
-            reply_error(client_sock, "err out of memory");
+    cmd_result result;
+    if (client_sock >= 0 && (cmd->flags & CMD_WRITE) && aof_write_failing()) {
+        // a write that can't be logged would be lost on restart. like redis,
+        // writes are refused until the append-only file works again
+        reply_error(client_sock, "MISCONF Errors writing to the AOF file, write commands are disabled");
+        result = CMD_ERR;
+    } else if (client_sock >= 0 && (cmd->flags & CMD_DENYOOM) &&
+        !dict_evict_if_needed(keyspace_dict(db, argv[cmd->first_key]))) {
+        // denyoom commands have a single key, eviction happens in its shard.
+        // del and expire only ever free memory. over maxmemory and the
+        // policy could not free enough
+        reply_error(client_sock, "OOM command not allowed when used memory > 'maxmemory'.");
+        result = CMD_ERR;
+    } else {
+        result = cmd->handler(client_sock, argc, argv, argv_len, db);
+    }
+
+    // if the command was okay, and we're the primary server, and it was a write command...
+    // then we need to tell our replicas about it.
+    // commands inside MULTI are only queued, EXEC runs them after the client
+    // has left the transaction, so each one gets here and is propagated on
+    // its own, without a MULTI/EXEC around it. EXEC holds their shards until
+    // the last one is done, so no other write to those keys is propagated
+    // in between. this happens before the keys are unlocked, so replicas see
+    // the writes to a key in the order they were applied
+    if (result == CMD_OK && (cmd->flags & (CMD_WRITE | CMD_NOPROPAGATE)) == CMD_WRITE &&
+        (!client || !client->in_transaction)) {
+        // the append-only file logs what the replication link applies as
+        // well, a replica's file follows its primary
+        aof_feed_command(db, argc, argv, argv_len);
+        if (server_repl.role == ROLE_PRIMARY && client_sock >= 0) {
+            track_command_change(); // for persistence, like auto-saving
+            replication_feed_command(argc, argv, argv_len);
         }
-        return CMD_ERR;
     }
 
-    char **argv = tokenize_command(input_copy, &argc); // break the command into pieces
-    cmd_result result = CMD_UNKNOWN; // let's assume we don't know the command yet
+    keyspace_unlock(db, &locks);
+    return result;
+}
+
+// run a command given as len bytes of inline or RESP input. used for
+// commands that don't come straight from a client's query buffer: queued
+// transactions and commands forwarded between reactors. input is split in
+// place and must have a NUL after its last byte
+cmd_result execute_command(client_t *client, char *input, size_t len, keyspace *db) {
+    int client_sock = client ? client->socket : -1;
+    resp_command cmd;
+    resp_command_init(&cmd);
 
-    // if we didn't get any pieces, or something went wrong tokenizing
-    if (!argv || argc == 0) {
-        if (argv) free_tokens(argv, argc); // clean up if argv was allocated
-        free(input_copy); // clean up the copy
+    size_t consumed;
+    const char *error;
+    if (resp_parse_command(input, len, &consumed, &cmd, &error) != RESP_PARSE_OK) {
+        // an inline command without its line ending is still a command
+        resp_split_inline(input, &cmd);
+    }
+
+    cmd_result result;
+    if (cmd.argc == 0) {
         if (client_sock >= 0) {
             reply_error(client_sock, "err empty command");
         }
-        return CMD_ERR;
+        result = CMD_ERR;
+    } else {
+        result = execute_command_argv(client, cmd.argc, cmd.argv, cmd.argv_len, db);
     }
+    resp_command_free(&cmd);
+    return result;
+}
 
-    // make the command name lowercase so "SET" and "set" are the same
-    for (size_t i = 0; argv[0][i]; i++) {
-        argv[0][i] = tolower(argv[0][i]);
-    }
+// this is where we figure out what the client wants to do. the arguments
+// may point into the client's query buffer, nothing keeps them past the call
+cmd_result execute_command_argv(client_t *client, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    cmd_result result;
+    int client_sock = client ? client->socket : -1;
 
-    // see if this client is in a transaction
-    client_t *client = client_sock >= 0 ? get_client_by_socket(client_sock) : NULL;
+    // one lookup tells what the command is and how to treat it, whatever
+    // case its name came in
+    const command_def *cmd = command_lookup(argv[0], argv_len[0]);
 
-    // is this a command that controls transactions, like multi, exec, or discard?
-    int is_tx_command = strcmp(argv[0], "multi") == 0 ||
-                        strcmp(argv[0], "exec") == 0 ||
-                        strcmp(argv[0], "discard") == 0;
+    // replies go to the client's output buffer, flushed once the batch is done
+    client_t *previous = reply_set_current_client(client);
 
     // if we're in a transaction and this isn't a transaction control command, just queue it
-    if (client && client->in_transaction && !is_tx_command) {
-        // use the original input string for queuing to preserve quotes and stuff
-        if (tx_queue_command(client, input)) {
+    if (client && client->in_transaction && !(cmd && (cmd->flags & CMD_NOQUEUE))) {
+        if (tx_queue_command(client, argc, argv, argv_len)) {
+            add_queued_keys(db, cmd, argc, argv, &client->tx_locks);
             reply_string(client_sock, "QUEUED");
         } else {
             reply_error(client_sock, "err queue command failed");
             client->transaction_errors = 1; // mark that something went wrong
         }
-        free_tokens(argv, argc); // clean up the pieces
-        free(input_copy); // clean up the copy
+        reply_set_current_client(previous);
         return CMD_OK; // we're done for now, it's queued
     }
 
-    // okay, not queuing, let's find the actual command to run
-    for (int i = 0; commands[i].name != NULL; i++) {
-        if (strcmp(argv[0], commands[i].name) == 0) {
-            // found it! now check if they gave the right number of arguments
-            if ((commands[i].min_args > 0 && argc < commands[i].min_args) ||
-                (commands[i].max_args > 0 && argc > commands[i].max_args && commands[i].max_args != -1)) { // -1 means any number of args is fine
-                if (client_sock >= 0) {
-                    reply_error(client_sock, "err wrong number of arguments");
-                }
-                result = CMD_ERR;
-            } else {
-                // looks good, run the command's handler function
-                result = commands[i].handler(client_sock, argc, argv, db);
-            }
-            break; // no need to check other commands
-        }
-    }
-
-    // if we went through all commands and didn't find it
-    if (result == CMD_UNKNOWN) {
+    if (!cmd) {
         if (client_sock >= 0) { // only send error if it's a real client connection
             reply_error(client_sock, "err unknown command");
         }
-        result = CMD_ERR; // make sure we return an error status
+        result = CMD_ERR;
+    } else if (argc < cmd->min_args || (cmd->max_args != -1 && argc > cmd->max_args)) { // -1 means any number of args is fine
+        if (client_sock >= 0) {
+            reply_error(client_sock, "err wrong number of arguments");
+        }
+        result = CMD_ERR;
+    } else if ((cmd->flags & CMD_WRITE) && client_sock >= 0 && server_repl.role == ROLE_REPLICA) {
+        // a replica's dataset follows its primary, clients may only read it
+        reply_error(client_sock, "READONLY You can't write against a read only replica.");
+        result = CMD_ERR;
+    } else {
+        // looks good, run the command's handler function
+        result = call_command(client_sock, cmd, argc, argv, argv_len, db, client);
     }
 
-    // if the command was okay, and we're the primary server, and it was a write command...
-    // then we need to tell our replicas about it
-    // but only if we're not in a transaction (exec will handle propagation for transactions)
-    if (result == CMD_OK && (!client || !client->in_transaction) && server_repl.role == ROLE_PRIMARY && client_sock >= 0) {
-        if (strcasecmp(argv[0], "set") == 0 ||
-            strcasecmp(argv[0], "del") == 0 ||
-            strcasecmp(argv[0], "expire") == 0 ||
-            strcasecmp(argv[0], "incr") == 0) {
+    reply_set_current_client(previous);
+    return result; // tell the caller how it went
+}
 
-            track_command_change(); // for persistence, like auto-saving
-            // use the original input for replication to keep quotes and exact format
-            replication_feed_slaves(input, strlen(input));
+// run every complete command in the client's query buffer in order and keep
+// a trailing partial command for the next read. the arguments are parsed in
+// place into the client's reused argv, so a command costs no allocations
+// before its handler runs. dispatch, when given, may take a command over by
+// returning 1, which stops processing until the caller calls this again.
+// returns 0 on a protocol error, after which the client has been sent an
+// error and should be disconnected
+int process_client_buffer(client_t *client, keyspace *db, command_dispatch dispatch, void *arg) {
+    resp_command *cmd = &client->cmd;
+    size_t pos = 0;
+    size_t buffered = client->buffer_pos;
+    int ok = 1;
+    int taken = 0;
+
+    while (pos < buffered && !taken) {
+        size_t consumed;
+        const char *error;
+
+        resp_parse_result parsed;
+        if (client->cmd_parsed) {
+            // an io thread parsed it already
+            parsed = RESP_PARSE_OK;
+            consumed = client->cmd_parsed;
+            client->cmd_parsed = 0;
+        } else {
+            parsed = resp_parse_command(client->buffer + pos, buffered - pos, &consumed, cmd, &error);
+        }
+        if (parsed == RESP_PARSE_INCOMPLETE) break;
+        if (parsed == RESP_PARSE_ERROR) {
+            char message[128];
+            snprintf(message, sizeof(message), "ERR Protocol error: %s", error);
+            reply_error(client->socket, message);
+            ok = 0;
+            break;
+        }
+        pos += consumed;
+
+        // empty lines are skipped, like redis does
+        if (cmd->argc > 0) {
+            taken = dispatch && dispatch(client, cmd->argc, cmd->argv, cmd->argv_len, arg);
+            if (!taken) {
+                execute_command_argv(client, cmd->argc, cmd->argv, cmd->argv_len, db);
+            }
         }
     }
 
-    free_tokens(argv, argc); // always clean up the token pieces
-    free(input_copy); // and the copy we made
-    return result; // tell the caller how it went
+    // keep what hasn't run yet at the front of the buffer
+    memmove(client->buffer, client->buffer + pos, buffered - pos);
+    client->buffer_pos = buffered - pos;
+    client->buffer[client->buffer_pos] = '\0';
+
+    // make room for the rest of a partial command. a taken command may
+    // still be running, it is done when this is called again
+    if (ok && !taken &&
+        !query_buffer_reserve(&client->buffer, &client->buffer_capacity, client->buffer_pos, cmd->needed)) {
+        fprintf(stderr, "closing client on socket %d: query buffer limit reached\n", client->socket);
+        reply_error(client->socket, "ERR Protocol error: command larger than client-query-buffer-limit");
+        ok = 0;
+    }
+    return ok;
 }
 
-// response formatters
+// size a query buffer holding used bytes for the next read. a partial
+// command whose length is known from its bulk headers (needed) gets all of
+// its room at once, so a large value is received straight into place with
+// a single allocation; otherwise a full buffer doubles. a buffer a large
+// command left behind shrinks back to buffer_size once it is mostly empty.
+// returns 0 if the buffer would have to grow past client-query-buffer-limit
+int query_buffer_reserve(char **buf, size_t *capacity, size_t used, size_t needed) {
+    size_t initial = (size_t)config.buffer_size;
+    size_t target = *capacity;
+
+    if (needed + 1 > target) {
+        target = needed + 1;
+    } else if (used + 1 >= target) {
+        target *= 2;
+    } else if (target >= QUERY_BUFFER_SHRINK_MIN && used < initial && needed < initial) {
+        target = initial;
+    }
+    if (target == *capacity) return 1;
+    if (target > config.query_buffer_limit) return 0;
+
+    char *resized = realloc(*buf, target);
+    if (!resized) return 0;
+    *buf = resized;
+    *capacity = target;
+    return 1;
+}
+
+// response formatters, they all go through the client's output buffer
 void reply_string(int client_sock, const char *str) {
     char buffer[1024];
-    snprintf(buffer, sizeof(buffer), "+%s\r\n", str);
-    write(client_sock, buffer, strlen(buffer));
+    int len = snprintf(buffer, sizeof(buffer), "+%s\r\n", str);
+    add_reply(client_sock, buffer, len < (int)sizeof(buffer) ? (size_t)len : sizeof(buffer) - 1);
 }
 
 void reply_error(int client_sock, const char *err) {
     char buffer[1024];
-    snprintf(buffer, sizeof(buffer), "-%s\r\n", err);
-    write(client_sock, buffer, strlen(buffer));
+    int len = snprintf(buffer, sizeof(buffer), "-%s\r\n", err);
+    add_reply(client_sock, buffer, len < (int)sizeof(buffer) ? (size_t)len : sizeof(buffer) - 1);
 }
 
 void reply_integer(int client_sock, long long num) {
     char buffer[32];
-    snprintf(buffer, sizeof(buffer), ":%lld\r\n", num);
-    write(client_sock, buffer, strlen(buffer));
+    int len = snprintf(buffer, sizeof(buffer), ":%lld\r\n", num);
+    add_reply(client_sock, buffer, len);
 }
 
 void reply_bulk(int client_sock, const char *str) {
-    char buffer[1024];
-    size_t len = str ? strlen(str) : 0;
+    reply_bulk_len(client_sock, str ? str : "", str ? strlen(str) : 0);
+}
+
+// bulk reply of len bytes, which may include NULs
+void reply_bulk_len(int client_sock, const char *str, size_t len) {
+    char header[32];
     
     // Format: $<length>\r\n<data>\r\n
-    snprintf(buffer, sizeof(buffer), "$%zu\r\n", len);
-    write(client_sock, buffer, strlen(buffer));
-    
-    if (str && len > 0) {
-        write(client_sock, str, len);
-        write(client_sock, "\r\n", 2);
-    }
+    int header_len = snprintf(header, sizeof(header), "$%zu\r\n", len);
+    add_reply_bulk(client_sock, header, header_len, str, len);
 }
 
 void reply_null_bulk(int client_sock) {
-    write(client_sock, "$-1\r\n", 5);
+    add_reply(client_sock, "$-1\r\n", 5);
 }
 
 // command implementations
-cmd_result ping_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result ping_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
     (void)db;
     
     if (argc > 1) {
-        reply_bulk(client_sock, argv[1]);
+        reply_bulk_len(client_sock, argv[1], argv_len[1]);
     } else {
         reply_string(client_sock, "PONG");
     }
     return CMD_OK;
 }
 
-cmd_result set_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result set_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
     const char *key = argv[1];
     const char *value = argv[2];
+    size_t value_len = argv_len[2];
     uint64_t expire_ms = 0;
     
     // Check for EX/PX option
@@ -369,53 +459,39 @@ cmd_result set_command(int client_sock, int argc, char **argv, dict *db) {
         }
     }
     
-    // create string object
-    cc_obj *obj = malloc(sizeof(cc_obj));
-    if (!obj) {
-        reply_error(client_sock, "ERR out of memory");
-        return CMD_ERR;
-    }
-    
-    obj->ptr = strdup(value);
-    if (!obj->ptr) {
-        free(obj);
-        reply_error(client_sock, "ERR out of memory");
-        return CMD_ERR;
-    }
-    
-    obj->type = CC_STRING;
-    obj->expire = expire_ms;
-    obj->size = strlen(value) + 1;
-    obj->last_access = current_time_ms();
-    
-    if (dict_add(db, key, obj)) {
+    // the dict copies key and value into a single entry
+    if (dict_set(keyspace_dict(db, key), key, value, value_len, expire_ms)) {
         reply_string(client_sock, "OK");
         return CMD_OK;
     } else {
-        free(obj->ptr);
-        free(obj);
         reply_error(client_sock, "ERR could not set key");
         return CMD_ERR;
     }
 }
 
-cmd_result get_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result get_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc; // unused parameter
     
-    cc_obj *obj = dict_get(db, argv[1]);
-    if (obj && obj->type == CC_STRING) {
-        reply_bulk(client_sock, (char*)obj->ptr);
+    // read commands hold a shared lock, dict_find leaves the shard untouched
+    cc_obj *obj = dict_find(keyspace_dict(db, argv[1]), argv[1]);
+    if (obj && (obj->type == CC_STRING || obj->type == CC_INT)) {
+        char buf[CC_INT_STR_SIZE];
+        size_t len;
+        const char *str = cc_obj_str(obj, buf, &len);
+        reply_bulk_len(client_sock, str, len);
     } else {
         reply_null_bulk(client_sock);
     }
     return CMD_OK;
 }
 
-cmd_result del_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result del_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     int deleted = 0;
     
     for (int i = 1; i < argc; i++) {
-        if (dict_delete(db, argv[i])) {
+        if (dict_delete(keyspace_dict(db, argv[i]), argv[i])) {
             deleted++;
         }
     }
@@ -424,11 +500,12 @@ cmd_result del_command(int client_sock, int argc, char **argv, dict *db) {
     return CMD_OK;
 }
 
-cmd_result exists_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result exists_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     int count = 0;
     
     for (int i = 1; i < argc; i++) {
-        if (dict_get(db, argv[i]) != NULL) {
+        if (dict_find(keyspace_dict(db, argv[i]), argv[i]) != NULL) {
             count++;
         }
     }
@@ -437,26 +514,46 @@ cmd_result exists_command(int client_sock, int argc, char **argv, dict *db) {
     return CMD_OK;
 }
 
-cmd_result expire_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result expire_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc; // Unused parameter
     
-    cc_obj *obj = dict_get(db, argv[1]);
-    if (!obj) {
+    dict *d = keyspace_dict(db, argv[1]);
+
+    // dict_get first so an already expired key counts as missing
+    if (!dict_get(d, argv[1])) {
         reply_integer(client_sock, 0);
         return CMD_OK;
     }
     
     long seconds = atol(argv[2]);
-    obj->expire = current_time_ms() + (seconds * 1000);
+    int updated = dict_set_expire(d, argv[1], current_time_ms() + (seconds * 1000));
     
-    reply_integer(client_sock, 1);
+    reply_integer(client_sock, updated);
     return CMD_OK;
 }
 
-cmd_result ttl_command(int client_sock, int argc, char **argv, dict *db) {
+// pexpireat <key> <unix time in ms>, how the append-only file logs expires
+cmd_result pexpireat_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
+    (void)argc;
+
+    dict *d = keyspace_dict(db, argv[1]);
+    if (!dict_get(d, argv[1])) {
+        reply_integer(client_sock, 0);
+        return CMD_OK;
+    }
+
+    uint64_t when = strtoull(argv[2], NULL, 10);
+    reply_integer(client_sock, dict_set_expire(d, argv[1], when));
+    return CMD_OK;
+}
+
+cmd_result ttl_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc; // Unused parameter
     
-    cc_obj *obj = dict_get(db, argv[1]);
+    cc_obj *obj = dict_find(keyspace_dict(db, argv[1]), argv[1]);
     if (!obj) {
         reply_integer(client_sock, -2);
         return CMD_OK;
@@ -479,7 +576,8 @@ cmd_result ttl_command(int client_sock, int argc, char **argv, dict *db) {
     return CMD_OK;
 }
 
-cmd_result save_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result save_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc; // unused
     (void)argv; // unused
     
@@ -496,7 +594,8 @@ cmd_result save_command(int client_sock, int argc, char **argv, dict *db) {
     }
 }
 
-cmd_result bgsave_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result bgsave_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc; // unused
     (void)argv; // unused
     
@@ -512,8 +611,24 @@ cmd_result bgsave_command(int client_sock, int argc, char **argv, dict *db) {
     }
 }
 
+// bgrewriteaof - compact the append-only file in the background
+cmd_result bgrewriteaof_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
+    (void)argc; // unused
+    (void)argv; // unused
+
+    const char *error;
+    if (aof_rewrite_start(db, &error)) {
+        reply_string(client_sock, "Background append only file rewriting started");
+        return CMD_OK;
+    }
+    reply_error(client_sock, error);
+    return CMD_ERR;
+}
+
 // replicaof command - configure server as replica of another or as primary
-cmd_result replicaof_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result replicaof_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc; // unused
     (void)db;   // unused
 
@@ -543,7 +658,8 @@ cmd_result replicaof_command(int client_sock, int argc, char **argv, dict *db) {
 }
 
 // role command - return role of server (primary or replica)
-cmd_result role_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result role_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc; // unused
     (void)argv; // unused
     (void)db;   // unused
@@ -580,76 +696,93 @@ cmd_result role_command(int client_sock, int argc, char **argv, dict *db) {
                 server_repl.repl_offset);
     }
     
-    write(client_sock, response, strlen(response));
+    add_reply(client_sock, response, strlen(response));
     return CMD_OK;
 }
 
-// INCR command implementation
-cmd_result incr_command(int client_sock, int argc, char **argv, dict *db) {
-    (void)argc; // unused parameter
-    
-    const char *key = argv[1];
-    
+// shared by INCR, DECR, INCRBY and DECRBY. integer values are updated in
+// place, so a counter never allocates after its first increment
+static cmd_result incr_by(int client_sock, keyspace *db, const char *key, long long delta) {
+    dict *d = keyspace_dict(db, key);
+
     // Get current value
-    cc_obj *obj = dict_get(db, key);
+    cc_obj *obj = dict_get(d, key);
     long long value = 0;
     
     if (obj) {
-        // Key exists, check if it's a string we can convert to number
-        if (obj->type != CC_STRING) {
-            reply_error(client_sock, "ERR value is not an integer or out of range");
-            return CMD_ERR;
-        }
-        
-        // Try to parse as integer
-        char *endptr;
-        value = strtoll((char*)obj->ptr, &endptr, 10);
-        
-        if (*endptr != '\0') {
+        // a string here never parsed as an integer when it was stored
+        if (obj->type != CC_INT) {
             reply_error(client_sock, "ERR value is not an integer or out of range");
             return CMD_ERR;
         }
+        value = obj->ival;
     }
     
-    // Increment the value
-    value++;
-    
-    // Convert back to string
-    char new_val[32];
-    snprintf(new_val, sizeof(new_val), "%lld", value);
-    
-    // Create new object
-    cc_obj *new_obj = malloc(sizeof(cc_obj));
-    if (!new_obj) {
-        reply_error(client_sock, "ERR out of memory");
+    if ((delta < 0 && value < LLONG_MIN - delta) ||
+        (delta > 0 && value > LLONG_MAX - delta)) {
+        reply_error(client_sock, "ERR increment or decrement would overflow");
         return CMD_ERR;
     }
+    value += delta;
     
-    new_obj->ptr = strdup(new_val);
-    if (!new_obj->ptr) {
-        free(new_obj);
-        reply_error(client_sock, "ERR out of memory");
+    if (obj) {
+        obj->ival = value;
+    } else if (!dict_set_int(d, key, value, 0)) {
+        reply_error(client_sock, "ERR could not set key");
         return CMD_ERR;
     }
     
-    new_obj->type = CC_STRING;
-    new_obj->expire = obj ? obj->expire : 0; // Preserve expiry if exists
-    new_obj->size = strlen(new_val) + 1;
-    new_obj->last_access = current_time_ms();
+    reply_integer(client_sock, value);
+    return CMD_OK;
+}
+
+// parse the increment argument of INCRBY / DECRBY
+static int parse_increment(int client_sock, const char *arg, long long *delta) {
+    if (!dict_string_to_ll(arg, strlen(arg), delta)) {
+        reply_error(client_sock, "ERR value is not an integer or out of range");
+        return 0;
+    }
+    return 1;
+}
+
+// INCR command implementation
+cmd_result incr_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
+    (void)argc; // unused parameter
+    return incr_by(client_sock, db, argv[1], 1);
+}
+
+cmd_result decr_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
+    (void)argc; // unused parameter
+    return incr_by(client_sock, db, argv[1], -1);
+}
+
+cmd_result incrby_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
+    (void)argc; // unused parameter
     
-    if (dict_add(db, key, new_obj)) {
-        reply_integer(client_sock, value);
-        return CMD_OK;
-    } else {
-        free(new_obj->ptr);
-        free(new_obj);
-        reply_error(client_sock, "ERR could not set key");
+    long long delta;
+    if (!parse_increment(client_sock, argv[2], &delta)) return CMD_ERR;
+    return incr_by(client_sock, db, argv[1], delta);
+}
+
+cmd_result decrby_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
+    (void)argc; // unused parameter
+    
+    long long delta;
+    if (!parse_increment(client_sock, argv[2], &delta)) return CMD_ERR;
+    if (delta == LLONG_MIN) {
+        reply_error(client_sock, "ERR decrement would overflow");
         return CMD_ERR;
     }
+    return incr_by(client_sock, db, argv[1], -delta);
 }
 
 // implement the REPLCONF command handler
-cmd_result replconf_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result replconf_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)db; // unused
     
     // handle REPLCONF listening-port <port>
@@ -678,12 +811,13 @@ cmd_result replconf_command(int client_sock, int argc, char **argv, dict *db) {
 }
 
 // MULTI command - begin transaction
-cmd_result multi_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result multi_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc;
     (void)argv;
     (void)db; 
     
-    client_t *client = get_client_by_socket(client_sock);
+    client_t *client = lookup_client(client_sock);
     if (!client) {
         reply_error(client_sock, "ERR client not found");
         return CMD_ERR;
@@ -701,11 +835,12 @@ cmd_result multi_command(int client_sock, int argc, char **argv, dict *db) {
 }
 
 // EXEC command - execute transaction
-cmd_result exec_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result exec_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc;
     (void)argv;
     
-    client_t *client = get_client_by_socket(client_sock);
+    client_t *client = lookup_client(client_sock);
     if (!client) {
         reply_error(client_sock, "ERR client not found");
         return CMD_ERR;
@@ -716,25 +851,23 @@ cmd_result exec_command(int client_sock, int argc, char **argv, dict *db) {
         return CMD_ERR;
     }
     
-    printf("Executing transaction with %d commands\n", client->queue_size);
     tx_execute_commands(client, db);
     
     if (client->in_transaction != 0) {
         printf("WARNING: Transaction state not properly reset, forcing to 0\n");
         client->in_transaction = 0;
     }
-    
-    printf("Transaction execution complete, in_transaction=%d\n", client->in_transaction);
     return CMD_OK;
 }
 
 // DISCARD command - discard transaction
-cmd_result discard_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result discard_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)argc; 
     (void)argv; 
     (void)db;   
     
-    client_t *client = get_client_by_socket(client_sock);
+    client_t *client = lookup_client(client_sock);
     if (!client) {
         reply_error(client_sock, "ERR client not found");
         return CMD_ERR;
@@ -751,9 +884,10 @@ cmd_result discard_command(int client_sock, int argc, char **argv, dict *db) {
 }
 
 // subscribe command
-cmd_result subscribe_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result subscribe_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)db; // unused
-    client_t *client = get_client_by_socket(client_sock);
+    client_t *client = lookup_client(client_sock);
     if (!client) {
         reply_error(client_sock, "err client not found for subscribe");
         return CMD_ERR;
@@ -764,9 +898,10 @@ cmd_result subscribe_command(int client_sock, int argc, char **argv, dict *db) {
 }
 
 // unsubscribe command
-cmd_result unsubscribe_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result unsubscribe_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
     (void)db; // unused
-    client_t *client = get_client_by_socket(client_sock);
+    client_t *client = lookup_client(client_sock);
     if (!client) {
         reply_error(client_sock, "err client not found for unsubscribe");
         return CMD_ERR;
@@ -777,7 +912,7 @@ cmd_result unsubscribe_command(int client_sock, int argc, char **argv, dict *db)
 }
 
 // publish command
-cmd_result publish_command(int client_sock, int argc, char **argv, dict *db) {
+cmd_result publish_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
     (void)db; // unused
     if (argc != 3) {
         reply_error(client_sock, "err wrong number of arguments for 'publish' command");
@@ -785,11 +920,121 @@ cmd_result publish_command(int client_sock, int argc, char **argv, dict *db) {
     }
     const char *channel_name = argv[1];
     const char *message = argv[2];
-    int receivers = pubsub_publish_message(channel_name, message);
+    int receivers = pubsub_publish_message(channel_name, message, argv_len[2]);
     reply_integer(client_sock, receivers);
     return CMD_OK;
 }
 
+// info command - server statistics, one "# Section" block per area
+cmd_result info_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
+    (void)argc;
+    (void)argv;
 
+    char info[4096];
+    size_t len = sizeof(info);
 
+    keyspace_stats stats;
+    keyspace_get_stats(db, &stats);
 
+    snprintf(info, sizeof(info),
+             "# Memory\r\n"
+             "used_memory:%zu\r\n"
+             "used_memory_payload:%zu\r\n"
+             "maxmemory:%zu\r\n"
+             "maxmemory_policy:%s\r\n"
+             "maxmemory_samples:%d\r\n"
+             "\r\n"
+             "# Stats\r\n"
+             "evicted_keys:%llu\r\n"
+             "expired_keys:%llu\r\n"
+             "expired_time_cap_reached_count:%llu\r\n"
+             "expire_cycle_cpu_milliseconds:%llu\r\n"
+             "\r\n"
+             "# Keyspace\r\n"
+             "keyspace_shards:%d\r\n"
+             "db0:keys=%zu,expires=%zu\r\n"
+             "\r\n",
+             stats.used_memory,
+             stats.payload_memory,
+             config.maxmemory,
+             dict_evict_policy_name(config.maxmemory_policy),
+             config.maxmemory_samples,
+             (unsigned long long)stats.evicted_keys,
+             (unsigned long long)stats.expired_keys,
+             (unsigned long long)stats.expire_cap_reached,
+             (unsigned long long)(stats.expire_cycle_us / 1000),
+             db->nshards,
+             stats.keys,
+             stats.expires);
+
+    aof_info_append(info, &len);
+    replication_info_append(info, &len);
+
+    reply_bulk(client_sock, info);
+    return CMD_OK;
+}
+
+// memory usage <key> - heap bytes held by a key, its value and their headers
+// memory stats       - where the dataset's memory goes, payload vs overhead
+cmd_result memory_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db) {
+    (void)argv_len;
+    if (strcasecmp(argv[1], "usage") == 0) {
+        if (argc != 3) {
+            reply_error(client_sock, "ERR wrong number of arguments for 'memory usage'");
+            return CMD_ERR;
+        }
+
+        // keyless in the command table, so lock the key's shard here
+        int shard = keyspace_shard_index(db, argv[2]);
+        keyspace_lock_shard(db, shard, 0);
+        size_t bytes = dict_key_memory(db->shards[shard].d, argv[2]);
+        keyspace_unlock_shard(db, shard);
+        if (bytes == 0) {
+            reply_null_bulk(client_sock);
+        } else {
+            reply_integer(client_sock, (long long)bytes);
+        }
+        return CMD_OK;
+    }
+
+    if (strcasecmp(argv[1], "stats") == 0) {
+        keyspace_stats ks;
+        keyspace_get_stats(db, &ks);
+        size_t tables = ks.tables_memory;
+        size_t dataset = ks.used_memory;
+        size_t payload = ks.payload_memory;
+        size_t allocated = 0;
+#ifdef __GLIBC__
+        struct mallinfo2 mi = mallinfo2();
+        allocated = mi.uordblks + mi.hblkhd; // includes buffers, clients, ...
+#endif
+
+        struct {
+            const char *name;
+            size_t value;
+        } stats[] = {
+            {"total.allocated", allocated},
+            {"dataset.bytes", dataset},
+            {"keys.count", ks.keys},
+            {"keys.bytes-per-key", ks.keys ? dataset / ks.keys : 0},
+            {"payload.bytes", payload},
+            {"overhead.entries", ks.entries_memory - payload},
+            {"overhead.hashtable", tables},
+        };
+        int count = sizeof(stats) / sizeof(stats[0]);
+
+        // flat array of name / value pairs, like redis
+        char buffer[1024];
+        int len = snprintf(buffer, sizeof(buffer), "*%d\r\n", count * 2);
+        for (int i = 0; i < count; i++) {
+            len += snprintf(buffer + len, sizeof(buffer) - len, "$%zu\r\n%s\r\n:%zu\r\n",
+                            strlen(stats[i].name), stats[i].name, stats[i].value);
+        }
+        add_reply(client_sock, buffer, len);
+        return CMD_OK;
+    }
+
+    reply_error(client_sock, "ERR unknown subcommand, try MEMORY USAGE <key> or MEMORY STATS");
+    return CMD_ERR;
+}
@@ -1,7 +1,7 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
-#include "dict.h"
+#include "keyspace.h"
 #include <stddef.h>
 
 // RESP protocol types
@@ -19,7 +19,17 @@ typedef enum {
 } cmd_result;
 
 // Command handler function type
-typedef cmd_result (*cmd_handler)(int client_sock, int argc, char **argv, dict *db);
+// argv_len holds the length of every argument, which may contain NUL bytes
+typedef cmd_result (*cmd_handler)(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+
+// command flags
+#define CMD_WRITE       (1 << 0)  // changes the dataset: exclusive shard locks, propagated to replicas
+#define CMD_DENYOOM     (1 << 1)  // may grow memory, refused while over maxmemory
+#define CMD_READONLY    (1 << 2)  // only reads the dataset
+#define CMD_ADMIN       (1 << 3)  // server administration: persistence, replication setup
+#define CMD_PUBSUB      (1 << 4)  // publish/subscribe, never touches the dataset
+#define CMD_NOPROPAGATE (1 << 5)  // a write that is not sent to replicas
+#define CMD_NOQUEUE     (1 << 6)  // runs right away inside MULTI (transaction control)
 
 // Command definition
 typedef struct command_def {
@@ -27,39 +37,63 @@ typedef struct command_def {
     cmd_handler handler;
     int min_args;  // Minimum number of arguments (including command name)
     int max_args;  // Maximum arguments (-1 for unlimited)
+    int first_key; // argv index of the first key, 0 if the command takes none
+    int last_key;  // argv index of the last key, negative counts from the end
+    int key_step;  // distance between keys
+    int flags;     // CMD_* flags
 } command_def;
 
+// lets the caller of process_client_buffer take over a parsed command by
+// returning 1. the arguments are only valid during the call
+struct client;
+typedef int (*command_dispatch)(struct client *client, int argc, char **argv,
+                                size_t *argv_len, void *arg);
+
 // Command parsing and execution
-char** tokenize_command(char *input, int *argc);
-void free_tokens(char **tokens, int count);
-cmd_result execute_command(int client_sock, char *input, dict *db);
+void commands_init(void);
+const command_def *command_lookup(const char *name, size_t len);
+// client is the one the command came from, NULL for commands applied
+// without anyone to reply to (the replication stream)
+cmd_result execute_command(struct client *client, char *input, size_t len, keyspace *db);
+cmd_result execute_command_argv(struct client *client, int argc, char **argv, size_t *argv_len, keyspace *db);
+int process_client_buffer(struct client *client, keyspace *db, command_dispatch dispatch, void *arg);
+int query_buffer_reserve(char **buf, size_t *capacity, size_t used, size_t needed);
+int command_shard(keyspace *db, int argc, char **argv);
 
 // Response formatting
 void reply_string(int client_sock, const char *str);
 void reply_error(int client_sock, const char *err);
 void reply_integer(int client_sock, long long num);
 void reply_bulk(int client_sock, const char *str);
+void reply_bulk_len(int client_sock, const char *str, size_t len);
 void reply_null_bulk(int client_sock);
 
 // Command implementations
-cmd_result ping_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result set_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result get_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result del_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result exists_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result expire_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result ttl_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result save_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result bgsave_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result replicaof_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result role_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result incr_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result replconf_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result multi_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result exec_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result discard_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result subscribe_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result unsubscribe_command(int client_sock, int argc, char **argv, dict *db);
-cmd_result publish_command(int client_sock, int argc, char **argv, dict *db);
+cmd_result ping_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result set_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result get_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result del_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result exists_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result expire_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result pexpireat_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result ttl_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result save_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result bgsave_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result bgrewriteaof_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result replicaof_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result role_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result incr_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result decr_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result incrby_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result decrby_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result replconf_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result multi_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result exec_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result discard_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result subscribe_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result unsubscribe_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result publish_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result info_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
+cmd_result memory_command(int client_sock, int argc, char **argv, size_t *argv_len, keyspace *db);
 
 #endif /* COMMANDS_H */
\ No newline at end of file
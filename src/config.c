@@ -1,4 +1,6 @@
 #include "config.h"
+#include "keyspace.h"
+#include "io_threads.h" // for IO_THREADS_MAX
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,11 +14,68 @@ void load_default_config() {
     config.port = 6379;
     config.concurrency_model = CONCURRENCY_THREADED; // Default to the original model
     config.max_clients = 100;
+    config.tcp_backlog = 511; // like redis, the kernel caps it at somaxconn
     strncpy(config.log_file, "crimsoncache.log", sizeof(config.log_file) - 1);
     config.save_after_seconds = 300; // 5 minutes
     config.save_after_changes = 1000;
+    config.rdb_compression = 1;
+    config.rdb_load_threads = 0; // one per cpu
+    config.appendonly = 0;
+    strncpy(config.aof_filename, "appendonly.aof", sizeof(config.aof_filename) - 1);
+    config.appendfsync = AOF_FSYNC_EVERYSEC;
+    config.auto_aof_rewrite_percentage = 100;
+    config.auto_aof_rewrite_min_size = 64 * 1024 * 1024;
     config.buffer_size = 1024; // default buffer size
+    config.query_buffer_limit = 1024ULL * 1024 * 1024; // 1gb, like redis
     config.max_events = 64; // default max events for epoll
+    config.maxmemory = 0; // no limit
+    config.maxmemory_policy = DICT_DEFAULT_EVICTION_POLICY;
+    config.maxmemory_samples = DICT_DEFAULT_EVICTION_SAMPLES;
+    config.lfu_log_factor = DICT_DEFAULT_LFU_LOG_FACTOR;
+    config.lfu_decay_time = DICT_DEFAULT_LFU_DECAY_TIME;
+    config.hz = 10;
+    config.keyspace_shards = KEYSPACE_DEFAULT_SHARDS;
+    config.worker_threads = 0; // one per cpu
+    config.reactors = 1;
+    config.io_threads = 1;
+    config.output_limits[CLIENT_CLASS_NORMAL] = (output_buffer_limit_t){0, 0, 0};
+    config.output_limits[CLIENT_CLASS_PUBSUB] = (output_buffer_limit_t){32 * 1024 * 1024, 8 * 1024 * 1024, 60};
+}
+
+// parse a memory size like "100mb" or "1gb", plain numbers are bytes
+static size_t parse_memory(const char *value) {
+    char *end;
+    unsigned long long n = strtoull(value, &end, 10);
+    while (*end == ' ') end++;
+
+    if (strcasecmp(end, "k") == 0 || strcasecmp(end, "kb") == 0) {
+        n *= 1024ULL;
+    } else if (strcasecmp(end, "m") == 0 || strcasecmp(end, "mb") == 0) {
+        n *= 1024ULL * 1024;
+    } else if (strcasecmp(end, "g") == 0 || strcasecmp(end, "gb") == 0) {
+        n *= 1024ULL * 1024 * 1024;
+    }
+    return (size_t)n;
+}
+
+// "<class> <hard> <soft> <seconds>", e.g. "pubsub 32mb 8mb 60"
+static int parse_output_limit(const char *value) {
+    char class_name[16], hard[32], soft[32];
+    int seconds;
+    if (sscanf(value, "%15s %31s %31s %d", class_name, hard, soft, &seconds) != 4) return 0;
+
+    client_class_t class;
+    if (strcasecmp(class_name, "normal") == 0) {
+        class = CLIENT_CLASS_NORMAL;
+    } else if (strcasecmp(class_name, "pubsub") == 0) {
+        class = CLIENT_CLASS_PUBSUB;
+    } else {
+        return 0;
+    }
+    config.output_limits[class].hard = parse_memory(hard);
+    config.output_limits[class].soft = parse_memory(soft);
+    config.output_limits[class].soft_seconds = seconds < 0 ? 0 : seconds;
+    return 1;
 }
 
 // Simple parser to read key-value pairs from a file
@@ -42,21 +101,88 @@ int load_config_from_file(const char *filename) {
         } else if (strcasecmp(key, "concurrency") == 0) {
             if (strcasecmp(value, "eventloop") == 0) {
                 config.concurrency_model = CONCURRENCY_EVENTLOOP;
+            } else if (strcasecmp(value, "uring") == 0 || strcasecmp(value, "io_uring") == 0) {
+                config.concurrency_model = CONCURRENCY_URING;
             } else {
                 config.concurrency_model = CONCURRENCY_THREADED;
             }
         } else if (strcasecmp(key, "maxClients") == 0) {
             config.max_clients = atoi(value);
+        } else if (strcasecmp(key, "workerThreads") == 0) {
+            config.worker_threads = atoi(value);
+            if (config.worker_threads < 0) config.worker_threads = 0;
+        } else if (strcasecmp(key, "tcp-backlog") == 0) {
+            config.tcp_backlog = atoi(value);
+            if (config.tcp_backlog < 1) config.tcp_backlog = 1;
         } else if (strcasecmp(key, "logFile") == 0) {
             strncpy(config.log_file, value, sizeof(config.log_file) - 1);
         } else if (strcasecmp(key, "saveSeconds") == 0) {
             config.save_after_seconds = atoi(value);
         } else if (strcasecmp(key, "saveChanges") == 0) {
             config.save_after_changes = atoi(value);
+        } else if (strcasecmp(key, "rdbcompression") == 0) {
+            config.rdb_compression = strcasecmp(value, "yes") == 0;
+        } else if (strcasecmp(key, "rdb-load-threads") == 0) {
+            config.rdb_load_threads = atoi(value);
+            if (config.rdb_load_threads < 0) config.rdb_load_threads = 0;
+        } else if (strcasecmp(key, "appendonly") == 0) {
+            config.appendonly = strcasecmp(value, "yes") == 0;
+        } else if (strcasecmp(key, "appendfilename") == 0) {
+            strncpy(config.aof_filename, value, sizeof(config.aof_filename) - 1);
+        } else if (strcasecmp(key, "appendfsync") == 0) {
+            if (strcasecmp(value, "always") == 0) {
+                config.appendfsync = AOF_FSYNC_ALWAYS;
+            } else if (strcasecmp(value, "no") == 0) {
+                config.appendfsync = AOF_FSYNC_NO;
+            } else if (strcasecmp(value, "everysec") == 0) {
+                config.appendfsync = AOF_FSYNC_EVERYSEC;
+            } else {
+                fprintf(stderr, "Warning: unknown appendfsync '%s', using everysec.\n", value);
+                config.appendfsync = AOF_FSYNC_EVERYSEC;
+            }
+        } else if (strcasecmp(key, "auto-aof-rewrite-percentage") == 0) {
+            config.auto_aof_rewrite_percentage = atoi(value);
+        } else if (strcasecmp(key, "auto-aof-rewrite-min-size") == 0) {
+            config.auto_aof_rewrite_min_size = parse_memory(value);
         } else if (strcasecmp(key, "buffer_size") == 0) {
             config.buffer_size = atoi(value);
+        } else if (strcasecmp(key, "client-query-buffer-limit") == 0) {
+            config.query_buffer_limit = parse_memory(value);
         } else if (strcasecmp(key, "max_events") == 0) {
             config.max_events = atoi(value);
+        } else if (strcasecmp(key, "maxmemory") == 0) {
+            config.maxmemory = parse_memory(value);
+        } else if (strcasecmp(key, "maxmemory-policy") == 0) {
+            if (!dict_evict_policy_from_name(value, &config.maxmemory_policy)) {
+                fprintf(stderr, "Warning: unknown maxmemory-policy '%s', using %s.\n",
+                        value, dict_evict_policy_name(config.maxmemory_policy));
+            }
+        } else if (strcasecmp(key, "maxmemory-samples") == 0) {
+            config.maxmemory_samples = atoi(value);
+        } else if (strcasecmp(key, "lfu-log-factor") == 0) {
+            config.lfu_log_factor = atoi(value);
+        } else if (strcasecmp(key, "lfu-decay-time") == 0) {
+            config.lfu_decay_time = atoi(value);
+        } else if (strcasecmp(key, "hz") == 0) {
+            config.hz = atoi(value);
+            if (config.hz < 1) config.hz = 1;
+            if (config.hz > 500) config.hz = 500;
+        } else if (strcasecmp(key, "keyspace-shards") == 0) {
+            config.keyspace_shards = atoi(value);
+            if (config.keyspace_shards < 1) config.keyspace_shards = 1;
+            if (config.keyspace_shards > KEYSPACE_MAX_SHARDS) config.keyspace_shards = KEYSPACE_MAX_SHARDS;
+        } else if (strcasecmp(key, "io-threads") == 0) {
+            config.io_threads = atoi(value);
+            if (config.io_threads < 1) config.io_threads = 1;
+            if (config.io_threads > IO_THREADS_MAX) config.io_threads = IO_THREADS_MAX;
+        } else if (strcasecmp(key, "reactors") == 0) {
+            config.reactors = atoi(value);
+            if (config.reactors < 1) config.reactors = 1;
+            if (config.reactors > KEYSPACE_MAX_SHARDS) config.reactors = KEYSPACE_MAX_SHARDS;
+        } else if (strcasecmp(key, "client-output-buffer-limit") == 0) {
+            if (!parse_output_limit(value)) {
+                fprintf(stderr, "Warning: invalid client-output-buffer-limit '%s', expected <normal|pubsub> <hard> <soft> <seconds>.\n", value);
+            }
         }
     }
 
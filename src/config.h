@@ -2,23 +2,67 @@
 #define CONFIG_H
 
 #include <stddef.h>
+#include "dict.h"
 
 // Enum for concurrency models
 typedef enum {
     CONCURRENCY_THREADED,
-    CONCURRENCY_EVENTLOOP
+    CONCURRENCY_EVENTLOOP,
+    CONCURRENCY_URING       // event loop on io_uring instead of epoll
 } concurrency_model_t;
 
+// clients with separate output buffer limits
+typedef enum {
+    CLIENT_CLASS_NORMAL,
+    CLIENT_CLASS_PUBSUB, // subscribed to at least one channel or pattern
+    CLIENT_CLASS_COUNT
+} client_class_t;
+
+// a client whose pending output goes over hard, or stays over soft for
+// soft_seconds, is disconnected. 0 disables a limit
+typedef struct output_buffer_limit {
+    size_t hard;
+    size_t soft;
+    int soft_seconds;
+} output_buffer_limit_t;
+
+// when the append-only file is fsynced
+typedef enum {
+    AOF_FSYNC_NO,        // never, the kernel writes it back
+    AOF_FSYNC_EVERYSEC,  // once a second, a crash loses up to a second of writes
+    AOF_FSYNC_ALWAYS     // before replying to a write
+} aof_fsync_t;
+
 // Structure to hold all server configuration
 typedef struct server_config {
     int port;
     concurrency_model_t concurrency_model;
     int max_clients;
+    int worker_threads; // threads serving clients in the threaded model, 0 = one per cpu
+    int tcp_backlog; // connections the kernel queues before they are accepted
     char log_file[256];
     int save_after_seconds;
     int save_after_changes;
-    int buffer_size;
+    int rdb_compression; // lz4-compress values in rdb files
+    int rdb_load_threads; // threads decoding the rdb file at startup, 0 = one per cpu
+    int appendonly; // log writes to the append-only file and load it at startup
+    char aof_filename[256];
+    aof_fsync_t appendfsync;
+    int auto_aof_rewrite_percentage; // growth since the last rewrite that starts one, 0 = never
+    size_t auto_aof_rewrite_min_size; // no automatic rewrite below this size
+    int buffer_size; // initial size of a client's query buffer
+    size_t query_buffer_limit; // bytes a query buffer may grow to for one command
     int max_events; // max events for epoll
+    size_t maxmemory; // bytes, 0 = no limit
+    dict_evict_policy maxmemory_policy;
+    int maxmemory_samples; // keys sampled per eviction round
+    int lfu_log_factor;
+    int lfu_decay_time; // minutes
+    int hz; // background maintenance (active expire, rehash) runs per second
+    int keyspace_shards; // independently locked parts of the keyspace, a power of two
+    int reactors; // event loop threads in the eventloop model, 1 = a single loop
+    int io_threads; // threads reading and writing sockets for a single event loop, 1 = none
+    output_buffer_limit_t output_limits[CLIENT_CLASS_COUNT];
 } server_config_t;
 
 // Global server configuration instance
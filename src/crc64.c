@@ -0,0 +1,58 @@
+#include "crc64.h"
+#include <pthread.h>
+
+#define CRC64_POLY 0xad93d23594c935a9ULL  // jones, bit-reversed below
+
+// slicing by 8: table[k][b] is the crc of byte b followed by k zero bytes,
+// so eight bytes of input take eight lookups instead of eight rounds
+static uint64_t crc64_table[8][256];
+static pthread_once_t crc64_once = PTHREAD_ONCE_INIT;
+
+static uint64_t reflect64(uint64_t v) {
+    uint64_t r = 0;
+    for (int i = 0; i < 64; i++) {
+        r = (r << 1) | (v & 1);
+        v >>= 1;
+    }
+    return r;
+}
+
+static void crc64_init(void) {
+    uint64_t poly = reflect64(CRC64_POLY);
+    for (int b = 0; b < 256; b++) {
+        uint64_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 1 ? (crc >> 1) ^ poly : crc >> 1;
+        }
+        crc64_table[0][b] = crc;
+    }
+    for (int b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint64_t prev = crc64_table[k - 1][b];
+            crc64_table[k][b] = (prev >> 8) ^ crc64_table[0][prev & 0xff];
+        }
+    }
+}
+
+uint64_t crc64(uint64_t crc, const void *data, size_t len) {
+    pthread_once(&crc64_once, crc64_init);
+    const unsigned char *p = data;
+
+    while (len >= 8) {
+        // little-endian whatever the host, compilers turn it into one load
+        uint64_t v = (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+                     (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+                     (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+        crc ^= v;
+        crc = crc64_table[7][crc & 0xff] ^ crc64_table[6][(crc >> 8) & 0xff] ^
+              crc64_table[5][(crc >> 16) & 0xff] ^ crc64_table[4][(crc >> 24) & 0xff] ^
+              crc64_table[3][(crc >> 32) & 0xff] ^ crc64_table[2][(crc >> 40) & 0xff] ^
+              crc64_table[1][(crc >> 48) & 0xff] ^ crc64_table[0][crc >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = crc64_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
@@ -0,0 +1,12 @@
+#ifndef CRC64_H
+#define CRC64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// crc-64 with the jones polynomial (reflected, no final xor), the one
+// redis checksums its rdb files with. start with crc 0 and feed the data
+// in as many pieces as convenient
+uint64_t crc64(uint64_t crc, const void *data, size_t len);
+
+#endif /* CRC64_H */
@@ -3,8 +3,11 @@
 
 #include <netinet/in.h>
 #include <signal.h>
-#include "dict.h"
+#include <pthread.h>
+#include <time.h>
+#include "keyspace.h"
 #include "config.h"
+#include "resp.h"
 
 // constants
 #define DEFAULT_PORT 6379
@@ -17,22 +20,54 @@ typedef struct client {
     char *buffer;
     size_t buffer_capacity;
     int buffer_pos;
+    resp_command cmd;            // the command being run, its arguments point into buffer
+    size_t cmd_parsed;           // the first command in buffer is already parsed into cmd, this long
     
     int in_transaction;          // flag to indicate if in MULTI state
     int transaction_errors;      // tracks if any errors occurred during MULTI
-    char **queued_commands;     
+    char **queued_commands;      // RESP encoded, NUL terminated
+    size_t *queued_lens;         // length of each queued command
     int queue_size;              // current size of queue
     int queue_capacity;          // allocated capacity of queue
+    keyspace_lockset tx_locks;   // shards EXEC holds for the queued commands
+
+    int forwarded;               // a command is running on another reactor, input is held back
+    int read_pending;            // input arrived while forwarded, read it once the command is done
+    int read_queued;             // on the event loop's read_ready list
+    struct client *next_ready;   // event loop: next client with input left to read
+    int write_queued;            // on the event loop's write_ready list
+    struct client *next_write;   // event loop: next client whose replies wait for the aof fsync
+    // io threads: outcome of the read (1, 0 if the client hung up, -errno)
+    // or write (1, 0 if it failed) done for the event loop on another thread
+    int io_status;
+    int io_more;                 // the read stopped with input possibly left
+
+    // output buffer, see reply.h. locked because publishers on other
+    // threads append to subscribers
+    pthread_mutex_t reply_lock;
+    char *reply;
+    size_t reply_len;            // bytes buffered
+    size_t reply_sent;           // of those, bytes already written
+    size_t reply_capacity;
+    time_t reply_soft_limit_since; // when the output went over the soft limit, 0 if it isn't
+    int reply_closing;           // over its output limit, being disconnected
+    int epoll_fd;                // event loop watching the socket, -1 in the threaded model
+    int write_registered;        // EPOLLOUT is registered for the leftover output
+    // set when the event loop writes the output itself (io_uring): output
+    // another thread adds is handed to it instead of written right away
+    void (*reply_handoff)(struct client *client);
+    int subscriptions;           // channels and patterns subscribed to
+    int worker_events;           // threaded model: events for the client not yet served, see workers.c
+    struct client *next_closed;  // event loop: next client waiting to be freed
 } client_t;
 
 // function prototypes
 void handle_signal(int sig);
-void *handle_client(void *arg);
 void register_client(client_t *client);
 void unregister_client(client_t *client);
 client_t *get_client_by_socket(int socket);
 
 // global dictionary
-extern dict *server_db;
+extern keyspace *server_db;
 
 #endif /* CRIMSONCACHE_H */
\ No newline at end of file
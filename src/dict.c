@@ -1,18 +1,28 @@
 #define _POSIX_C_SOURCE 200809L
 #include "dict.h"
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <time.h>
 #include <sys/time.h>
+#include <malloc.h>
+#include <limits.h>
 
 // simple hash function  -- djb2 //http://www.cse.yorku.ca/~oz/hash.html
-static size_t dict_hash(const char *key) {
-    size_t hash = 5381;
+// followed by a 64-bit finalizer so the high bits (used by the swiss engine's
+// control bytes) are as well mixed as the low ones (used for the index)
+uint64_t dict_hash(const char *key) {
+    uint64_t hash = 5381;
     int c;
-    
+
     while ((c = *key++))
         hash = ((hash << 5) + hash) + c;
-    
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
     return hash;
 }
 
@@ -24,306 +34,955 @@ static uint64_t current_time_ms() {
 }
 //used for key expiration and LRU timestamp tracking
 
+// xorshift64 -- only used to pick sampling positions and lfu increments.
+// per thread, since lookups on different shards run in parallel
+static __thread uint64_t random_state = 88172645463325252ULL;
+static uint64_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+// lru clock: milliseconds truncated to 32 bits. idle times are computed with
+// unsigned wrap-around, so they stay exact for ~49 days of inactivity
+static uint32_t lru_clock(void) {
+    return (uint32_t)current_time_ms();
+}
+
+// lfu data packs the minute of the last decay in the upper 16 bits and a
+// logarithmic access counter in the lower 8 bits of cc_obj->lru
+static uint32_t lfu_time_minutes(void) {
+    return (uint32_t)(current_time_ms() / 60000) & 0xFFFF;
+}
+
+// counter after applying the decay for the minutes elapsed since it was
+// last touched
+static unsigned int lfu_decayed_counter(const dict *d, uint32_t lru) {
+    uint32_t ldt = lru >> 8;
+    unsigned int counter = lru & 0xFF;
+    uint32_t now = lfu_time_minutes();
+    uint32_t elapsed = now >= ldt ? now - ldt : 65535 - ldt + now;
+
+    uint32_t periods = d->lfu_decay_time > 0 ? elapsed / (uint32_t)d->lfu_decay_time : 0;
+    return periods > counter ? 0 : counter - periods;
+}
+
+// increment with probability 1/((counter - init) * factor + 1), so hot keys
+// need exponentially more hits to climb further
+static unsigned int lfu_log_incr(const dict *d, unsigned int counter) {
+    if (counter == 255) return 255;
+
+    double r = (double)next_random() / (double)UINT64_MAX;
+    double base = counter > DICT_LFU_INIT_VAL ? counter - DICT_LFU_INIT_VAL : 0;
+    double p = 1.0 / (base * d->lfu_log_factor + 1);
+    if (r < p) counter++;
+    return counter;
+}
+
+static int policy_is_lfu(const dict *d) {
+    return d->eviction_policy == DICT_EVICT_ALLKEYS_LFU;
+}
+
+// record an access to val for the configured eviction policy. readers of
+// a shared dict (dict_find) may touch the same value at once, so the field
+// is read and written with relaxed atomics and a racing update is just lost
+static void touch_value(dict *d, cc_obj *val) {
+    uint32_t lru;
+    if (policy_is_lfu(d)) {
+        unsigned int counter = lfu_decayed_counter(d, __atomic_load_n(&val->lru, __ATOMIC_RELAXED));
+        counter = lfu_log_incr(d, counter);
+        lru = (lfu_time_minutes() << 8) | counter;
+    } else {
+        lru = lru_clock();
+    }
+    __atomic_store_n(&val->lru, lru, __ATOMIC_RELAXED);
+}
+
+// access data for a value that has never been read
+static void init_access(dict *d, cc_obj *val) {
+    if (policy_is_lfu(d)) {
+        // new keys start above zero so they are not evicted right away
+        val->lru = (lfu_time_minutes() << 8) | DICT_LFU_INIT_VAL;
+    } else {
+        val->lru = lru_clock();
+    }
+}
+
+// round up to power of 2
+static size_t next_power(size_t size) {
+    size_t n = DICT_HT_INITIAL_SIZE;
+    while (n < size) n *= 2;
+    return n;
+}
+
+// bytes the allocator really reserved for p, including its size class
+// rounding. this is what memory accounting is based on, not the requested size
+size_t dict_alloc_size(const void *p) {
+    return p ? malloc_usable_size((void *)p) : 0;
+}
+
+// heap footprint of an entry: the entry itself (header, key and embedded
+// value) plus a separately allocated value
+static size_t entry_memory(const dict_entry *entry) {
+    size_t mem = dict_alloc_size(entry);
+    if (entry->val.encoding == CC_ENC_RAW) mem += dict_alloc_size(entry->val.ptr);
+    return mem;
+}
+
+// add (sign > 0) or remove an entry from the memory counters. payload only
+// counts the bytes a client handed us that the entry stores, everything
+// else is overhead. an integer is held in the value header, it has no
+// bytes of its own
+static void account_entry(dict *d, const dict_entry *entry, int sign) {
+    size_t mem = entry_memory(entry);
+    size_t payload = strlen(entry->key);
+    if (entry->val.encoding != CC_ENC_INT) payload += entry->val.size;
+
+    if (sign > 0) {
+        d->entries_memory += mem;
+        d->payload_memory += payload;
+    } else {
+        d->entries_memory -= mem;
+        d->payload_memory -= payload;
+    }
+}
+
+// expiry index: a binary min-heap of the entries that have an expire,
+// ordered by expire time, so the active expire cycle only ever looks at keys
+// that are actually due. every indexed entry keeps its 1-based heap position
+// in val.expire_idx, which makes removal and updates O(log n)
+#define EXPIRES_INITIAL_SIZE 16
+
+static void expires_place(dict *d, size_t i, dict_entry *entry) {
+    d->expires[i] = entry;
+    entry->val.expire_idx = (uint32_t)(i + 1);
+}
+
+static void expires_sift_up(dict *d, size_t i) {
+    dict_entry *entry = d->expires[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (d->expires[parent]->val.expire <= entry->val.expire) break;
+        expires_place(d, i, d->expires[parent]);
+        i = parent;
+    }
+    expires_place(d, i, entry);
+}
+
+static void expires_sift_down(dict *d, size_t i) {
+    dict_entry *entry = d->expires[i];
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= d->expires_used) break;
+        if (child + 1 < d->expires_used &&
+            d->expires[child + 1]->val.expire < d->expires[child]->val.expire) {
+            child++;
+        }
+        if (entry->val.expire <= d->expires[child]->val.expire) break;
+        expires_place(d, i, d->expires[child]);
+        i = child;
+    }
+    expires_place(d, i, entry);
+}
+
+static int expires_insert(dict *d, dict_entry *entry) {
+    if (d->expires_used == d->expires_size) {
+        size_t size = d->expires_size ? d->expires_size * 2 : EXPIRES_INITIAL_SIZE;
+        dict_entry **expires = realloc(d->expires, size * sizeof(dict_entry*));
+        if (!expires) return 0;
+        d->expires = expires;
+        d->expires_size = size;
+    }
+
+    d->expires[d->expires_used++] = entry;
+    expires_sift_up(d, d->expires_used - 1);
+    return 1;
+}
+
+static void expires_remove(dict *d, dict_entry *entry) {
+    size_t i = entry->val.expire_idx - 1;
+    entry->val.expire_idx = 0;
+
+    dict_entry *last = d->expires[--d->expires_used];
+    if (i != d->expires_used) {
+        // fill the hole with the last entry and restore the heap order
+        expires_place(d, i, last);
+        expires_sift_up(d, i);
+        expires_sift_down(d, last->val.expire_idx - 1);
+    }
+
+    // give memory back after a mass expiry
+    if (d->expires_size > EXPIRES_INITIAL_SIZE && d->expires_used < d->expires_size / 4) {
+        dict_entry **expires = realloc(d->expires, d->expires_size / 2 * sizeof(dict_entry*));
+        if (expires) {
+            d->expires = expires;
+            d->expires_size /= 2;
+        }
+    }
+}
+
+// set the expire of an entry and keep the index in sync with it
+static int set_entry_expire(dict *d, dict_entry *entry, uint64_t expire) {
+    entry->val.expire = expire;
+
+    if (expire == 0) {
+        if (entry->val.expire_idx) expires_remove(d, entry);
+        return 1;
+    }
+    if (!entry->val.expire_idx) return expires_insert(d, entry);
+
+    expires_sift_up(d, entry->val.expire_idx - 1);
+    expires_sift_down(d, entry->val.expire_idx - 1);
+    return 1;
+}
+
+// free an entry together with its key and value
+static void free_entry(dict *d, dict_entry *entry) {
+    if (entry->val.expire_idx) expires_remove(d, entry);
+    account_entry(d, entry, -1);
+    if (entry->val.encoding == CC_ENC_RAW) free(entry->val.ptr);
+    free(entry);
+}
+
+// bytes of value storage an embedded entry has room for after its key
+static size_t embed_capacity(const dict_entry *entry, size_t key_len) {
+    size_t used = sizeof(dict_entry) + key_len + 1;
+    size_t usable = dict_alloc_size(entry);
+    return usable > used ? usable - used : 0;
+}
+
+// a value to be stored: len bytes at str, or an integer when str is NULL
+typedef struct value_src {
+    const char *str;
+    size_t len;
+    long long ival;
+} value_src;
+
+// whether a string value of len bytes wants to live inside the entry
+static int wants_embed(const value_src *v) {
+    return v->str && v->len <= DICT_EMBED_VALUE_MAX;
+}
+
+// store v in entry: integers in ival, strings embedded after the key when
+// short enough and there is room, in a separate buffer otherwise. the old
+// value is freed
+static int store_value(dict_entry *entry, size_t key_len, const value_src *v) {
+    if (!v->str) {
+        if (entry->val.encoding == CC_ENC_RAW) free(entry->val.ptr);
+        entry->val.type = CC_INT;
+        entry->val.encoding = CC_ENC_INT;
+        entry->val.ival = v->ival;
+        entry->val.size = sizeof(long long);
+        return 1;
+    }
+
+    if (wants_embed(v) && v->len + 1 <= embed_capacity(entry, key_len)) {
+        if (entry->val.encoding == CC_ENC_RAW) free(entry->val.ptr);
+        entry->val.encoding = CC_ENC_EMBED;
+        entry->val.ptr = entry->key + key_len + 1;
+    } else {
+        char *buf = entry->val.encoding == CC_ENC_RAW ? entry->val.ptr : NULL;
+        buf = realloc(buf, v->len + 1);
+        if (!buf) return 0;
+        entry->val.encoding = CC_ENC_RAW;
+        entry->val.ptr = buf;
+    }
+
+    memcpy(entry->val.ptr, v->str, v->len);
+    ((char *)entry->val.ptr)[v->len] = '\0';
+    entry->val.type = CC_STRING;
+    entry->val.size = v->len;
+    return 1;
+}
+
+// allocate an entry for key, with room to embed the value if it is short
+static dict_entry *new_entry(const char *key, size_t key_len, const value_src *v) {
+    size_t alloc = sizeof(dict_entry) + key_len + 1;
+    if (wants_embed(v)) alloc += v->len + 1;
+
+    dict_entry *entry = malloc(alloc);
+    if (!entry) return NULL;
+
+    memcpy(entry->key, key, key_len + 1);
+    entry->val.encoding = CC_ENC_EMBED;
+    entry->val.ptr = NULL;
+    entry->val.expire = 0;
+    entry->val.expire_idx = 0;
+    if (!store_value(entry, key_len, v)) {
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+// strict string to long long: only the canonical form ("-12", not "+12",
+// "012" or " 12") converts, so the integer prints back as the same string
+int dict_string_to_ll(const char *s, size_t len, long long *out) {
+    if (len == 0 || len > CC_INT_STR_SIZE - 1) return 0;
+
+    size_t i = 0;
+    int negative = 0;
+    if (s[0] == '-') {
+        negative = 1;
+        i++;
+        if (len == 1) return 0;
+    }
+    if (s[i] == '0' && (len > i + 1 || negative)) return 0; // leading zero or "-0"
+
+    unsigned long long v = 0;
+    for (; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return 0;
+        unsigned int digit = s[i] - '0';
+        if (v > (ULLONG_MAX - digit) / 10) return 0;
+        v = v * 10 + digit;
+    }
+
+    if (negative) {
+        if (v > (unsigned long long)LLONG_MAX + 1) return 0;
+        *out = (long long)(0 - v);
+    } else {
+        if (v > (unsigned long long)LLONG_MAX) return 0;
+        *out = (long long)v;
+    }
+    return 1;
+}
+
+// decimal strings of the shared small integers, filled in by dict_create
+static char shared_integers[DICT_SHARED_INTEGERS][8];
+static uint8_t shared_integer_lens[DICT_SHARED_INTEGERS];
+
+static void init_shared_integers(void) {
+    static int initialized = 0;
+    if (initialized) return;
+
+    for (int i = 0; i < DICT_SHARED_INTEGERS; i++) {
+        shared_integer_lens[i] = snprintf(shared_integers[i], sizeof(shared_integers[i]), "%d", i);
+    }
+    initialized = 1;
+}
+
+// string form of a value. integers come from the shared pool when small and
+// are formatted into buf (CC_INT_STR_SIZE bytes) otherwise. len is optional
+const char *cc_obj_str(const cc_obj *obj, char *buf, size_t *len) {
+    if (obj->type != CC_INT) {
+        if (len) *len = obj->size;
+        return obj->ptr;
+    }
+
+    if (obj->ival >= 0 && obj->ival < DICT_SHARED_INTEGERS) {
+        if (len) *len = shared_integer_lens[obj->ival];
+        return shared_integers[obj->ival];
+    }
+
+    int n = snprintf(buf, CC_INT_STR_SIZE, "%lld", obj->ival);
+    if (len) *len = n;
+    return buf;
+}
 
 // create a new dictionary
 dict* dict_create(size_t initial_size) {
     dict *d = malloc(sizeof(dict));
     if (!d) return NULL;
-    
-    if (initial_size < 4) initial_size = 4;
-    
-    // round up to power of 2
-    size_t size = 1;
-    while (size < initial_size) size *= 2;
-    
-    d->table = calloc(size, sizeof(dict_entry*));
-    if (!d->table) {
+
+    init_shared_integers();
+
+    if (!dict_ht_init(&d->ht[0], next_power(initial_size))) {
         free(d);
         return NULL;
     }
-    
-    d->size = size;
+
+    memset(&d->ht[1], 0, sizeof(dict_ht));
+    d->rehash_idx = -1;
+    d->pause_rehash = 0;
     d->used = 0;
-    d->mask = size - 1;
     d->max_memory = 0; // No limit by default
-    d->used_memory = 0;
-    
+    d->entries_memory = 0;
+    d->payload_memory = 0;
+    d->eviction_policy = DICT_DEFAULT_EVICTION_POLICY;
+    d->eviction_samples = DICT_DEFAULT_EVICTION_SAMPLES;
+    d->lfu_log_factor = DICT_DEFAULT_LFU_LOG_FACTOR;
+    d->lfu_decay_time = DICT_DEFAULT_LFU_DECAY_TIME;
+    d->stat_evicted_keys = 0;
+    d->expires = NULL;
+    d->expires_used = 0;
+    d->expires_size = 0;
+    d->stat_expired_keys = 0;
+    d->stat_expire_cap_reached = 0;
+    d->stat_expire_cycle_us = 0;
+
+    d->evict_pool = calloc(DICT_EVPOOL_SIZE, sizeof(dict_evict_candidate));
+    if (!d->evict_pool) {
+        dict_ht_release(&d->ht[0]);
+        free(d);
+        return NULL;
+    }
+
     return d;
 }
 
 // free the dictionary and all entries
 void dict_free(dict *d) {
     if (!d) return;
-    
-    for (size_t i = 0; i < d->size; i++) {
-        dict_entry *entry = d->table[i];
-        while (entry) {
-            dict_entry *next = entry->next;
-            free(entry->key);
-            
-            // free value object
-            if (entry->val) {
-                free(entry->val->ptr);
-                free(entry->val);
-            }
-            
-            free(entry);
-            entry = next;
-        }
+
+    dict_iterator it;
+    dict_entry *entry;
+    dict_iter_init(&it, d);
+    while ((entry = dict_iter_next(&it)) != NULL) {
+        free_entry(d, entry);
+    }
+    dict_iter_release(&it);
+
+    dict_ht_release(&d->ht[0]);
+    dict_ht_release(&d->ht[1]);
+
+    for (int i = 0; i < DICT_EVPOOL_SIZE; i++) {
+        free(d->evict_pool[i].key);
     }
-    
-    free(d->table);
+    free(d->evict_pool);
+    free(d->expires);
     free(d);
 }
 
-// add or update a key-value pair
-int dict_add(dict *d, const char *key, cc_obj *val) {
-    if (!d || !key || !val) return 0;
-    
-    // check if we need to resize
-    if (d->used >= d->size) {
+// remove every key, settings and statistics stay. returns 0 if out of
+// memory, with the dict left as it was
+int dict_empty(dict *d) {
+    dict_ht ht;
+    if (!dict_ht_init(&ht, DICT_HT_INITIAL_SIZE)) return 0;
+
+    dict_iterator it;
+    dict_entry *entry;
+    dict_iter_init(&it, d);
+    while ((entry = dict_iter_next(&it)) != NULL) {
+        free_entry(d, entry);
+    }
+    dict_iter_release(&it);
+
+    dict_ht_release(&d->ht[0]);
+    dict_ht_release(&d->ht[1]);
+    d->ht[0] = ht;
+    memset(&d->ht[1], 0, sizeof(dict_ht));
+    d->rehash_idx = -1;
+    d->used = 0;
+    return 1;
+}
+
+// start an incremental rehash into a table of the given size. entries are
+// migrated a few buckets at a time by dict_rehash() so no single call has
+// to touch the whole keyspace
+int dict_expand(dict *d, size_t size) {
+    if (!d || dict_is_rehashing(d)) return 0;
+
+    // a same-size rehash is still useful when it clears out tombstones
+    size_t new_size = next_power(size);
+    if (new_size == d->ht[0].size && !dict_ht_needs_grow(&d->ht[0])) return 0;
+
+    if (!dict_ht_init(&d->ht[1], new_size)) return 0;
+
+    d->rehash_idx = 0;
+    return 1;
+}
+
+// size the table of an empty dict for entries keys at once, so adding
+// them never grows it. the engine decides how full a table may get
+int dict_reserve(dict *d, size_t entries) {
+    if (!d || d->used > 0 || dict_is_rehashing(d)) return 0;
+
+    dict_ht probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.size = next_power(entries);
+    probe.used = entries;
+    while (dict_ht_needs_grow(&probe)) probe.size *= 2;
+    if (probe.size <= d->ht[0].size) return 1;
+
+    dict_ht ht;
+    if (!dict_ht_init(&ht, probe.size)) return 0;
+    dict_ht_release(&d->ht[0]);
+    d->ht[0] = ht;
+    return 1;
+}
+
+// grow or shrink the table so it fits the current number of entries
+void dict_resize(dict *d) {
+    if (!d || dict_is_rehashing(d) || d->pause_rehash > 0) return;
+
+    size_t size = d->ht[0].size;
+    if (dict_ht_needs_grow(&d->ht[0])) {
+        dict_expand(d, d->used * 2);
+    } else if (size > DICT_HT_INITIAL_SIZE && d->used < size / DICT_SHRINK_RATIO) {
+        dict_expand(d, d->used * 2);
+    }
+}
+
+// rehash in batches of 100 buckets for roughly ms milliseconds. used by the
+// background maintenance thread so an idle server still finishes migrating
+int dict_rehash_ms(dict *d, int ms) {
+    if (!d || d->pause_rehash > 0) return 0;
+
+    // also the place where an idle table notices it can shrink
+    if (!dict_is_rehashing(d)) dict_resize(d);
+
+    uint64_t start = current_time_ms();
+    int rehashes = 0;
+
+    while (dict_rehash(d, 100)) {
+        rehashes += 100;
+        if (current_time_ms() - start > (uint64_t)ms) break;
+    }
+    return rehashes;
+}
+
+// one bucket of migration piggybacked on normal lookups and updates
+static void rehash_step(dict *d) {
+    if (d->pause_rehash == 0) dict_rehash(d, 1);
+}
+
+// find the entry for key in either table
+static dict_entry *find_entry(dict *d, const char *key) {
+    uint64_t hash = dict_hash(key);
+
+    dict_entry *entry = dict_ht_find(&d->ht[0], key, hash);
+    // ht[1] only has entries while rehashing
+    if (!entry && dict_is_rehashing(d)) {
+        entry = dict_ht_find(&d->ht[1], key, hash);
+    }
+    return entry;
+}
+
+// remove the entry for key from whichever table holds it, without freeing it
+static dict_entry *unlink_entry(dict *d, const char *key) {
+    uint64_t hash = dict_hash(key);
+
+    dict_entry *entry = dict_ht_unlink(&d->ht[0], key, hash);
+    if (!entry && dict_is_rehashing(d)) {
+        entry = dict_ht_unlink(&d->ht[1], key, hash);
+    }
+    if (entry) d->used--;
+    return entry;
+}
+
+// create key or overwrite its value with v. returns the stored object, or
+// NULL if out of memory
+static cc_obj *set_value(dict *d, const char *key, const value_src *v, uint64_t expire) {
+    if (!d || !key) return NULL;
+
+    // make room first, so the entry we return can't be evicted under us
+    dict_evict_if_needed(d);
+
+    if (dict_is_rehashing(d)) {
+        rehash_step(d);
+    } else if (dict_ht_needs_grow(&d->ht[0])) {
+        // check if we need to resize
         dict_resize(d);
     }
-    
-    // hash the key
-    size_t idx = dict_hash(key) & d->mask;
-    
+
+    size_t key_len = strlen(key);
+
     // check if key already exists
-    dict_entry *entry = d->table[idx];
-    while (entry) {
-        if (strcmp(entry->key, key) == 0) {
-            // update existing entry
-            // free old value
-            if (entry->val) {
-                d->used_memory -= entry->val->size;
-                free(entry->val->ptr);
-                free(entry->val);
+    dict_entry *entry = find_entry(d, key);
+    if (entry) {
+        // an overwrite keeps the key's access frequency
+        uint32_t lru = entry->val.lru;
+
+        account_entry(d, entry, -1);
+        if (wants_embed(v) && v->len + 1 > embed_capacity(entry, key_len)) {
+            // short value that doesn't fit the allocation, move to a new entry
+            dict_entry *moved = new_entry(key, key_len, v);
+            if (!moved) {
+                account_entry(d, entry, 1);
+                return NULL;
             }
-            
-            // set new value
-            entry->val = val;
-            val->last_access = current_time_ms();
-            d->used_memory += val->size;
-            
-            // check if we need to evict
-            dict_evict_lru_if_needed(d);
-            return 1;
+            // the new entry goes in first, so a full table leaves the old
+            // one where it was
+            uint64_t hash = dict_hash(key);
+            dict_ht *ht = dict_is_rehashing(d) ? &d->ht[1] : &d->ht[0];
+            if (!dict_ht_insert(ht, moved, hash)) {
+                free(moved);
+                account_entry(d, entry, 1);
+                return NULL;
+            }
+            dict_entry *old = entry;
+            if (!dict_ht_remove(&d->ht[0], old, hash)) dict_ht_remove(&d->ht[1], old, hash);
+
+            // the new entry takes over the old one's place in the expiry heap
+            if (old->val.expire_idx) {
+                moved->val.expire = old->val.expire;
+                expires_place(d, old->val.expire_idx - 1, moved);
+            }
+            if (old->val.encoding == CC_ENC_RAW) free(old->val.ptr);
+            free(old);
+            entry = moved;
+        } else if (!store_value(entry, key_len, v)) {
+            account_entry(d, entry, 1);
+            return NULL;
+        }
+
+        entry->val.lru = lru;
+        touch_value(d, &entry->val);
+        account_entry(d, entry, 1);
+
+        if (!set_entry_expire(d, entry, expire)) {
+            dict_delete(d, key);
+            return NULL;
         }
-        entry = entry->next;
+        return &entry->val;
     }
-    
+
     // create new entry
-    entry = malloc(sizeof(dict_entry));
-    if (!entry) return 0;
-    
-    entry->key = strdup(key);
-    if (!entry->key) {
+    entry = new_entry(key, key_len, v);
+    if (!entry) return NULL;
+
+    // new entries always go to the table being rehashed into
+    dict_ht *ht = dict_is_rehashing(d) ? &d->ht[1] : &d->ht[0];
+    if (!dict_ht_insert(ht, entry, dict_hash(key))) {
+        if (entry->val.encoding == CC_ENC_RAW) free(entry->val.ptr);
         free(entry);
-        return 0;
+        return NULL;
     }
-    
-    entry->val = val;
-    val->last_access = current_time_ms();
-    d->used_memory += val->size;
-    
-    // add to hash table (prepend to list at idx)
-    entry->next = d->table[idx];
-    d->table[idx] = entry;
+
+    init_access(d, &entry->val);
+    account_entry(d, entry, 1);
     d->used++;
-    
-    // check if we need to evict
-    dict_evict_lru_if_needed(d);
-    return 1;
+
+    if (!set_entry_expire(d, entry, expire)) {
+        dict_delete(d, key);
+        return NULL;
+    }
+    return &entry->val;
+}
+
+// set key to a string value of len bytes, creating it or overwriting the
+// existing value. strings that are integers are stored as CC_INT
+cc_obj *dict_set(dict *d, const char *key, const char *val, size_t len, uint64_t expire) {
+    if (!val) return NULL;
+
+    value_src v = {val, len, 0};
+    if (dict_string_to_ll(val, len, &v.ival)) v.str = NULL;
+    return set_value(d, key, &v, expire);
+}
+
+// set key to an integer value
+cc_obj *dict_set_int(dict *d, const char *key, long long val, uint64_t expire) {
+    value_src v = {NULL, 0, val};
+    return set_value(d, key, &v, expire);
 }
 
 // get a value by key
 cc_obj* dict_get(dict *d, const char *key) {
     if (!d || !key) return NULL;
-    
-    // hash the key
-    size_t idx = dict_hash(key) & d->mask;
-    
+
+    if (dict_is_rehashing(d)) rehash_step(d);
+
     // search for the key
-    dict_entry *entry = d->table[idx];
-    while (entry) {
-        if (strcmp(entry->key, key) == 0) {
-            // check if expired
-            if (entry->val->expire != 0 && entry->val->expire < current_time_ms()) {
-                // actually delete the expired key
-                dict_delete(d, key);
-                return NULL;
-            }
-            
-            // update access time for LRU
-            entry->val->last_access = current_time_ms();
-            return entry->val;
-        }
-        entry = entry->next;
+    dict_entry *entry = find_entry(d, key);
+    if (!entry) return NULL;
+
+    // check if expired
+    if (entry->val.expire != 0 && entry->val.expire < current_time_ms()) {
+        // actually delete the expired key
+        dict_delete(d, key);
+        d->stat_expired_keys++;
+        return NULL;
     }
-    
-    return NULL;
+
+    // update access data for LRU / LFU
+    touch_value(d, &entry->val);
+    return &entry->val;
+}
+
+// lookup that never modifies the tables: no rehash step, and an expired key
+// is reported missing but left for the expire cycle or the next write.
+// concurrent dict_find calls on the same dict are safe as long as nothing
+// else modifies it (see keyspace.c)
+cc_obj *dict_find(dict *d, const char *key) {
+    if (!d || !key) return NULL;
+
+    dict_entry *entry = find_entry(d, key);
+    if (!entry) return NULL;
+    if (entry->val.expire != 0 && entry->val.expire < current_time_ms()) return NULL;
+
+    touch_value(d, &entry->val);
+    return &entry->val;
 }
 
 // delete a key
 int dict_delete(dict *d, const char *key) {
     if (!d || !key) return 0;
-    
-    // hash the key
-    size_t idx = dict_hash(key) & d->mask;
-    
-    dict_entry *entry = d->table[idx];
-    dict_entry *prev = NULL;
-    
-    // search for the key
-    while (entry) {
-        if (strcmp(entry->key, key) == 0) {
-            // found the key, remove it
-            if (prev) {
-                prev->next = entry->next;
-            } else {
-                d->table[idx] = entry->next;
-            }
-            
-            // update used memory
-            if (entry->val) {
-                d->used_memory -= entry->val->size;
-                free(entry->val->ptr);
-                free(entry->val);
-            }
-            
-            free(entry->key);
-            free(entry);
-            d->used--;
+
+    if (dict_is_rehashing(d)) rehash_step(d);
+
+    dict_entry *entry = unlink_entry(d, key);
+    if (!entry) return 0;
+
+    free_entry(d, entry);
+
+    // give memory back once the table is mostly empty
+    dict_resize(d);
+    return 1;
+}
+
+// heap footprint of a single key, 0 if it does not exist. does not count
+// as an access for eviction
+size_t dict_key_memory(dict *d, const char *key) {
+    if (!d || !key) return 0;
+
+    dict_entry *entry = find_entry(d, key);
+    if (!entry) return 0;
+    if (entry->val.expire != 0 && entry->val.expire < current_time_ms()) return 0;
+
+    return entry_memory(entry);
+}
+
+// set or clear (expire = 0) the expire time of a key. returns 0 if the key
+// does not exist
+int dict_set_expire(dict *d, const char *key, uint64_t expire) {
+    if (!d || !key) return 0;
+
+    dict_entry *entry = find_entry(d, key);
+    if (!entry) return 0;
+
+    if (!set_entry_expire(d, entry, expire)) {
+        // out of memory for the index, an expire we can't track is dropped
+        entry->val.expire = 0;
+        return 0;
+    }
+    return 1;
+}
+
+static uint64_t current_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// active expiration: remove keys whose ttl has passed, soonest first, for at
+// most budget_us microseconds (0 = no limit). returns 1 if it stopped on the
+// time limit with expired keys still left, so the caller can come back sooner
+int dict_expire_cycle(dict *d, long budget_us) {
+    if (!d || d->expires_used == 0) return 0;
+
+    uint64_t start = current_time_us();
+    uint64_t now = current_time_ms();
+    int expired = 0;
+    int timed_out = 0;
+
+    while (d->expires_used > 0 && d->expires[0]->val.expire < now) {
+        dict_entry *entry = d->expires[0];
+        unlink_entry(d, entry->key);
+        free_entry(d, entry);
+        d->stat_expired_keys++;
+
+        // checking the clock is not free, do it every 16 keys
+        if ((++expired & 15) == 0 && budget_us > 0 &&
+            current_time_us() - start > (uint64_t)budget_us) {
+            timed_out = d->expires_used > 0 && d->expires[0]->val.expire < now;
+            break;
+        }
+    }
+
+    if (timed_out) d->stat_expire_cap_reached++;
+    d->stat_expire_cycle_us += current_time_us() - start;
+
+    if (expired) dict_resize(d);
+    return timed_out;
+}
+
+// pick up to count entries around random positions of the table(s)
+static int sample_entries(dict *d, dict_entry **out, int count) {
+    int stored = dict_ht_sample(&d->ht[0], next_random(), out, count);
+    if (stored < count && dict_is_rehashing(d)) {
+        stored += dict_ht_sample(&d->ht[1], next_random(), out + stored, count - stored);
+    }
+    return stored;
+}
+
+// volatile policies only consider keys with an expire, so sample those
+// straight from the expiry index. the heap root is always included, it is
+// the best volatile-ttl candidate there is
+static int sample_volatile(dict *d, dict_entry **out, int count) {
+    if (d->expires_used == 0) return 0;
+
+    out[0] = d->expires[0];
+    for (int i = 1; i < count; i++) {
+        out[i] = d->expires[next_random() % d->expires_used];
+    }
+    return count;
+}
+
+static const char *evict_policy_names[] = {
+    [DICT_EVICT_NOEVICTION] = "noeviction",
+    [DICT_EVICT_ALLKEYS_LRU] = "allkeys-lru",
+    [DICT_EVICT_VOLATILE_LRU] = "volatile-lru",
+    [DICT_EVICT_ALLKEYS_LFU] = "allkeys-lfu",
+    [DICT_EVICT_VOLATILE_TTL] = "volatile-ttl",
+    [DICT_EVICT_ALLKEYS_RANDOM] = "allkeys-random",
+};
+
+#define EVICT_POLICY_COUNT (int)(sizeof(evict_policy_names) / sizeof(evict_policy_names[0]))
+
+const char *dict_evict_policy_name(dict_evict_policy policy) {
+    if ((int)policy < 0 || (int)policy >= EVICT_POLICY_COUNT) return "unknown";
+    return evict_policy_names[policy];
+}
+
+// parse a maxmemory-policy name, returns 0 if it is not one we know
+int dict_evict_policy_from_name(const char *name, dict_evict_policy *policy) {
+    for (int i = 0; i < EVICT_POLICY_COUNT; i++) {
+        if (strcasecmp(name, evict_policy_names[i]) == 0) {
+            *policy = (dict_evict_policy)i;
             return 1;
         }
-        
-        prev = entry;
-        entry = entry->next;
     }
-    
     return 0;
 }
 
-// resize the dictionary
-void dict_resize(dict *d) {
-    if (!d) return;
-    
-    size_t new_size = d->size * 2;
-    dict_entry **new_table = calloc(new_size, sizeof(dict_entry*));
-    if (!new_table) return;
-    
-    // rehash all entries
-    for (size_t i = 0; i < d->size; i++) {
-        dict_entry *entry = d->table[i];
-        while (entry) {
-            dict_entry *next = entry->next;
-            
-            // recalculate index with new size
-            size_t idx = dict_hash(entry->key) & (new_size - 1);
-            
-            // move to new table
-            entry->next = new_table[idx];
-            new_table[idx] = entry;
-            
-            entry = next;
-        }
+// bucket / slot arrays of both tables, plus the expiry index
+size_t dict_tables_memory(const dict *d) {
+    return dict_ht_mem_usage(&d->ht[0]) + dict_ht_mem_usage(&d->ht[1]) +
+           dict_alloc_size(d->expires);
+}
+
+// everything the dataset holds on the heap: entries, keys, values and tables
+size_t dict_used_memory(const dict *d) {
+    return d->entries_memory + dict_tables_memory(d);
+}
+
+int dict_is_over_memory(const dict *d) {
+    return d->max_memory != 0 && dict_used_memory(d) > d->max_memory;
+}
+
+// how good a candidate val is under the current policy, higher goes first
+static uint64_t evict_score(dict *d, const cc_obj *val) {
+    switch (d->eviction_policy) {
+        case DICT_EVICT_ALLKEYS_LFU:
+            return 255 - lfu_decayed_counter(d, val->lru);
+        case DICT_EVICT_VOLATILE_TTL:
+            return UINT64_MAX - val->expire;
+        default:
+            return (uint32_t)(lru_clock() - val->lru);
     }
-    
-    // free old table and update dict
-    free(d->table);
-    d->table = new_table;
-    d->size = new_size;
-    d->mask = new_size - 1;
 }
 
-// clear expired keys
-void dict_clear_expired(dict *d) {
-    if (!d) return;
-    
-    uint64_t now = current_time_ms();
-    
-    for (size_t i = 0; i < d->size; i++) {
-        dict_entry *entry = d->table[i];
-        dict_entry *prev = NULL;
-        
-        while (entry) {
-            if (entry->val->expire != 0 && entry->val->expire < now) {
-                // this key has expired
-                dict_entry *next = entry->next;
-                
-                if (prev) {
-                    prev->next = next;
-                } else {
-                    d->table[i] = next;
-                }
-                
-                // Update used memory
-                d->used_memory -= entry->val->size;
-                
-                // Free memory
-                free(entry->key);
-                free(entry->val->ptr);
-                free(entry->val);
-                free(entry);
-                
-                d->used--;
-                entry = next;
-            } else {
-                prev = entry;
-                entry = entry->next;
+// merge a fresh sample into the eviction pool. the pool stays sorted by
+// score (ascending) so the best candidate is always the last one
+static void evict_pool_populate(dict *d) {
+    dict_entry *samples[64];
+    int count = d->eviction_samples;
+    if (count < 1) count = 1;
+    if (count > 64) count = 64;
+
+    int volatile_only = d->eviction_policy == DICT_EVICT_VOLATILE_LRU ||
+                        d->eviction_policy == DICT_EVICT_VOLATILE_TTL;
+    int n = volatile_only ? sample_volatile(d, samples, count) : sample_entries(d, samples, count);
+    dict_evict_candidate *pool = d->evict_pool;
+
+    for (int j = 0; j < n; j++) {
+        dict_entry *entry = samples[j];
+
+        uint64_t idle = evict_score(d, &entry->val);
+
+        // find the first slot with a larger score
+        int k = 0;
+        while (k < DICT_EVPOOL_SIZE && pool[k].key && pool[k].idle < idle) k++;
+
+        // skip keys already pooled, their score is refreshed in place
+        int dup = 0;
+        for (int i = 0; i < DICT_EVPOOL_SIZE && pool[i].key; i++) {
+            if (strcmp(pool[i].key, entry->key) == 0) {
+                dup = 1;
+                break;
             }
         }
+        if (dup) continue;
+
+        if (k == 0 && pool[DICT_EVPOOL_SIZE - 1].key) {
+            // pool is full and this one is worse than all of them
+            continue;
+        } else if (k < DICT_EVPOOL_SIZE && !pool[DICT_EVPOOL_SIZE - 1].key) {
+            // free space on the right, shift right
+            memmove(pool + k + 1, pool + k, sizeof(pool[0]) * (DICT_EVPOOL_SIZE - k - 1));
+        } else {
+            // no space on the right, drop the worst candidate on the left
+            k--;
+            free(pool[0].key);
+            memmove(pool, pool + 1, sizeof(pool[0]) * k);
+        }
+
+        pool[k].key = strdup(entry->key);
+        pool[k].idle = idle;
     }
 }
 
-// find and evict the least recently used entry if needed
-void dict_evict_lru_if_needed(dict *d) {
-    if (!d || d->max_memory == 0 || d->used_memory <= d->max_memory) {
-        return; // no need to evict
-    }
-    
-    // find LRU entry
-    dict_entry *lru_entry = NULL;
-    dict_entry *lru_prev = NULL;
-    size_t lru_idx = 0;
-    uint64_t oldest_access = UINT64_MAX;
-    
-    for (size_t i = 0; i < d->size; i++) {
-        dict_entry *entry = d->table[i];
-        dict_entry *prev = NULL;
-        
-        while (entry) {
-            if (entry->val->last_access < oldest_access) {
-                oldest_access = entry->val->last_access;
-                lru_entry = entry;
-                lru_prev = prev;
-                lru_idx = i;
-            }
-            prev = entry;
-            entry = entry->next;
+// evict the best pooled candidate that still exists, stale ones are dropped
+static int evict_from_pool(dict *d) {
+    dict_evict_candidate *pool = d->evict_pool;
+
+    evict_pool_populate(d);
+
+    for (int k = DICT_EVPOOL_SIZE - 1; k >= 0; k--) {
+        if (!pool[k].key) continue;
+
+        dict_entry *entry = unlink_entry(d, pool[k].key);
+        free(pool[k].key);
+        pool[k].key = NULL;
+
+        if (entry) {
+            free_entry(d, entry);
+            return 1;
         }
     }
-    
-    // remove LRU entry if found
-    if (lru_entry) {
-        if (lru_prev) {
-            lru_prev->next = lru_entry->next;
-        } else {
-            d->table[lru_idx] = lru_entry->next;
+    return 0;
+}
+
+static int evict_random(dict *d) {
+    dict_entry *entry;
+    if (sample_entries(d, &entry, 1) == 0) return 0;
+
+    unlink_entry(d, entry->key);
+    free_entry(d, entry);
+    return 1;
+}
+
+// rounds in a row that may find nothing to evict before giving up, e.g. a
+// volatile policy on a keyspace with (almost) no expiring keys
+#define EVICT_MAX_EMPTY_ROUNDS 16
+
+// evict keys according to the policy until under max_memory. returns 1 when
+// memory is within the limit afterwards, 0 if it could not get there
+int dict_evict_if_needed(dict *d) {
+    if (!d || !dict_is_over_memory(d)) {
+        return 1; // no need to evict
+    }
+    if (d->eviction_policy == DICT_EVICT_NOEVICTION) return 0;
+
+    int empty_rounds = 0;
+    while (dict_is_over_memory(d) && d->used > 0) {
+        int evicted = d->eviction_policy == DICT_EVICT_ALLKEYS_RANDOM ?
+                      evict_random(d) : evict_from_pool(d);
+
+        if (evicted) {
+            d->stat_evicted_keys++;
+            empty_rounds = 0;
+        } else if (++empty_rounds == EVICT_MAX_EMPTY_ROUNDS) {
+            break;
         }
-        
-        // update used memory
-        d->used_memory -= lru_entry->val->size;
-        
-        // free memory
-        free(lru_entry->key);
-        free(lru_entry->val->ptr);
-        free(lru_entry->val);
-        free(lru_entry);
-        
-        d->used--;
-        
-        // recursively evict if still over limit
-        dict_evict_lru_if_needed(d);
-    }
-}
\ No newline at end of file
+    }
+    return !dict_is_over_memory(d);
+}
+
+// start iterating over all entries. the dict must not be modified until
+// the iterator is released, except for removing the returned entry. several
+// threads may iterate a dict at once (under a shared lock), hence the
+// atomic pause count
+void dict_iter_init(dict_iterator *it, dict *d) {
+    it->d = d;
+    it->table = 0;
+    it->index = -1;
+    it->entry = NULL;
+    it->next_entry = NULL;
+    __atomic_add_fetch(&d->pause_rehash, 1, __ATOMIC_RELAXED);
+}
+
+void dict_iter_release(dict_iterator *it) {
+    __atomic_sub_fetch(&it->d->pause_rehash, 1, __ATOMIC_RELAXED);
+}
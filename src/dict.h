@@ -6,48 +6,196 @@
 #include <string.h>
 
 typedef enum {
-    CC_STRING, 
-    CC_LIST, 
+    CC_STRING,
+    CC_LIST,
     CC_SET,
     CC_INT,
     CC_FLOAT,
     CC_BOOL
 } cc_type;
 
-// value object structure
+// how a value's data is stored
+#define CC_ENC_RAW   0    // ptr is a separate allocation
+#define CC_ENC_EMBED 1    // ptr points into the entry, right after the key
+#define CC_ENC_INT   2    // CC_INT held in ival, nothing allocated
+
+// value object structure, embedded in its dict entry
 typedef struct cc_obj {
-    void *ptr;            // pointer to actual data
-    cc_type type;         // type of data
+    union {
+        void *ptr;        // pointer to actual data
+        long long ival;   // value of a CC_INT
+    };
     uint64_t expire;      // expiration timestamp (0 = no expiry)
-    size_t size;          // size of data in bytes
-    uint64_t last_access; // time of last access -- for lru eviction
+    uint32_t size;        // size of data in bytes
+    uint32_t lru;         // access clock (lru) or counter + decay time (lfu), set by the dict
+    uint32_t expire_idx;  // 1-based position in the dict's expiry heap, 0 if not in it
+    uint8_t type;         // cc_type of data
+    uint8_t encoding;     // CC_ENC_RAW, CC_ENC_EMBED or CC_ENC_INT
 } cc_obj;
 
-// Dictionary entry
+// the hash table engine is picked at build time (make DICT_ENGINE=swiss):
+//   dict_chain.c -- bucket array of chained entries (default)
+//   dict_swiss.c -- open addressing with 16-slot control byte groups
+#ifdef DICT_ENGINE_SWISS
+#define DICT_ENGINE_NAME "swiss"
+#else
+#define DICT_ENGINE_NAME "chain"
+#endif
+
+// Dictionary entry. header, key and (when short enough) the value share a
+// single allocation: [header][key\0][value\0]
 typedef struct dict_entry {
-    char *key;                 // key
-    cc_obj *val;               // value
+#ifndef DICT_ENGINE_SWISS
     struct dict_entry *next;   // next entry in the linked list (hash collision)
+#endif
+    cc_obj val;                // value header
+    char key[];                // key, followed by the value when embedded
 } dict_entry;
 
-// main dictionary structure
-typedef struct dict {
+// values up to this many bytes are embedded in the entry, like redis embstr
+#define DICT_EMBED_VALUE_MAX 44
+
+// strings that are canonical 64-bit integers are stored as CC_INT. the
+// decimal form of 0 .. DICT_SHARED_INTEGERS-1 is preformatted once and
+// shared, so replying with a small counter never formats anything
+#define DICT_SHARED_INTEGERS 10000
+#define CC_INT_STR_SIZE 21    // "-9223372036854775808" plus NUL
+
+#ifdef DICT_ENGINE_SWISS
+// slots are probed a group at a time, so a table is never smaller than one group
+#define DICT_GROUP_WIDTH 16
+#define DICT_HT_INITIAL_SIZE DICT_GROUP_WIDTH
+#else
+// smallest table we ever allocate (also the floor when shrinking)
+#define DICT_HT_INITIAL_SIZE 4
+#endif
+
+// shrink once fewer than 1/DICT_SHRINK_RATIO of the buckets are in use
+#define DICT_SHRINK_RATIO 8
+
+// a single table -- a dict keeps two of them while rehashing
+typedef struct dict_ht {
+#ifdef DICT_ENGINE_SWISS
+    uint8_t *ctrl;         // one control byte per slot: empty, deleted or 7 hash bits
+    dict_entry **slots;    // entry for each full slot
+    size_t deleted;        // tombstones, they count against the load factor
+#else
     dict_entry **table;    // hash table
+#endif
     size_t size;           // size of the hash table
-    size_t used;           // number of entries in the hash table
     size_t mask;           // bitmask for fast modulo (size-1)
-    size_t max_memory;     // max limit for lru
-    size_t used_memory;    // current memory usage
+    size_t used;           // number of entries in this table
+} dict_ht;
+
+// eviction samples a few random keys per round instead of scanning the table.
+// the best candidates seen so far are kept across rounds in a small pool
+#define DICT_EVPOOL_SIZE 16
+#define DICT_DEFAULT_EVICTION_SAMPLES 5
+
+typedef struct dict_evict_candidate {
+    uint64_t idle;         // eviction score when sampled, higher goes first
+    char *key;             // copy of the key, NULL for an unused pool slot
+} dict_evict_candidate;
+
+// what to do once dict_used_memory() goes over max_memory
+typedef enum {
+    DICT_EVICT_NOEVICTION,     // evict nothing, write commands fail with OOM
+    DICT_EVICT_ALLKEYS_LRU,    // least recently used of all keys
+    DICT_EVICT_VOLATILE_LRU,   // least recently used of the keys with an expire
+    DICT_EVICT_ALLKEYS_LFU,    // least frequently used of all keys
+    DICT_EVICT_VOLATILE_TTL,   // keys with the nearest expire first
+    DICT_EVICT_ALLKEYS_RANDOM  // any key
+} dict_evict_policy;
+
+#define DICT_DEFAULT_EVICTION_POLICY DICT_EVICT_ALLKEYS_LRU
+
+// lfu counters grow logarithmically: with the default factor of 10 it takes
+// about a million hits to saturate the 8-bit counter. counters lose one
+// point per lfu_decay_time minutes without access
+#define DICT_LFU_INIT_VAL 5
+#define DICT_DEFAULT_LFU_LOG_FACTOR 10
+#define DICT_DEFAULT_LFU_DECAY_TIME 1
+
+// main dictionary structure
+typedef struct dict {
+    dict_ht ht[2];         // ht[1] only holds entries while a rehash is in progress
+    long rehash_idx;       // next ht[0] bucket to migrate, -1 when not rehashing
+    int pause_rehash;      // > 0 while iterators are walking the tables
+    size_t used;           // number of entries in both tables
+    size_t max_memory;     // evict (or refuse writes) above this, 0 = no limit
+    size_t entries_memory; // allocator-reported bytes of entries, keys and values
+    size_t payload_memory; // key and value bytes alone, the rest is overhead
+    dict_evict_policy eviction_policy;
+    int eviction_samples;  // keys sampled per eviction round
+    int lfu_log_factor;    // higher makes the lfu counter grow slower
+    int lfu_decay_time;    // minutes per point of lfu counter decay, 0 = never
+    dict_evict_candidate *evict_pool; // sorted by idle time, best candidate last
+    uint64_t stat_evicted_keys;       // keys removed to stay under max_memory
+    dict_entry **expires;  // min-heap of the entries with an expire, soonest first
+    size_t expires_used;
+    size_t expires_size;
+    uint64_t stat_expired_keys;       // keys removed because their ttl passed
+    uint64_t stat_expire_cap_reached; // expire cycles that ran out of time
+    uint64_t stat_expire_cycle_us;    // time spent in expire cycles
 } dict;
 
+// iterates every entry of both tables; rehashing is paused until released
+typedef struct dict_iterator {
+    dict *d;
+    int table;
+    long index;
+    dict_entry *entry;
+    dict_entry *next_entry;
+} dict_iterator;
+
+#define dict_is_rehashing(d) ((d)->rehash_idx != -1)
+
 // dictionary functions
 dict* dict_create(size_t initial_size);
 void dict_free(dict *d);
-int dict_add(dict *d, const char *key, cc_obj *val);
+int dict_empty(dict *d);
+cc_obj *dict_set(dict *d, const char *key, const char *val, size_t len, uint64_t expire);
+cc_obj *dict_set_int(dict *d, const char *key, long long val, uint64_t expire);
 cc_obj* dict_get(dict *d, const char *key);
+cc_obj *dict_find(dict *d, const char *key);
 int dict_delete(dict *d, const char *key);
 void dict_resize(dict *d);
-void dict_clear_expired(dict *d);
-void dict_evict_lru_if_needed(dict *d);
+int dict_expand(dict *d, size_t size);
+int dict_reserve(dict *d, size_t entries);
+int dict_rehash(dict *d, int n);
+int dict_rehash_ms(dict *d, int ms);
+int dict_set_expire(dict *d, const char *key, uint64_t expire);
+int dict_expire_cycle(dict *d, long budget_us);
+size_t dict_key_memory(dict *d, const char *key);
+size_t dict_used_memory(const dict *d);
+size_t dict_tables_memory(const dict *d);
+size_t dict_alloc_size(const void *p);
+int dict_evict_if_needed(dict *d);
+int dict_is_over_memory(const dict *d);
+const char *dict_evict_policy_name(dict_evict_policy policy);
+int dict_evict_policy_from_name(const char *name, dict_evict_policy *policy);
+
+// iteration
+void dict_iter_init(dict_iterator *it, dict *d);
+dict_entry *dict_iter_next(dict_iterator *it);
+void dict_iter_release(dict_iterator *it);
+
+uint64_t dict_hash(const char *key);
+
+// values
+int dict_string_to_ll(const char *s, size_t len, long long *out);
+const char *cc_obj_str(const cc_obj *obj, char *buf, size_t *len);
+
+// table engine primitives, implemented by dict_chain.c or dict_swiss.c.
+// dict.c builds keys, values, rehashing policy and eviction on top of these
+int dict_ht_init(dict_ht *ht, size_t size);
+void dict_ht_release(dict_ht *ht);
+int dict_ht_needs_grow(const dict_ht *ht);
+dict_entry *dict_ht_find(dict_ht *ht, const char *key, uint64_t hash);
+int dict_ht_insert(dict_ht *ht, dict_entry *entry, uint64_t hash);
+dict_entry *dict_ht_unlink(dict_ht *ht, const char *key, uint64_t hash);
+int dict_ht_remove(dict_ht *ht, const dict_entry *entry, uint64_t hash);
+int dict_ht_sample(dict_ht *ht, size_t start, dict_entry **out, int count);
+size_t dict_ht_mem_usage(const dict_ht *ht);
 
-#endif /* DICT_H */
\ No newline at end of file
+#endif /* DICT_H */
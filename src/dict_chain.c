@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dict.h"
+#include <string.h>
+
+// chained hash table engine: a power-of-two bucket array where colliding
+// entries are linked through dict_entry->next
+
+// allocate an empty table
+int dict_ht_init(dict_ht *ht, size_t size) {
+    ht->table = calloc(size, sizeof(dict_entry*));
+    if (!ht->table) return 0;
+
+    ht->size = size;
+    ht->mask = size - 1;
+    ht->used = 0;
+    return 1;
+}
+
+// free the bucket array, entries are owned by the dict
+void dict_ht_release(dict_ht *ht) {
+    free(ht->table);
+    memset(ht, 0, sizeof(dict_ht));
+}
+
+// heap bytes of the bucket array
+size_t dict_ht_mem_usage(const dict_ht *ht) {
+    return dict_alloc_size(ht->table);
+}
+
+// keep the load factor at or below 1
+int dict_ht_needs_grow(const dict_ht *ht) {
+    return ht->used >= ht->size;
+}
+
+dict_entry *dict_ht_find(dict_ht *ht, const char *key, uint64_t hash) {
+    if (ht->size == 0) return NULL;
+
+    dict_entry *entry = ht->table[hash & ht->mask];
+    while (entry) {
+        if (strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+// add to hash table (prepend to list at idx), the key must not be present
+int dict_ht_insert(dict_ht *ht, dict_entry *entry, uint64_t hash) {
+    size_t idx = hash & ht->mask;
+
+    entry->next = ht->table[idx];
+    ht->table[idx] = entry;
+    ht->used++;
+    return 1;
+}
+
+// remove the entry for key from its chain and return it
+dict_entry *dict_ht_unlink(dict_ht *ht, const char *key, uint64_t hash) {
+    if (ht->size == 0) return NULL;
+
+    size_t idx = hash & ht->mask;
+    dict_entry *entry = ht->table[idx];
+    dict_entry *prev = NULL;
+
+    while (entry) {
+        if (strcmp(entry->key, key) == 0) {
+            if (prev) {
+                prev->next = entry->next;
+            } else {
+                ht->table[idx] = entry->next;
+            }
+            ht->used--;
+            return entry;
+        }
+
+        prev = entry;
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+// remove this very entry, another one with the same key may be in the
+// table too. returns 0 if it isn't there
+int dict_ht_remove(dict_ht *ht, const dict_entry *entry, uint64_t hash) {
+    if (ht->size == 0) return 0;
+
+    dict_entry **link = &ht->table[hash & ht->mask];
+    while (*link) {
+        if (*link == entry) {
+            *link = entry->next;
+            ht->used--;
+            return 1;
+        }
+        link = &(*link)->next;
+    }
+    return 0;
+}
+
+// collect up to count entries from consecutive buckets beginning at start.
+// gives up after a bounded number of empty buckets on sparse tables
+int dict_ht_sample(dict_ht *ht, size_t start, dict_entry **out, int count) {
+    if (ht->used == 0) return 0;
+
+    int stored = 0;
+    size_t max_steps = (size_t)count * 10;
+    size_t idx = start & ht->mask;
+
+    for (size_t steps = 0; stored < count && steps < max_steps && steps < ht->size; steps++) {
+        dict_entry *entry = ht->table[idx];
+        while (entry && stored < count) {
+            out[stored++] = entry;
+            entry = entry->next;
+        }
+        idx = (idx + 1) & ht->mask;
+    }
+    return stored;
+}
+
+// migrate up to n non-empty buckets from ht[0] to ht[1]. returns 1 if
+// there is still work left, 0 once the rehash has completed
+int dict_rehash(dict *d, int n) {
+    if (!dict_is_rehashing(d)) return 0;
+
+    int empty_visits = n * 10; // cap the time spent skipping empty buckets
+
+    while (n-- && d->ht[0].used != 0) {
+        while (d->ht[0].table[d->rehash_idx] == NULL) {
+            d->rehash_idx++;
+            if (--empty_visits == 0) return 1;
+        }
+
+        dict_entry *entry = d->ht[0].table[d->rehash_idx];
+        while (entry) {
+            dict_entry *next = entry->next;
+
+            // recalculate index with new size and move to new table
+            dict_ht_insert(&d->ht[1], entry, dict_hash(entry->key));
+            d->ht[0].used--;
+
+            entry = next;
+        }
+        d->ht[0].table[d->rehash_idx] = NULL;
+        d->rehash_idx++;
+    }
+
+    if (d->ht[0].used == 0) {
+        // all entries moved, the new table becomes the main one
+        free(d->ht[0].table);
+        d->ht[0] = d->ht[1];
+        memset(&d->ht[1], 0, sizeof(dict_ht));
+        d->rehash_idx = -1;
+        return 0;
+    }
+
+    return 1;
+}
+
+// return the next entry, or NULL when both tables have been walked
+dict_entry *dict_iter_next(dict_iterator *it) {
+    while (1) {
+        if (it->entry == NULL) {
+            dict_ht *ht = &it->d->ht[it->table];
+            it->index++;
+            if (it->index >= (long)ht->size) {
+                if (dict_is_rehashing(it->d) && it->table == 0) {
+                    it->table++;
+                    it->index = 0;
+                    ht = &it->d->ht[1];
+                } else {
+                    return NULL;
+                }
+            }
+            it->entry = ht->table[it->index];
+        } else {
+            it->entry = it->next_entry;
+        }
+
+        if (it->entry) {
+            // save next here, the caller may free the returned entry
+            it->next_entry = it->entry->next;
+            return it->entry;
+        }
+    }
+}
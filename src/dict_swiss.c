@@ -0,0 +1,316 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dict.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// open addressing hash table engine in the style of SwissTable.
+//
+// every slot has a control byte: EMPTY, DELETED (tombstone), or the top 7
+// bits of the key's hash when full. slots are probed 16 at a time -- one
+// group of control bytes is compared against the wanted hash fragment in a
+// single SSE2 instruction, so most non-matching slots are rejected without
+// touching the entry or calling strcmp. groups are probed quadratically and
+// a probe stops at the first group that still has an EMPTY slot.
+
+#define CTRL_EMPTY   ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+// full slots hold a value in 0..127, empty and deleted have the top bit set
+#define ctrl_is_full(c) (((c) & 0x80) == 0)
+
+// top 7 bits of the hash are stored in the control byte,
+// the low bits pick the first group to probe
+static inline uint8_t hash_fragment(uint64_t hash) {
+    return (uint8_t)(hash >> 57);
+}
+
+// bitmask of slots in the group whose control byte equals c
+static inline uint32_t group_match(const uint8_t *group, uint8_t c) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_load_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < DICT_GROUP_WIDTH; i++) {
+        if (group[i] == c) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// bitmask of slots in the group that are empty or deleted
+static inline uint32_t group_match_free(const uint8_t *group) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_load_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(ctrl);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < DICT_GROUP_WIDTH; i++) {
+        if (!ctrl_is_full(group[i])) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// index of the lowest set bit
+static inline int first_bit(uint32_t mask) {
+    return __builtin_ctz(mask);
+}
+
+// allocate an empty table, control bytes are 16-byte aligned for SSE loads
+int dict_ht_init(dict_ht *ht, size_t size) {
+    if (size < DICT_GROUP_WIDTH) size = DICT_GROUP_WIDTH;
+
+    void *ctrl = NULL;
+    if (posix_memalign(&ctrl, DICT_GROUP_WIDTH, size) != 0) return 0;
+
+    ht->slots = malloc(size * sizeof(dict_entry*));
+    if (!ht->slots) {
+        free(ctrl);
+        return 0;
+    }
+
+    ht->ctrl = ctrl;
+    memset(ht->ctrl, CTRL_EMPTY, size);
+    ht->size = size;
+    ht->mask = size - 1;
+    ht->used = 0;
+    ht->deleted = 0;
+    return 1;
+}
+
+// free the slot arrays, entries are owned by the dict
+void dict_ht_release(dict_ht *ht) {
+    free(ht->ctrl);
+    free(ht->slots);
+    memset(ht, 0, sizeof(dict_ht));
+}
+
+// heap bytes of the control byte and slot arrays
+size_t dict_ht_mem_usage(const dict_ht *ht) {
+    return dict_alloc_size(ht->ctrl) + dict_alloc_size(ht->slots);
+}
+
+// keep full slots plus tombstones at or below 7/8 of the table
+int dict_ht_needs_grow(const dict_ht *ht) {
+    return ht->used + ht->deleted >= ht->size - ht->size / 8;
+}
+
+// walk the probe sequence for hash and return the slot holding key, or -1
+static long find_slot(dict_ht *ht, const char *key, uint64_t hash) {
+    if (ht->size == 0) return -1;
+
+    size_t groups_mask = (ht->size / DICT_GROUP_WIDTH) - 1;
+    size_t group = hash & groups_mask;
+    uint8_t fragment = hash_fragment(hash);
+
+    for (size_t probe = 0; probe <= groups_mask; probe++) {
+        const uint8_t *ctrl = ht->ctrl + group * DICT_GROUP_WIDTH;
+
+        uint32_t match = group_match(ctrl, fragment);
+        while (match) {
+            size_t slot = group * DICT_GROUP_WIDTH + first_bit(match);
+            if (strcmp(ht->slots[slot]->key, key) == 0) {
+                return (long)slot;
+            }
+            match &= match - 1;
+        }
+
+        // the key would have been placed here if it existed
+        if (group_match(ctrl, CTRL_EMPTY)) return -1;
+
+        group = (group + probe + 1) & groups_mask;
+    }
+    return -1;
+}
+
+dict_entry *dict_ht_find(dict_ht *ht, const char *key, uint64_t hash) {
+    long slot = find_slot(ht, key, hash);
+    return slot < 0 ? NULL : ht->slots[slot];
+}
+
+// place entry in the first free slot of its probe sequence, the key must
+// not be present
+int dict_ht_insert(dict_ht *ht, dict_entry *entry, uint64_t hash) {
+    size_t groups_mask = (ht->size / DICT_GROUP_WIDTH) - 1;
+    size_t group = hash & groups_mask;
+
+    for (size_t probe = 0; probe <= groups_mask; probe++) {
+        uint8_t *ctrl = ht->ctrl + group * DICT_GROUP_WIDTH;
+
+        uint32_t free_slots = group_match_free(ctrl);
+        if (free_slots) {
+            int i = first_bit(free_slots);
+            if (ctrl[i] == CTRL_DELETED) ht->deleted--;
+            ctrl[i] = hash_fragment(hash);
+            ht->slots[group * DICT_GROUP_WIDTH + i] = entry;
+            ht->used++;
+            return 1;
+        }
+
+        group = (group + probe + 1) & groups_mask;
+    }
+    return 0; // table full, the load factor check should prevent this
+}
+
+// mark a slot as free. if its group still has an empty slot no probe ever
+// continued past this group, so the slot can go straight back to EMPTY
+static void clear_slot(dict_ht *ht, size_t slot) {
+    uint8_t *group = ht->ctrl + (slot & ~(size_t)(DICT_GROUP_WIDTH - 1));
+
+    if (group_match(group, CTRL_EMPTY)) {
+        ht->ctrl[slot] = CTRL_EMPTY;
+    } else {
+        ht->ctrl[slot] = CTRL_DELETED;
+        ht->deleted++;
+    }
+    ht->used--;
+}
+
+dict_entry *dict_ht_unlink(dict_ht *ht, const char *key, uint64_t hash) {
+    long slot = find_slot(ht, key, hash);
+    if (slot < 0) return NULL;
+
+    dict_entry *entry = ht->slots[slot];
+    clear_slot(ht, (size_t)slot);
+    return entry;
+}
+
+// remove this very entry, another one with the same key may be in the
+// table too. returns 0 if it isn't there
+int dict_ht_remove(dict_ht *ht, const dict_entry *entry, uint64_t hash) {
+    if (ht->size == 0) return 0;
+
+    size_t groups_mask = (ht->size / DICT_GROUP_WIDTH) - 1;
+    size_t group = hash & groups_mask;
+    uint8_t fragment = hash_fragment(hash);
+
+    for (size_t probe = 0; probe <= groups_mask; probe++) {
+        const uint8_t *ctrl = ht->ctrl + group * DICT_GROUP_WIDTH;
+
+        uint32_t match = group_match(ctrl, fragment);
+        while (match) {
+            size_t slot = group * DICT_GROUP_WIDTH + first_bit(match);
+            if (ht->slots[slot] == entry) {
+                clear_slot(ht, slot);
+                return 1;
+            }
+            match &= match - 1;
+        }
+        if (group_match(ctrl, CTRL_EMPTY)) return 0;
+
+        group = (group + probe + 1) & groups_mask;
+    }
+    return 0;
+}
+
+// collect up to count entries from consecutive slots beginning at start.
+// gives up after a bounded number of free slots on sparse tables
+int dict_ht_sample(dict_ht *ht, size_t start, dict_entry **out, int count) {
+    if (ht->used == 0) return 0;
+
+    int stored = 0;
+    size_t max_steps = (size_t)count * 10 * DICT_GROUP_WIDTH;
+    size_t idx = start & ht->mask;
+
+    for (size_t steps = 0; stored < count && steps < max_steps && steps < ht->size; steps++) {
+        if (ctrl_is_full(ht->ctrl[idx])) {
+            out[stored++] = ht->slots[idx];
+        }
+        idx = (idx + 1) & ht->mask;
+    }
+    return stored;
+}
+
+// double a table that is too full, moving its entries over
+static int grow_table(dict_ht *ht) {
+    dict_ht bigger;
+    if (!dict_ht_init(&bigger, ht->size * 2)) return 0;
+
+    for (size_t slot = 0; slot < ht->size; slot++) {
+        if (ctrl_is_full(ht->ctrl[slot])) {
+            dict_entry *entry = ht->slots[slot];
+            dict_ht_insert(&bigger, entry, dict_hash(entry->key));
+        }
+    }
+    dict_ht_release(ht);
+    *ht = bigger;
+    return 1;
+}
+
+// migrate up to n non-empty groups from ht[0] to ht[1]. returns 1 if
+// there is still work left, 0 once the rehash has completed
+int dict_rehash(dict *d, int n) {
+    if (!dict_is_rehashing(d)) return 0;
+
+    dict_ht *from = &d->ht[0];
+    int empty_visits = n * 10; // cap the time spent skipping empty groups
+
+    while (n-- && from->used != 0) {
+        const uint8_t *ctrl;
+        uint32_t full;
+
+        while (1) {
+            ctrl = from->ctrl + d->rehash_idx * DICT_GROUP_WIDTH;
+            full = ~group_match_free(ctrl) & 0xFFFF;
+            if (full) break;
+            d->rehash_idx++;
+            if (--empty_visits == 0) return 1;
+        }
+
+        while (full) {
+            size_t slot = d->rehash_idx * DICT_GROUP_WIDTH + first_bit(full);
+            dict_entry *entry = from->slots[slot];
+
+            // keys added while the rehash was paused may have filled the
+            // new table. an entry that can't move stays where it is
+            dict_ht *to = &d->ht[1];
+            if (dict_ht_needs_grow(to) && !grow_table(to)) return 1;
+            if (!dict_ht_insert(to, entry, dict_hash(entry->key))) return 1;
+
+            // a tombstone keeps probes for not yet migrated keys intact
+            from->ctrl[slot] = CTRL_DELETED;
+            from->deleted++;
+            from->used--;
+
+            full &= full - 1;
+        }
+        d->rehash_idx++;
+    }
+
+    if (from->used == 0) {
+        // all entries moved, the new table becomes the main one
+        dict_ht_release(from);
+        d->ht[0] = d->ht[1];
+        memset(&d->ht[1], 0, sizeof(dict_ht));
+        d->rehash_idx = -1;
+        return 0;
+    }
+
+    return 1;
+}
+
+// return the next entry, or NULL when both tables have been walked
+dict_entry *dict_iter_next(dict_iterator *it) {
+    while (1) {
+        dict_ht *ht = &it->d->ht[it->table];
+        it->index++;
+
+        if (it->index >= (long)ht->size) {
+            if (dict_is_rehashing(it->d) && it->table == 0) {
+                it->table++;
+                it->index = -1;
+                continue;
+            }
+            return NULL;
+        }
+
+        // removing the returned entry only rewrites its control byte,
+        // so walking on from the same index is safe
+        if (ctrl_is_full(ht->ctrl[it->index])) {
+            return ht->slots[it->index];
+        }
+    }
+}
@@ -1,7 +1,11 @@
+#define _GNU_SOURCE // for pthread_setaffinity_np
 #include "eventloop.h"
 #include "commands.h"
 #include "transaction.h" // for tx_init
 #include "pubsub.h" // for pubsub_remove_client
+#include "reply.h"
+#include "io_threads.h"
+#include "aof.h" // for aof_flush
 #include "config.h" // for config.buffer_size
 #include <unistd.h> // for close, read
 #include <stdio.h>  // for perror
@@ -9,14 +13,53 @@
 #include <sys/socket.h> // for accept
 #include <netinet/in.h> // for sockaddr_in
 #include <string.h> // for memset
+#include <errno.h>
+#include <sched.h> // for cpu_set_t
+#include <sys/eventfd.h> // for reactor wakeups
 
 extern volatile sig_atomic_t server_running;
-extern dict *server_db;
-extern client_t *get_client_by_socket(int socket);
+extern keyspace *server_db;
 
 // forward declarations for static functions
 static void handle_new_connection(event_loop_t *loop, int server_sock);
-static void handle_client_message(event_loop_t *loop, int client_sock);
+static void handle_client_event(event_loop_t *loop, client_t *client, uint32_t events);
+static void handle_client_message(event_loop_t *loop, client_t *client);
+static void handle_reactor_messages(event_loop_t *loop);
+static void close_client(event_loop_t *loop, client_t *client);
+static int forward_command(client_t *client, int argc, char **argv,
+                           size_t *argv_len, void *arg);
+
+// epoll data of a client socket is its client_t, so an event never needs a
+// lookup. the listener and the eventfd are told apart by these addresses
+static char listener_event;
+static char wake_event;
+
+// bytes read from one client before the others get their turn. a client
+// that had more waiting is read again after the current batch of events,
+// since its socket, being edge-triggered, won't report it a second time
+#define CLIENT_READ_BUDGET (64 * 1024)
+
+// all reactors in multi-reactor mode, NULL with a single event loop
+static event_loop_t *reactors = NULL;
+static int reactor_count = 0;
+
+// a command sent to the reactor owning its keys, and sent back once it ran.
+// the sender keeps at most REACTOR_MAX_IN_FLIGHT commands outstanding per
+// reactor, so the queues (twice that size) can never fill up
+#define REACTOR_MAX_IN_FLIGHT (REACTOR_QUEUE_SIZE / 2)
+
+typedef enum {
+    REACTOR_MSG_COMMAND,  // run command for client, then send it back
+    REACTOR_MSG_DONE      // command finished, the client may read again
+} reactor_msg_type;
+
+typedef struct reactor_msg {
+    reactor_msg_type type;
+    int from;             // reactor the client belongs to
+    client_t *client;
+    size_t len;           // length of the command
+    char command[];       // the command, RESP encoded and NUL terminated
+} reactor_msg;
 
 // initialize the event loop
 int event_loop_init(event_loop_t *loop) {
@@ -35,6 +78,17 @@ int event_loop_init(event_loop_t *loop) {
         return -1;
     }
 
+    // a lone event loop has no reactors to talk to
+    loop->id = 0;
+    loop->wake_fd = -1;
+    loop->inbox = NULL;
+    loop->in_flight = NULL;
+    loop->closed = NULL;
+    loop->read_ready = NULL;
+    loop->write_ready = NULL;
+    loop->io_batch = NULL;
+    loop->io_batch_capacity = 0;
+
     return 0;
 }
 
@@ -44,14 +98,92 @@ void event_loop_cleanup(event_loop_t *loop) {
         if (loop->epoll_fd != -1) {
             close(loop->epoll_fd);
         }
+        if (loop->wake_fd != -1) {
+            close(loop->wake_fd);
+        }
+        if (loop->inbox) {
+            for (int i = 0; i < reactor_count; i++) {
+                spsc_free(&loop->inbox[i]);
+            }
+            free(loop->inbox);
+        }
+        free(loop->in_flight);
+        free(loop->io_batch);
         free(loop->events);
     }
 }
 
+// free the clients closed while handling the last batch of events. until
+// now a later event of the batch could still point to one of them
+static void free_closed_clients(event_loop_t *loop) {
+    while (loop->closed) {
+        client_t *client = loop->closed;
+        loop->closed = client->next_closed;
+        free(client);
+    }
+}
+
+// read the client after the current batch of events
+static void queue_read(event_loop_t *loop, client_t *client) {
+    if (!client->read_queued) {
+        client->read_queued = 1;
+        client->next_ready = loop->read_ready;
+        loop->read_ready = client;
+    }
+}
+
+// write the client's replies once the writes of this round are on disk
+static void queue_write(event_loop_t *loop, client_t *client) {
+    if (!client->write_queued) {
+        client->write_queued = 1;
+        client->next_write = loop->write_ready;
+        loop->write_ready = client;
+    }
+}
+
+// appendfsync always: a single fsync covers the writes of every client of
+// the round, then they all get their replies
+static void write_synced_clients(event_loop_t *loop) {
+    if (!loop->write_ready) return;
+
+    aof_wait_synced();
+    client_t *client = loop->write_ready;
+    loop->write_ready = NULL;
+    while (client) {
+        client_t *next = client->next_write;
+        client->write_queued = 0;
+        // skip clients closed since they were queued
+        if (client->socket != -1 && !client_flush_replies(client) && !client->forwarded) {
+            close_client(loop, client);
+        }
+        client = next;
+    }
+}
+
+static int handle_ready_threaded(event_loop_t *loop);
+
+// carry on reading the clients that used up their budget last time (and,
+// with io threads, every client that has input)
+static void handle_ready_clients(event_loop_t *loop) {
+    if (io_threads_count() > 1 && handle_ready_threaded(loop)) return;
+
+    client_t *client = loop->read_ready;
+    loop->read_ready = NULL;
+    while (client) {
+        client_t *next = client->next_ready;
+        client->read_queued = 0;
+        // skip clients closed since they were queued
+        if (client->socket != -1) {
+            handle_client_message(loop, client);
+        }
+        client = next;
+    }
+}
+
 // the main event loop
 void event_loop_run(event_loop_t *loop, int server_sock) {
     struct epoll_event event;
-    event.data.fd = server_sock;
+    event.data.ptr = &listener_event;
     event.events = EPOLLIN | EPOLLET; // watch for incoming connections, edge-triggered
 
     // add the server socket to the epoll set
@@ -60,37 +192,82 @@ void event_loop_run(event_loop_t *loop, int server_sock) {
         return;
     }
 
+    // other reactors signal queued messages through the eventfd
+    if (loop->wake_fd != -1) {
+        event.data.ptr = &wake_event;
+        event.events = EPOLLIN;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) == -1) {
+            perror("epoll_ctl for wake_fd failed");
+            return;
+        }
+    }
+
     printf("server event loop started. waiting for events...\n");
 
     while (server_running) {
-        int num_events = epoll_wait(loop->epoll_fd, loop->events, config.max_events, -1);
+        // don't block while clients still have input waiting to be read
+        int timeout = loop->read_ready ? 0 : -1;
+        int num_events = epoll_wait(loop->epoll_fd, loop->events, config.max_events, timeout);
         if (num_events == -1) {
             perror("epoll_wait failed");
             continue; // or break, depending on desired error handling
         }
 
         for (int i = 0; i < num_events; i++) {
-            if (loop->events[i].data.fd == server_sock) {
+            void *source = loop->events[i].data.ptr;
+            if (source == &listener_event) {
                 // event on the listening socket means new connection
                 handle_new_connection(loop, server_sock);
+            } else if (source == &wake_event) {
+                // commands (or their completions) from other reactors
+                handle_reactor_messages(loop);
             } else {
-                // event on a client socket means incoming data
-                handle_client_message(loop, loop->events[i].data.fd);
+                // event on a client socket: incoming data, or room for
+                // output that didn't fit last time
+                handle_client_event(loop, source, loop->events[i].events);
             }
         }
+        handle_ready_clients(loop);
+        write_synced_clients(loop);
+        free_closed_clients(loop);
+        // the writes of this round go to the append-only file in one piece
+        aof_flush();
     }
 }
 
-// accepts a new connection and adds it to the event loop
-static void handle_new_connection(event_loop_t *loop, int server_sock) {
-    struct sockaddr_storage client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    int client_sock = accept(server_sock, (struct sockaddr *)&client_addr, &client_len);
-    if (client_sock == -1) {
-        perror("accept failed");
-        return;
+int event_loop_client_init(client_t *client, int client_sock, const struct sockaddr_storage *client_addr,
+                           socklen_t client_len, int epoll_fd) {
+    client->socket = client_sock;
+    memcpy(&client->address, client_addr, client_len);
+    client->addr_len = client_len;
+    client->buffer_pos = 0; // initialize buffer position
+    client->buffer = (char *)malloc(config.buffer_size);
+    if (client->buffer == NULL) {
+        perror("failed to allocate client buffer");
+        return 0;
     }
+    client->buffer_capacity = config.buffer_size;
+    resp_command_init(&client->cmd);
+    client->cmd_parsed = 0;
+    client->forwarded = 0;
+    client->read_pending = 0;
+    client->read_queued = 0;
+    client->write_queued = 0;
+    client->subscriptions = 0;
+    tx_init(client); // initialize transaction state
+    client_reply_init(client, epoll_fd);
+    return 1;
+}
 
+void event_loop_client_release(client_t *client) {
+    resp_command_free(&client->cmd);
+    client_reply_free(client);
+    free(client->buffer);
+}
+
+// adds an accepted connection to the event loop
+static void add_client(event_loop_t *loop, int client_sock, struct sockaddr_storage *client_addr,
+                       socklen_t client_len) {
     // allocate and initialize client_t
     client_t *client = (client_t *)malloc(sizeof(client_t));
     if (client == NULL) {
@@ -98,27 +275,20 @@ static void handle_new_connection(event_loop_t *loop, int server_sock) {
         close(client_sock);
         return;
     }
-    client->socket = client_sock;
-    memcpy(&client->address, &client_addr, client_len);
-    client->addr_len = client_len;
-    client->buffer_pos = 0; // initialize buffer position
-    client->buffer = (char *)malloc(config.buffer_size);
-    if (client->buffer == NULL) {
-        perror("failed to allocate client buffer");
+    if (!event_loop_client_init(client, client_sock, client_addr, client_len, loop->epoll_fd)) {
         free(client);
         close(client_sock);
         return;
     }
-    client->buffer_capacity = config.buffer_size;
-    tx_init(client); // initialize transaction state
 
     // add the new client socket to the epoll set
     struct epoll_event event;
-    event.data.fd = client_sock;
+    event.data.ptr = client;
     event.events = EPOLLIN | EPOLLET; // watch for input, edge-triggered
     if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_sock, &event) == -1) {
         perror("epoll_ctl for client_sock failed");
         close(client_sock);
+        event_loop_client_release(client);
         free(client);
         return;
     }
@@ -127,36 +297,409 @@ static void handle_new_connection(event_loop_t *loop, int server_sock) {
     register_client(client); // register the client
 }
 
-// handles a message from a client
-static void handle_client_message(event_loop_t *loop, int client_sock) {
-    client_t *client = get_client_by_socket(client_sock);
-    if (!client) {
-        fprintf(stderr, "error: client not found for socket %d\n", client_sock);
-        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client_sock, NULL); // remove from epoll
-        close(client_sock);
+// accepts every pending connection. the listener is edge-triggered, so a
+// connection left in the backlog would wait for the next one to arrive
+static void handle_new_connection(event_loop_t *loop, int server_sock) {
+    while (1) {
+        struct sockaddr_storage client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_sock = accept4(server_sock, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK);
+        if (client_sock == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            // the connection was reset before we got to it
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            // out of fds or memory, the rest stays queued until the next
+            // connection wakes us up
+            perror("accept failed");
+            return;
+        }
+        add_client(loop, client_sock, &client_addr, client_len);
+    }
+}
+
+static void close_client(event_loop_t *loop, client_t *client) {
+    printf("client on socket %d disconnected.\n", client->socket);
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client->socket, NULL); // remove from epoll
+    pubsub_remove_client(client);
+    unregister_client(client);
+    close(client->socket);
+    event_loop_client_release(client);
+    // freed once the current batch of events is done, see free_closed_clients
+    client->socket = -1;
+    client->next_closed = loop->closed;
+    loop->closed = client;
+}
+
+// run the buffered commands and write out everything they replied in one
+// go. returns 0 if the client was disconnected
+static int process_client_input(event_loop_t *loop, client_t *client) {
+    int ok = process_client_buffer(client, server_db, forward_command, loop);
+    if (ok && aof_unsynced()) {
+        queue_write(loop, client);
+        return 1;
+    }
+    // flushed even after a protocol error, so the client sees the error
+    if (!client_flush_replies(client) || !ok) {
+        // a command running on another reactor still holds on to the
+        // client, it is closed when that comes back
+        if (!client->forwarded) close_client(loop, client);
+        return 0;
+    }
+    return 1;
+}
+
+static void handle_client_event(event_loop_t *loop, client_t *client, uint32_t events) {
+    // closed by an earlier event of the same batch
+    if (client->socket == -1) return;
+
+    if ((events & EPOLLOUT) && !client_flush_replies(client)) {
+        if (!client->forwarded) close_client(loop, client);
         return;
     }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        // with io threads the clients of the whole batch are read together
+        if (io_threads_count() > 1) {
+            queue_read(loop, client);
+        } else {
+            handle_client_message(loop, client);
+        }
+    }
+}
 
-    int bytes_read = read(client_sock, client->buffer + client->buffer_pos, config.buffer_size - client->buffer_pos - 1);
+// handles a message from a client
+static void handle_client_message(event_loop_t *loop, client_t *client) {
+    int client_sock = client->socket;
+    size_t budget = CLIENT_READ_BUDGET;
 
-    if (bytes_read <= 0) {
-        // 0 means client closed connection, < 0 is an error
-        if (bytes_read < 0) {
-            perror("read from client failed");
+    // the socket is edge-triggered, so keep reading until it is drained,
+    // or a pipeline longer than the buffer would be left unread
+    while (1) {
+        // another reactor is still running one of this client's commands
+        // and adds its reply to the output buffer; read (or notice the
+        // hangup) once it is done so replies stay in order
+        if (client->forwarded) {
+            client->read_pending = 1;
+            return;
+        }
+
+        // enough for this turn, the rest is read after the other events
+        if (budget == 0) {
+            queue_read(loop, client);
+            return;
+        }
+
+        int bytes_read = recv(client_sock, client->buffer + client->buffer_pos,
+                              client->buffer_capacity - client->buffer_pos - 1, 0);
+
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (bytes_read <= 0) {
+            // 0 means client closed connection, < 0 is an error
+            if (bytes_read < 0) {
+                perror("read from client failed");
+            }
+            close_client(loop, client);
+            return;
+        }
+
+        client->buffer_pos += bytes_read;
+        client->buffer[client->buffer_pos] = '\0';
+        budget = (size_t)bytes_read < budget ? budget - bytes_read : 0;
+        if (!process_client_input(loop, client)) return;
+    }
+}
+
+// io thread: read what the client sent, up to its budget, and parse the
+// first command so the event loop can run it right away
+static void io_read_client(client_t *client) {
+    size_t budget = CLIENT_READ_BUDGET;
+    client->io_status = 1;
+    client->io_more = 0;
+
+    while (1) {
+        if ((size_t)client->buffer_pos + 1 >= client->buffer_capacity &&
+            !query_buffer_reserve(&client->buffer, &client->buffer_capacity, client->buffer_pos, 0)) {
+            // let the event loop run what is there first
+            client->io_more = 1;
+            break;
+        }
+        ssize_t bytes_read = recv(client->socket, client->buffer + client->buffer_pos,
+                                  client->buffer_capacity - client->buffer_pos - 1, 0);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (bytes_read <= 0) {
+            client->io_status = bytes_read == 0 ? 0 : -errno;
+            break;
         }
-        printf("client on socket %d disconnected.\n", client_sock);
-        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client_sock, NULL); // remove from epoll
-        pubsub_remove_client(client);
-        unregister_client(client);
-        close(client_sock);
-        free(client->buffer);
-        free(client);
-    } else {
         client->buffer_pos += bytes_read;
         client->buffer[client->buffer_pos] = '\0';
+        budget = (size_t)bytes_read < budget ? budget - bytes_read : 0;
+        if (budget == 0) {
+            client->io_more = 1;
+            break;
+        }
+    }
+
+    size_t consumed;
+    const char *error;
+    if (client->buffer_pos > 0 &&
+        resp_parse_command(client->buffer, client->buffer_pos, &consumed, &client->cmd, &error) == RESP_PARSE_OK) {
+        client->cmd_parsed = consumed;
+    }
+}
+
+// io thread: write the replies of the commands the event loop ran
+static void io_write_client(client_t *client) {
+    client->io_status = client_flush_replies(client);
+}
+
+// with io threads: read and parse the input of all ready clients in
+// parallel, run their commands here one client after the other, then
+// write the replies in parallel. the commands never run concurrently, so
+// the keyspace sees the same single thread as without io threads. returns
+// 0 when there are too few clients for the threads to pay off
+static int handle_ready_threaded(event_loop_t *loop) {
+    int threads = io_threads_count();
+    int count = 0;
+    for (client_t *client = loop->read_ready; client; client = client->next_ready) {
+        count++;
+    }
+    if (count < threads * 2) return 0;
+
+    if (count > loop->io_batch_capacity) {
+        int capacity = loop->io_batch_capacity ? loop->io_batch_capacity : 64;
+        while (capacity < count) capacity *= 2;
+        client_t **batch = realloc(loop->io_batch, capacity * sizeof(client_t *));
+        if (!batch) return 0;
+        loop->io_batch = batch;
+        loop->io_batch_capacity = capacity;
+    }
+
+    // oldest first (the list is newest first), without the clients closed
+    // since they were queued
+    client_t **batch = loop->io_batch;
+    client_t *client = loop->read_ready;
+    loop->read_ready = NULL;
+    int n = count;
+    while (client) {
+        client_t *next = client->next_ready;
+        client->read_queued = 0;
+        if (client->socket != -1) batch[--n] = client;
+        client = next;
+    }
+    batch += n;
+    count -= n;
+
+    io_threads_run(io_read_client, batch, count);
+
+    int writes = 0;
+    for (int i = 0; i < count; i++) {
+        client = batch[i];
+        int status = client->io_status;
+        int ok = process_client_buffer(client, server_db, forward_command, loop);
+        if (!ok || status <= 0) {
+            // 0 means client closed connection, < 0 is an error. what it
+            // sent before that still gets its replies
+            if (status < 0) {
+                fprintf(stderr, "read from client failed: %s\n", strerror(-status));
+            }
+            client_flush_replies(client);
+            close_client(loop, client);
+            continue;
+        }
+        if (client->io_more) queue_read(loop, client);
+        if (client_has_pending_replies(client)) batch[writes++] = client;
+    }
+
+    if (writes >= threads * 2) {
+        io_threads_run(io_write_client, batch, writes);
+    } else {
+        for (int i = 0; i < writes; i++) {
+            io_write_client(batch[i]);
+        }
+    }
+    for (int i = 0; i < writes; i++) {
+        if (!batch[i]->io_status) close_client(loop, batch[i]);
+    }
+    return 1;
+}
+
+static void wake_reactor(int id) {
+    uint64_t one = 1;
+    if (write(reactors[id].wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("reactor wakeup failed");
+    }
+}
+
+// hand a parsed command to the reactor owning its keys. returns 0 when it
+// should run right here: single reactor, keys owned by this reactor,
+// keyless or multi-shard commands, transactions, or too many commands
+// already waiting on the owner. those run under the shard locks, which is
+// always safe, just not contention free
+static int forward_command(client_t *client, int argc, char **argv,
+                           size_t *argv_len, void *arg) {
+    event_loop_t *loop = arg;
+    if (reactor_count <= 1 || client->in_transaction) return 0;
+
+    int shard = command_shard(server_db, argc, argv);
+    if (shard < 0) return 0;
+
+    int owner = shard % reactor_count;
+    if (owner == loop->id || loop->in_flight[owner] >= REACTOR_MAX_IN_FLIGHT) return 0;
+
+    // the arguments point into the client's buffer, send a RESP copy
+    size_t len = resp_command_size(argc, argv_len);
+    reactor_msg *msg = malloc(sizeof(reactor_msg) + len + 1);
+    if (!msg) return 0;
+    msg->type = REACTOR_MSG_COMMAND;
+    msg->from = loop->id;
+    msg->client = client;
+    msg->len = len;
+    *resp_encode_command(msg->command, argc, argv, argv_len) = '\0';
+
+    // can't fail, see REACTOR_MAX_IN_FLIGHT
+    spsc_push(&reactors[owner].inbox[loop->id], msg);
+    loop->in_flight[owner]++;
+    client->forwarded = 1;
+    wake_reactor(owner);
+    return 1;
+}
+
+// drain the queues from every other reactor
+static void handle_reactor_messages(event_loop_t *loop) {
+    uint64_t count;
+    // reset the eventfd before draining, so a message queued after this
+    // point wakes us up again
+    if (read(loop->wake_fd, &count, sizeof(count)) < 0) {
+        // EAGAIN: another event already drained it
+    }
+
+    for (int from = 0; from < reactor_count; from++) {
+        reactor_msg *msg;
+        while ((msg = spsc_pop(&loop->inbox[from])) != NULL) {
+            if (msg->type == REACTOR_MSG_COMMAND) {
+                // the reply goes to the client's output buffer, the owning
+                // reactor flushes it once we send this back. it waits on the
+                // shard lock while an EXEC on another reactor holds it, so
+                // it never lands between the commands of a transaction
+                execute_command(msg->client, msg->command, msg->len, server_db);
+                // msg belongs to the sender again once pushed
+                int owner = msg->from;
+                msg->type = REACTOR_MSG_DONE;
+                spsc_push(&reactors[owner].inbox[loop->id], msg);
+                wake_reactor(owner);
+                continue;
+            }
+
+            client_t *client = msg->client;
+            loop->in_flight[from]--;
+            free(msg);
+
+            // carry on with the commands that were pipelined behind it
+            client->forwarded = 0;
+            if (!process_client_input(loop, client)) continue;
+            if (!client->forwarded && client->read_pending) {
+                client->read_pending = 0;
+                handle_client_message(loop, client);
+            }
+        }
+    }
+}
+
+// pin the calling reactor to a cpu of its own (wrapping around when there
+// are more reactors than cpus)
+static void pin_to_cpu(int id) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 1) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(id % cpus, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "warning: could not pin reactor %d to a cpu\n", id);
+    }
+}
+
+typedef struct reactor_args {
+    event_loop_t *loop;
+    int listener;
+} reactor_args;
+
+static void *reactor_thread(void *arg) {
+    reactor_args *args = arg;
+    pin_to_cpu(args->loop->id);
+    event_loop_run(args->loop, args->listener);
+    return NULL;
+}
+
+// set up a reactor: its own epoll instance, eventfd and inbound queues
+static int reactor_init(event_loop_t *loop, int id) {
+    if (event_loop_init(loop) != 0) return 0;
+
+    loop->id = id;
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK);
+    loop->inbox = calloc(reactor_count, sizeof(spsc_queue));
+    loop->in_flight = calloc(reactor_count, sizeof(int));
+    if (loop->wake_fd == -1 || !loop->inbox || !loop->in_flight) {
+        perror("failed to set up reactor");
+        return 0;
+    }
+    for (int i = 0; i < reactor_count; i++) {
+        if (!spsc_init(&loop->inbox[i], REACTOR_QUEUE_SIZE)) {
+            perror("failed to allocate reactor queue");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// run one reactor thread per listener. every reactor accepts its own
+// connections (the kernel spreads them over the SO_REUSEPORT listeners)
+// and owns an equal part of the keyspace shards
+void event_loop_run_reactors(int *listeners, int count) {
+    reactors = calloc(count, sizeof(event_loop_t));
+    reactor_args *args = calloc(count, sizeof(reactor_args));
+    if (!reactors || !args) {
+        perror("failed to allocate reactors");
+        free(reactors);
+        free(args);
+        reactors = NULL;
+        return;
+    }
+    reactor_count = count;
+
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        // unused fds stay -1 so cleanup of a half set up reactor is safe
+        reactors[i].epoll_fd = -1;
+        reactors[i].wake_fd = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!reactor_init(&reactors[i], i)) goto cleanup;
+    }
+
+    printf("running %d reactors, %d keyspace shards\n", count, server_db->nshards);
+    for (int i = 0; i < count; i++) {
+        args[i].loop = &reactors[i];
+        args[i].listener = listeners[i];
+        if (pthread_create(&reactors[i].thread, NULL, reactor_thread, &args[i]) != 0) {
+            perror("failed to create reactor thread");
+            break;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(reactors[i].thread, NULL);
+    }
 
-        // process the command (assuming null-terminated string)
-        execute_command(client_sock, client->buffer, server_db);
-        client->buffer_pos = 0; // reset buffer for next command
+cleanup:
+    for (int i = 0; i < count; i++) {
+        event_loop_cleanup(&reactors[i]);
     }
+    free(reactors);
+    free(args);
+    reactors = NULL;
+    reactor_count = 0;
 }
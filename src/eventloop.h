@@ -2,13 +2,32 @@
 #define EVENTLOOP_H
 
 #include <sys/epoll.h>
+#include <pthread.h>
 #include "crimsoncache.h"
 #include "config.h"
+#include "spsc.h"
+
+// messages between reactors live in queues of this many slots
+#define REACTOR_QUEUE_SIZE 1024
 
 // represents the state of our event loop
 typedef struct event_loop {
     int epoll_fd; // file descriptor for the epoll instance
     struct epoll_event *events; // array to hold triggered events
+
+    // multi-reactor mode only: one loop per thread, each with its own
+    // SO_REUSEPORT listener, owning the keyspace shards with
+    // shard % reactors == id
+    int id;
+    int wake_fd;         // eventfd the other reactors write to after queueing a message
+    spsc_queue *inbox;   // one queue per reactor, inbox[i] is filled only by reactor i
+    int *in_flight;      // commands sent to each reactor and not yet back
+    client_t *closed;    // clients closed during this batch of events, freed after it
+    client_t *read_ready; // clients that used up their read budget with input left
+    client_t *write_ready; // appendfsync always: clients replying once the round's writes are fsynced
+    client_t **io_batch;  // with io threads: the clients read (then written) together
+    int io_batch_capacity;
+    pthread_t thread;
 } event_loop_t;
 
 // Functions to manage the event loop
@@ -16,4 +35,19 @@ int event_loop_init(event_loop_t *loop);
 void event_loop_run(event_loop_t *loop, int server_sock);
 void event_loop_cleanup(event_loop_t *loop);
 
+// run one reactor per listener (config.reactors of them), returns on shutdown
+void event_loop_run_reactors(int *listeners, int count);
+
+// io_uring backend (concurrency uring), see eventloop_uring.c. runs a single
+// loop until shutdown and returns 1, or returns 0 right away if io_uring
+// can't be used here, so the caller can fall back to epoll
+int uring_loop_run(int server_sock);
+
+// client state shared by the backends. init returns 0 if the query buffer
+// can't be allocated, release frees what the client holds but not the
+// client_t itself. epoll_fd is -1 for clients not watched by epoll
+int event_loop_client_init(client_t *client, int client_sock, const struct sockaddr_storage *client_addr,
+                           socklen_t client_len, int epoll_fd);
+void event_loop_client_release(client_t *client);
+
 #endif // EVENTLOOP_H
@@ -0,0 +1,673 @@
+#define _GNU_SOURCE
+#include "eventloop.h"
+#include "uring.h"
+#include "commands.h"
+#include "pubsub.h" // for pubsub_remove_client
+#include "reply.h"
+#include "config.h"
+#include "aof.h" // for aof_flush
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+extern volatile sig_atomic_t server_running;
+extern keyspace *server_db;
+
+#ifdef HAVE_IO_URING
+
+// io_uring backend: one ring does all the socket work of a single loop. a
+// multishot accept keeps accepting, and a multishot recv per client keeps
+// receiving into buffers the kernel takes from a shared buffer ring, so
+// neither is resubmitted per event. the replies of every client handled in
+// a round are queued as sends and reach the kernel together with the wait
+// for the next round, in one io_uring_enter. sockets are registered as
+// fixed files at the index of their fd, which spares the kernel the fd
+// lookup and reference counting on every request
+
+#define URING_ENTRIES   4096   // submission queue, the completion queue is 4x
+#define URING_BUFS      4096   // provided receive buffers, a power of two
+#define URING_BUF_SIZE  4096
+#define URING_BUF_GROUP 0
+#define URING_MAX_FILES 65536  // registered file table, sockets above it are used unregistered
+// bytes of one client's input run per round, like CLIENT_READ_BUDGET of
+// the epoll loop. the kernel keeps receiving into buffers regardless, so a
+// client pipelining megabytes fills the completion queue; what is over its
+// budget waits in the buffers it arrived in, and the replies of everyone
+// else go out first
+#define URING_READ_BUDGET (64 * 1024)
+// input one client may hold in receive buffers. past it the client's recv
+// is cancelled, leaving the rest in its socket, and armed again once
+// run_held has worked it down to half. a client pipelining megabytes can't
+// take the buffers every other client receives into
+#define URING_HELD_LIMIT (4 * URING_READ_BUDGET)
+
+// what a completion is for, in the low bits of its user_data next to the
+// connection pointer (malloc aligns to more than 8)
+enum {
+    URING_OP_ACCEPT,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_WAKE,
+    URING_OP_CANCEL
+};
+#define URING_OP_MASK 7ULL
+
+typedef struct uring_conn {
+    client_t client;          // first, so a connection's client_t is the connection
+    int fixed;                // the socket is a registered file
+    int ops;                  // requests in the kernel, freed once they are all done
+    int receiving;            // the multishot recv is armed
+    int closing;              // shut down, freed once ops drops to 0
+    int close_after_send;     // closed once the pending output is sent
+    int hung_up;              // the client is done sending
+    // output a send request is writing, taken from the client's reply buffer
+    char *sending;
+    size_t sending_len;
+    size_t sending_sent;
+    size_t sending_capacity;
+    int handoff_queued;       // on the loop's handoff list
+    struct uring_conn *next_handoff;
+    // received buffers not run yet, oldest first, -1 if none
+    int held_head;
+    int held_tail;
+    size_t held_bytes;        // received into those buffers
+    int recv_paused;          // holds URING_HELD_LIMIT, not receiving until it ran some
+    int starved_queued;       // on the starved list, its recv ran out of buffers
+    struct uring_conn *next_starved;
+    unsigned round;           // loop round round_bytes counts for
+    size_t round_bytes;
+    int ready_queued;         // on the ready list, has input over budget
+    struct uring_conn *next_ready;
+} uring_conn;
+
+typedef struct uring_loop {
+    uring ring;
+    int server_sock;
+    int accept_paused;              // out of fds, accept again once a client is gone
+    int wake_fd;                    // other threads wake the loop to write output they added
+    struct io_uring_buf_ring *bufs; // the provided buffer ring
+    size_t bufs_size;
+    char *buf_base;                 // URING_BUFS buffers of URING_BUF_SIZE
+    unsigned files;                 // size of the registered file table, 0 if none
+    pthread_mutex_t handoff_lock;
+    uring_conn *handoff;            // clients other threads added output to
+    unsigned round;
+    uring_conn *ready;              // clients with held input to run next round
+    uring_conn *starved;            // clients to arm the recv of once buffers are back, oldest first
+    uring_conn *starved_tail;
+    unsigned held_bufs;             // buffers clients hold, the kernel has the others
+    // held buffers form a list per client: the next buffer and the bytes
+    // received into each, indexed by buffer id
+    int held_next[URING_BUFS];
+    unsigned held_len[URING_BUFS];
+} uring_loop;
+
+// the running loop, for the handoff hook
+static uring_loop *running_loop = NULL;
+static __thread int on_loop_thread = 0;
+
+// an sqe, submitting what is queued first if the submission queue is full
+static struct io_uring_sqe *get_sqe(uring_loop *loop) {
+    struct io_uring_sqe *sqe;
+    while ((sqe = uring_get_sqe(&loop->ring)) == NULL) {
+        aof_wait_synced(); // sends may be among them
+        uring_submit_and_wait(&loop->ring, 0);
+    }
+    return sqe;
+}
+
+static void set_conn_fd(struct io_uring_sqe *sqe, uring_conn *conn) {
+    sqe->fd = conn->client.socket;
+    if (conn->fixed) sqe->flags |= IOSQE_FIXED_FILE;
+}
+
+static void arm_accept(uring_loop *loop) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->server_sock;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_OP_ACCEPT;
+}
+
+static void arm_wake(uring_loop *loop) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->wake_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_OP_WAKE;
+}
+
+static void arm_recv(uring_loop *loop, uring_conn *conn) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    sqe->opcode = IORING_OP_RECV;
+    set_conn_fd(sqe, conn);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = (uintptr_t)conn | URING_OP_RECV;
+    conn->ops++;
+    conn->receiving = 1;
+}
+
+// stop receiving for a client holding URING_HELD_LIMIT of input. the recv
+// completes with -ECANCELED, anything received before that is still held
+static void pause_recv(uring_loop *loop, uring_conn *conn) {
+    conn->recv_paused = 1;
+    if (!conn->receiving) return;
+
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uintptr_t)conn | URING_OP_RECV;
+    sqe->user_data = URING_OP_CANCEL;
+}
+
+static void submit_send(uring_loop *loop, uring_conn *conn) {
+    struct io_uring_sqe *sqe = get_sqe(loop);
+    sqe->opcode = IORING_OP_SEND;
+    set_conn_fd(sqe, conn);
+    sqe->addr = (uintptr_t)(conn->sending + conn->sending_sent);
+    sqe->len = conn->sending_len - conn->sending_sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)conn | URING_OP_SEND;
+    conn->ops++;
+}
+
+// give a receive buffer back to the kernel. only this thread adds buffers
+static void recycle_buffer(uring_loop *loop, unsigned bid) {
+    struct io_uring_buf_ring *br = loop->bufs;
+    unsigned short tail = br->tail;
+    struct io_uring_buf *buf = &br->bufs[tail & (URING_BUFS - 1)];
+    buf->addr = (uintptr_t)(loop->buf_base + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static int setup_buffers(uring_loop *loop) {
+    loop->bufs_size = URING_BUFS * sizeof(struct io_uring_buf);
+    loop->bufs = mmap(NULL, loop->bufs_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (loop->bufs == MAP_FAILED) {
+        loop->bufs = NULL;
+        return 0;
+    }
+    loop->buf_base = malloc((size_t)URING_BUFS * URING_BUF_SIZE);
+    if (!loop->buf_base) return 0;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)loop->bufs;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BUF_GROUP;
+    int ret = uring_register(&loop->ring, IORING_REGISTER_PBUF_RING, &reg, 1);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring buffer ring registration failed: %s\n", strerror(-ret));
+        return 0;
+    }
+    for (unsigned i = 0; i < URING_BUFS; i++) {
+        recycle_buffer(loop, i);
+    }
+    return 1;
+}
+
+// an empty file table for the client sockets, as large as the fd limit
+static void setup_files(uring_loop *loop) {
+    unsigned files = URING_MAX_FILES;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < files) files = rl.rlim_cur;
+
+    struct io_uring_rsrc_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = files;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (uring_register(&loop->ring, IORING_REGISTER_FILES2, &reg, sizeof(reg)) < 0) {
+        fprintf(stderr, "warning: io_uring file registration failed, using plain fds\n");
+        files = 0;
+    }
+    loop->files = files;
+}
+
+// put socket in (or with -1, take it out of) its slot in the file table
+static int update_file(uring_loop *loop, int slot, int socket) {
+    struct io_uring_rsrc_update2 up;
+    memset(&up, 0, sizeof(up));
+    up.offset = slot;
+    up.data = (uintptr_t)&socket;
+    up.nr = 1;
+    return uring_register(&loop->ring, IORING_REGISTER_FILES_UPDATE2, &up, sizeof(up)) == 1;
+}
+
+// hook for output other threads add to one of our clients (a published
+// message): queue the client and wake the loop to write it
+static void uring_handoff(client_t *client) {
+    uring_conn *conn = (uring_conn *)client;
+    uring_loop *loop = running_loop;
+
+    pthread_mutex_lock(&loop->handoff_lock);
+    int queued = conn->handoff_queued;
+    if (!queued) {
+        conn->handoff_queued = 1;
+        conn->next_handoff = loop->handoff;
+        loop->handoff = conn;
+    }
+    pthread_mutex_unlock(&loop->handoff_lock);
+
+    // the loop looks at the list after every round anyway
+    if (!queued && !on_loop_thread) {
+        uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+            perror("io_uring loop wakeup failed");
+        }
+    }
+}
+
+static void add_conn(uring_loop *loop, int client_sock) {
+    uring_conn *conn = calloc(1, sizeof(uring_conn));
+    if (!conn) {
+        perror("failed to allocate memory for client");
+        close(client_sock);
+        return;
+    }
+    // the event loop has no use for the peer address, don't spend a
+    // system call on it
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    if (!event_loop_client_init(&conn->client, client_sock, &addr, 0, -1)) {
+        free(conn);
+        close(client_sock);
+        return;
+    }
+    conn->client.reply_handoff = uring_handoff;
+    conn->held_head = conn->held_tail = -1;
+    conn->fixed = (unsigned)client_sock < loop->files && update_file(loop, client_sock, client_sock);
+
+    printf("new client connected on socket %d\n", client_sock);
+    register_client(&conn->client);
+    arm_recv(loop, conn);
+}
+
+static void hold_buffer(uring_loop *loop, uring_conn *conn, int bid, unsigned len) {
+    loop->held_next[bid] = -1;
+    loop->held_len[bid] = len;
+    if (conn->held_tail == -1) {
+        conn->held_head = bid;
+    } else {
+        loop->held_next[conn->held_tail] = bid;
+    }
+    conn->held_tail = bid;
+    conn->held_bytes += len;
+    loop->held_bufs++;
+}
+
+// take the oldest held buffer off the client's list, the caller recycles it
+static int unhold_buffer(uring_loop *loop, uring_conn *conn) {
+    int bid = conn->held_head;
+    conn->held_head = loop->held_next[bid];
+    if (conn->held_head == -1) conn->held_tail = -1;
+    conn->held_bytes -= loop->held_len[bid];
+    loop->held_bufs--;
+    return bid;
+}
+
+static void drop_held(uring_loop *loop, uring_conn *conn) {
+    while (conn->held_head != -1) {
+        recycle_buffer(loop, unhold_buffer(loop, conn));
+    }
+}
+
+static void close_conn(uring_loop *loop, uring_conn *conn) {
+    if (conn->closing) return;
+    conn->closing = 1;
+    drop_held(loop, conn);
+    printf("client on socket %d disconnected.\n", conn->client.socket);
+    pubsub_remove_client(&conn->client);
+    unregister_client(&conn->client);
+    // completes the armed recv and a send still waiting for room, the
+    // socket is closed once they are back
+    shutdown(conn->client.socket, SHUT_RDWR);
+}
+
+// free a closed connection once the kernel is done with it
+static void release_conn(uring_loop *loop, uring_conn *conn) {
+    if (!conn->closing || conn->ops > 0 || conn->ready_queued || conn->starved_queued) return;
+
+    if (conn->handoff_queued) {
+        pthread_mutex_lock(&loop->handoff_lock);
+        uring_conn **link = &loop->handoff;
+        while (*link && *link != conn) link = &(*link)->next_handoff;
+        if (*link) *link = conn->next_handoff;
+        pthread_mutex_unlock(&loop->handoff_lock);
+    }
+    if (conn->fixed) update_file(loop, conn->client.socket, -1);
+    close(conn->client.socket);
+    event_loop_client_release(&conn->client);
+    free(conn->sending);
+    free(conn);
+
+    if (loop->accept_paused) {
+        loop->accept_paused = 0;
+        arm_accept(loop);
+    }
+}
+
+// start writing the client's pending output, unless a send is in flight
+// (its completion picks up whatever was added meanwhile)
+static void queue_send(uring_loop *loop, uring_conn *conn) {
+    if (conn->sending || conn->closing) return;
+
+    size_t len, capacity;
+    char *out = client_reply_take(&conn->client, &len, &capacity);
+    if (!out) {
+        if (conn->close_after_send) close_conn(loop, conn);
+        return;
+    }
+    conn->sending = out;
+    conn->sending_len = len;
+    conn->sending_sent = 0;
+    conn->sending_capacity = capacity;
+    submit_send(loop, conn);
+}
+
+// append received bytes to the query buffer, running the commands as they
+// complete. returns 0 on a protocol error
+static int feed_client(client_t *client, const char *data, size_t len) {
+    while (len > 0) {
+        // process_client_buffer always leaves room for more
+        size_t room = client->buffer_capacity - client->buffer_pos - 1;
+        size_t chunk = len < room ? len : room;
+        memcpy(client->buffer + client->buffer_pos, data, chunk);
+        client->buffer_pos += chunk;
+        client->buffer[client->buffer_pos] = '\0';
+        data += chunk;
+        len -= chunk;
+        if (!process_client_buffer(client, server_db, NULL, NULL)) return 0;
+    }
+    return 1;
+}
+
+// run the client's held input, up to its budget for this round, and send
+// the replies. what is left over waits on the ready list
+static void run_held(uring_loop *loop, uring_conn *conn) {
+    if (conn->round != loop->round) {
+        conn->round = loop->round;
+        conn->round_bytes = 0;
+    }
+    while (conn->held_head != -1 && !conn->closing && !conn->close_after_send) {
+        if (conn->round_bytes >= URING_READ_BUDGET) {
+            if (!conn->ready_queued) {
+                conn->ready_queued = 1;
+                conn->next_ready = loop->ready;
+                loop->ready = conn;
+            }
+            break;
+        }
+        int bid = unhold_buffer(loop, conn);
+        unsigned len = loop->held_len[bid];
+        conn->round_bytes += len;
+        if (!feed_client(&conn->client, loop->buf_base + (size_t)bid * URING_BUF_SIZE, len)) {
+            conn->close_after_send = 1;
+        }
+        recycle_buffer(loop, bid);
+    }
+    // a client that hung up still gets the replies to what it sent. after
+    // a protocol error the rest of the input is dropped
+    if (conn->hung_up && conn->held_head == -1) conn->close_after_send = 1;
+    if (conn->closing || conn->close_after_send) {
+        drop_held(loop, conn);
+    } else if (conn->held_bytes >= URING_HELD_LIMIT) {
+        if (!conn->recv_paused) pause_recv(loop, conn);
+    } else if (conn->recv_paused && conn->held_bytes <= URING_HELD_LIMIT / 2) {
+        conn->recv_paused = 0;
+        if (!conn->receiving && !conn->hung_up && !conn->starved_queued) arm_recv(loop, conn);
+    }
+    queue_send(loop, conn);
+}
+
+static void handle_recv(uring_loop *loop, uring_conn *conn, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->receiving = 0;
+        conn->ops--;
+    }
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!conn->closing && !conn->close_after_send) {
+            hold_buffer(loop, conn, bid, cqe->res);
+            run_held(loop, conn);
+        } else {
+            recycle_buffer(loop, bid);
+        }
+    }
+
+    if (cqe->res == 0) {
+        // client closed connection
+        conn->hung_up = 1;
+        run_held(loop, conn);
+    } else if (cqe->res == -ENOBUFS) {
+        // arming again right away would fail the same way, until clients
+        // give buffers back
+        if (!conn->receiving && !conn->starved_queued && !conn->closing) {
+            conn->starved_queued = 1;
+            conn->next_starved = NULL;
+            if (loop->starved) {
+                loop->starved_tail->next_starved = conn;
+            } else {
+                loop->starved = conn;
+            }
+            loop->starved_tail = conn;
+        }
+    } else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        if (!conn->closing) {
+            fprintf(stderr, "read from client failed: %s\n", strerror(-cqe->res));
+        }
+        close_conn(loop, conn);
+    } else if (!conn->receiving && !conn->closing && !conn->close_after_send && !conn->recv_paused) {
+        // the kernel ended the multishot, or it was paused and run_held
+        // worked the client's input down before the cancel came back
+        arm_recv(loop, conn);
+    }
+    release_conn(loop, conn);
+}
+
+static void handle_send(uring_loop *loop, uring_conn *conn, int res) {
+    conn->ops--;
+    if (res < 0) {
+        close_conn(loop, conn);
+    } else {
+        conn->sending_sent += res;
+        if (conn->sending_sent < conn->sending_len && !conn->closing) {
+            submit_send(loop, conn); // the rest didn't fit in the socket
+            return;
+        }
+    }
+
+    client_reply_recycle(&conn->client, conn->sending, conn->sending_capacity);
+    conn->sending = NULL;
+    // output added while this was in flight
+    queue_send(loop, conn);
+    release_conn(loop, conn);
+}
+
+static void handle_accept(uring_loop *loop, struct io_uring_cqe *cqe) {
+    if (cqe->res >= 0) {
+        add_conn(loop, cqe->res);
+    } else if (cqe->res == -EMFILE || cqe->res == -ENFILE || cqe->res == -ENOMEM) {
+        // retrying right away would spin, wait for a client to go away
+        fprintf(stderr, "accept failed: %s\n", strerror(-cqe->res));
+        loop->accept_paused = 1;
+        return;
+    } else if (cqe->res != -ECONNABORTED && cqe->res != -EINTR) {
+        fprintf(stderr, "accept failed: %s\n", strerror(-cqe->res));
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) arm_accept(loop);
+}
+
+static void handle_wake(uring_loop *loop, struct io_uring_cqe *cqe) {
+    uint64_t count;
+    if (read(loop->wake_fd, &count, sizeof(count)) < 0) {
+        // EAGAIN: nothing new since the last wakeup
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) arm_wake(loop);
+}
+
+// write the output other threads handed over
+static void drain_handoff(uring_loop *loop) {
+    pthread_mutex_lock(&loop->handoff_lock);
+    uring_conn *conn = loop->handoff;
+    loop->handoff = NULL;
+    pthread_mutex_unlock(&loop->handoff_lock);
+
+    while (conn) {
+        // still marked queued, so nobody relinks it before we move on
+        uring_conn *next = conn->next_handoff;
+        pthread_mutex_lock(&loop->handoff_lock);
+        conn->handoff_queued = 0;
+        pthread_mutex_unlock(&loop->handoff_lock);
+        queue_send(loop, conn);
+        release_conn(loop, conn);
+        conn = next;
+    }
+}
+
+// run the input held over from the last round
+static void run_ready(uring_loop *loop) {
+    uring_conn *conn = loop->ready;
+    loop->ready = NULL;
+    while (conn) {
+        uring_conn *next = conn->next_ready;
+        conn->ready_queued = 0;
+        run_held(loop, conn);
+        release_conn(loop, conn);
+        conn = next;
+    }
+}
+
+// arm the recvs that ran out of buffers again once clients have given a
+// quarter of them back. each may take URING_HELD_LIMIT before it pauses,
+// so only as many are armed as the free buffers cover, the others wait
+// for the next round
+static void rearm_starved(uring_loop *loop) {
+    unsigned free_bufs = URING_BUFS - loop->held_bufs;
+    if (!loop->starved || free_bufs < URING_BUFS / 4) return;
+
+    unsigned arms = free_bufs / (URING_HELD_LIMIT / URING_BUF_SIZE);
+    if (arms == 0) arms = 1;
+    while (loop->starved && arms > 0) {
+        uring_conn *conn = loop->starved;
+        loop->starved = conn->next_starved;
+        conn->starved_queued = 0;
+        if (!conn->receiving && !conn->closing && !conn->close_after_send &&
+            !conn->recv_paused && !conn->hung_up) {
+            arm_recv(loop, conn);
+            arms--;
+        }
+        release_conn(loop, conn);
+    }
+}
+
+static void handle_cqe(uring_loop *loop, struct io_uring_cqe *cqe) {
+    uring_conn *conn = (uring_conn *)(uintptr_t)(cqe->user_data & ~URING_OP_MASK);
+    switch (cqe->user_data & URING_OP_MASK) {
+    case URING_OP_ACCEPT:
+        handle_accept(loop, cqe);
+        break;
+    case URING_OP_RECV:
+        handle_recv(loop, conn, cqe);
+        break;
+    case URING_OP_SEND:
+        handle_send(loop, conn, cqe->res);
+        break;
+    case URING_OP_WAKE:
+        handle_wake(loop, cqe);
+        break;
+    case URING_OP_CANCEL:
+        break; // the cancelled recv completes on its own
+    }
+}
+
+int uring_loop_run(int server_sock) {
+    uring_loop loop;
+    memset(&loop, 0, sizeof(loop));
+    loop.server_sock = server_sock;
+    loop.wake_fd = -1;
+
+    int ret = uring_init(&loop.ring, URING_ENTRIES);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring setup failed: %s\n", strerror(-ret));
+        return 0;
+    }
+    loop.wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (loop.wake_fd == -1 || !setup_buffers(&loop)) {
+        perror("failed to set up io_uring loop");
+        goto cleanup;
+    }
+    setup_files(&loop);
+    pthread_mutex_init(&loop.handoff_lock, NULL);
+
+    // io_uring fails requests on non-blocking files instead of waiting
+    int flags = fcntl(server_sock, F_GETFL);
+    if (flags != -1) fcntl(server_sock, F_SETFL, flags & ~O_NONBLOCK);
+
+    running_loop = &loop;
+    on_loop_thread = 1;
+    arm_accept(&loop);
+    arm_wake(&loop);
+    printf("server io_uring loop started. waiting for events...\n");
+
+    while (server_running) {
+        // submits the sends and re-arms of the last round and waits for
+        // the next completion, all in one system call. clients with held
+        // input don't wait. with appendfsync always the sends wait for the
+        // fsync of the round's writes
+        aof_flush();
+        aof_wait_synced();
+        ret = uring_submit_and_wait(&loop.ring, loop.ready ? 0 : 1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+            fprintf(stderr, "io_uring_enter failed: %s\n", strerror(-ret));
+            continue;
+        }
+
+        loop.round++;
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&loop.ring)) != NULL) {
+            // the slot goes back to the kernel before handling, which may
+            // submit (and so complete) more
+            struct io_uring_cqe done = *cqe;
+            uring_cqe_seen(&loop.ring);
+            handle_cqe(&loop, &done);
+        }
+        run_ready(&loop);
+        drain_handoff(&loop);
+        rearm_starved(&loop);
+    }
+
+    running_loop = NULL;
+    on_loop_thread = 0;
+    pthread_mutex_destroy(&loop.handoff_lock);
+cleanup:
+    // closing the ring drops every request, buffer and file registration
+    uring_free(&loop.ring);
+    if (loop.bufs) munmap(loop.bufs, loop.bufs_size);
+    free(loop.buf_base);
+    if (loop.wake_fd != -1) close(loop.wake_fd);
+    return 1;
+}
+
+#else
+
+int uring_loop_run(int server_sock) {
+    (void)server_sock;
+    fprintf(stderr, "built without io_uring support (needs linux 6.0 headers)\n");
+    return 0;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,127 @@
+#include "io_threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+
+// polls before a thread goes to sleep waiting for the next batch, and
+// before the event loop starts yielding its cpu while waiting for a batch
+// to finish. under load the next batch comes within microseconds, so the
+// threads rarely sleep and a batch costs no system calls to hand out
+#define IO_SPIN 4096
+
+typedef struct io_thread {
+    pthread_t thread;
+    int id;
+    int pending;            // set with a batch to work on, cleared once its share is done
+    pthread_mutex_t lock;   // only for sleeping on cond
+    pthread_cond_t cond;
+} __attribute__((aligned(64))) io_thread;  // pending of each thread on its own cache line
+
+static io_thread *threads = NULL;
+static int thread_count = 1;
+static int stopping = 0;
+
+// the batch being worked on, written before pending is set
+static io_job batch_job;
+static client_t **batch_clients;
+static int batch_count;
+
+static void run_share(int id) {
+    for (int i = id; i < batch_count; i += thread_count) {
+        batch_job(batch_clients[i]);
+    }
+}
+
+static void *io_thread_main(void *arg) {
+    io_thread *t = arg;
+    while (1) {
+        int spins = 0;
+        while (!__atomic_load_n(&t->pending, __ATOMIC_ACQUIRE) && spins++ < IO_SPIN) {
+        }
+        if (!__atomic_load_n(&t->pending, __ATOMIC_ACQUIRE)) {
+            pthread_mutex_lock(&t->lock);
+            while (!__atomic_load_n(&t->pending, __ATOMIC_ACQUIRE) &&
+                   !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+                pthread_cond_wait(&t->cond, &t->lock);
+            }
+            pthread_mutex_unlock(&t->lock);
+            if (!__atomic_load_n(&t->pending, __ATOMIC_ACQUIRE)) return NULL; // stopping
+        }
+
+        run_share(t->id);
+        // the release store hands the clients back to the event loop
+        __atomic_store_n(&t->pending, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static void wake(io_thread *t) {
+    pthread_mutex_lock(&t->lock);
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+}
+
+int io_threads_start(int count) {
+    if (count <= 1) return 1;
+
+    threads = calloc(count, sizeof(io_thread));
+    if (!threads) {
+        perror("failed to allocate io threads");
+        return 0;
+    }
+    thread_count = count;
+    stopping = 0;
+    for (int i = 1; i < count; i++) {
+        threads[i].id = i;
+        pthread_mutex_init(&threads[i].lock, NULL);
+        pthread_cond_init(&threads[i].cond, NULL);
+        if (pthread_create(&threads[i].thread, NULL, io_thread_main, &threads[i]) != 0) {
+            perror("failed to create io thread");
+            // stop the ones already running
+            thread_count = i;
+            io_threads_stop();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void io_threads_stop(void) {
+    if (!threads) return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 1; i < thread_count; i++) {
+        wake(&threads[i]);
+    }
+    for (int i = 1; i < thread_count; i++) {
+        pthread_join(threads[i].thread, NULL);
+        pthread_mutex_destroy(&threads[i].lock);
+        pthread_cond_destroy(&threads[i].cond);
+    }
+    free(threads);
+    threads = NULL;
+    thread_count = 1;
+}
+
+int io_threads_count(void) {
+    return thread_count;
+}
+
+void io_threads_run(io_job job, client_t **clients, int count) {
+    batch_job = job;
+    batch_clients = clients;
+    batch_count = count;
+    for (int i = 1; i < thread_count; i++) {
+        __atomic_store_n(&threads[i].pending, 1, __ATOMIC_RELEASE);
+        wake(&threads[i]);
+    }
+
+    run_share(0);
+
+    for (int i = 1; i < thread_count; i++) {
+        int spins = 0;
+        while (__atomic_load_n(&threads[i].pending, __ATOMIC_ACQUIRE)) {
+            // let a thread that shares our cpu get on with it
+            if (++spins > IO_SPIN) sched_yield();
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef IO_THREADS_H
+#define IO_THREADS_H
+
+#include "crimsoncache.h"
+
+#define IO_THREADS_MAX 64
+
+// a pool of threads the event loop hands socket reads and reply writes to,
+// while it keeps running every command itself. a job runs over a batch of
+// clients, client i going to thread i % count, with the calling thread
+// taking the share of thread 0; io_threads_run returns once all of the
+// batch is done, so the caller owns the clients again
+typedef void (*io_job)(client_t *client);
+
+// start count - 1 threads (the caller is the first), returns 0 on failure
+int io_threads_start(int count);
+void io_threads_stop(void);
+// threads sharing a batch, 1 when there is no pool
+int io_threads_count(void);
+void io_threads_run(io_job job, client_t **clients, int count);
+
+#endif /* IO_THREADS_H */
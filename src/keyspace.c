@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200809L
+#include "keyspace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t current_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// create a keyspace of nshards (rounded up to a power of two) dicts
+keyspace *keyspace_create(int nshards, size_t initial_size) {
+    int n = 1;
+    while (n < nshards && n < KEYSPACE_MAX_SHARDS) n *= 2;
+
+    keyspace *ks = malloc(sizeof(keyspace));
+    if (!ks) return NULL;
+
+    void *shards;
+    if (posix_memalign(&shards, 64, n * sizeof(keyspace_shard)) != 0) {
+        free(ks);
+        return NULL;
+    }
+    ks->shards = shards;
+    ks->nshards = n;
+    ks->next_expire_shard = 0;
+
+    // the initial size is for the whole keyspace
+    size_t shard_size = initial_size / n;
+    for (int i = 0; i < n; i++) {
+        ks->shards[i].d = dict_create(shard_size);
+        if (!ks->shards[i].d) {
+            for (int j = 0; j < i; j++) {
+                pthread_rwlock_destroy(&ks->shards[j].lock);
+                dict_free(ks->shards[j].d);
+            }
+            free(ks->shards);
+            free(ks);
+            return NULL;
+        }
+        pthread_rwlock_init(&ks->shards[i].lock, NULL);
+    }
+    return ks;
+}
+
+// free all shards, no other thread may be using the keyspace
+void keyspace_free(keyspace *ks) {
+    if (!ks) return;
+
+    for (int i = 0; i < ks->nshards; i++) {
+        pthread_rwlock_destroy(&ks->shards[i].lock);
+        dict_free(ks->shards[i].d);
+    }
+    free(ks->shards);
+    free(ks);
+}
+
+// each shard evicts on its own, so the limit is split evenly between them
+void keyspace_set_max_memory(keyspace *ks, size_t max_memory) {
+    size_t per_shard = max_memory / ks->nshards;
+    if (max_memory != 0 && per_shard == 0) per_shard = 1;
+
+    for (int i = 0; i < ks->nshards; i++) {
+        ks->shards[i].d->max_memory = per_shard;
+    }
+}
+
+void keyspace_reserve(keyspace *ks, size_t keys) {
+    // keys spread evenly over the shards by hash, give each a little slack
+    size_t per_shard = keys / ks->nshards;
+    per_shard += per_shard / 16;
+
+    for (int i = 0; i < ks->nshards; i++) {
+        dict_reserve(ks->shards[i].d, per_shard);
+    }
+}
+
+void keyspace_empty(keyspace *ks) {
+    for (int i = 0; i < ks->nshards; i++) {
+        keyspace_lock_shard(ks, i, 1);
+        dict_empty(ks->shards[i].d);
+        keyspace_unlock_shard(ks, i);
+    }
+}
+
+// shards are picked from bits 32 and up of the key hash. the tables index
+// with the low bits and the swiss engine keeps the top 7 in its control
+// bytes, so every shard still gets a well spread hash
+int keyspace_shard_index(const keyspace *ks, const char *key) {
+    return (int)((dict_hash(key) >> 32) & (uint64_t)(ks->nshards - 1));
+}
+
+dict *keyspace_dict(keyspace *ks, const char *key) {
+    return ks->shards[keyspace_shard_index(ks, key)].d;
+}
+
+// the set the calling thread holds for a batch of commands, see
+// keyspace_hold. its shards are locked already, locking them again is a no-op
+static __thread const keyspace_lockset *held = NULL;
+
+static int shard_held(int shard) {
+    return held && (held->shards[shard / 64] >> (shard % 64)) & 1;
+}
+
+void keyspace_lock_shard(keyspace *ks, int shard, int write) {
+    if (shard_held(shard)) return;
+    if (write) {
+        pthread_rwlock_wrlock(&ks->shards[shard].lock);
+    } else {
+        pthread_rwlock_rdlock(&ks->shards[shard].lock);
+    }
+}
+
+void keyspace_unlock_shard(keyspace *ks, int shard) {
+    if (shard_held(shard)) return;
+    pthread_rwlock_unlock(&ks->shards[shard].lock);
+}
+
+void keyspace_lockset_init(keyspace_lockset *ls, int write) {
+    memset(ls->shards, 0, sizeof(ls->shards));
+    ls->write = write;
+}
+
+// adding the same shard twice is fine, it is locked once
+void keyspace_lockset_add(const keyspace *ks, keyspace_lockset *ls, const char *key) {
+    int shard = keyspace_shard_index(ks, key);
+    ls->shards[shard / 64] |= 1ULL << (shard % 64);
+}
+
+void keyspace_lockset_add_all(const keyspace *ks, keyspace_lockset *ls) {
+    for (int shard = 0; shard < ks->nshards; shard++) {
+        ls->shards[shard / 64] |= 1ULL << (shard % 64);
+    }
+}
+
+// lock every shard in the set, lowest index first
+void keyspace_lock(keyspace *ks, const keyspace_lockset *ls) {
+    for (int word = 0; word < (ks->nshards + 63) / 64; word++) {
+        uint64_t bits = ls->shards[word];
+        while (bits) {
+            int shard = word * 64 + __builtin_ctzll(bits);
+            keyspace_lock_shard(ks, shard, ls->write);
+            bits &= bits - 1;
+        }
+    }
+}
+
+void keyspace_unlock(keyspace *ks, const keyspace_lockset *ls) {
+    for (int word = 0; word < (ks->nshards + 63) / 64; word++) {
+        uint64_t bits = ls->shards[word];
+        while (bits) {
+            keyspace_unlock_shard(ks, word * 64 + __builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+void keyspace_hold(keyspace *ks, const keyspace_lockset *ls) {
+    keyspace_lock(ks, ls);
+    held = ls;
+}
+
+void keyspace_release(keyspace *ks, const keyspace_lockset *ls) {
+    held = NULL;
+    keyspace_unlock(ks, ls);
+}
+
+// run the active expire cycle on the shards in turn, sharing budget_us
+// between them. a cycle that runs out of time resumes from the shard it
+// stopped at next time. returns 1 if the budget ran out with keys still due
+int keyspace_expire_cycle(keyspace *ks, long budget_us) {
+    uint64_t start = current_time_us();
+
+    for (int i = 0; i < ks->nshards; i++) {
+        int shard = (ks->next_expire_shard + i) & (ks->nshards - 1);
+        long left = budget_us - (long)(current_time_us() - start);
+        if (left <= 0) {
+            ks->next_expire_shard = shard;
+            return 1;
+        }
+
+        keyspace_lock_shard(ks, shard, 1);
+        int timed_out = dict_expire_cycle(ks->shards[shard].d, left);
+        keyspace_unlock_shard(ks, shard);
+
+        if (timed_out) {
+            ks->next_expire_shard = shard;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// keep in-progress rehashes moving when no commands arrive, and shrink
+// the tables of shards that emptied out (see dict_rehash_ms)
+void keyspace_rehash_ms(keyspace *ks, int ms) {
+    for (int i = 0; i < ks->nshards; i++) {
+        keyspace_lock_shard(ks, i, 1);
+        dict_rehash_ms(ks->shards[i].d, ms);
+        keyspace_unlock_shard(ks, i);
+    }
+}
+
+// sum the counters of all shards. each shard is read under its own lock,
+// so the totals are not a single point-in-time snapshot
+void keyspace_get_stats(keyspace *ks, keyspace_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; i < ks->nshards; i++) {
+        keyspace_lock_shard(ks, i, 0);
+        const dict *d = ks->shards[i].d;
+        stats->keys += d->used;
+        stats->expires += d->expires_used;
+        stats->used_memory += dict_used_memory(d);
+        stats->entries_memory += d->entries_memory;
+        stats->payload_memory += d->payload_memory;
+        stats->tables_memory += dict_tables_memory(d);
+        stats->evicted_keys += d->stat_evicted_keys;
+        stats->expired_keys += d->stat_expired_keys;
+        stats->expire_cap_reached += d->stat_expire_cap_reached;
+        stats->expire_cycle_us += d->stat_expire_cycle_us;
+        keyspace_unlock_shard(ks, i);
+    }
+}
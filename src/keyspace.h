@@ -0,0 +1,82 @@
+#ifndef KEYSPACE_H
+#define KEYSPACE_H
+
+#include "dict.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// the keyspace is split into shards by key hash, each an independent dict
+// behind its own reader-writer lock. commands lock only the shards of the
+// keys they touch, so clients on different shards (or readers of the same
+// shard) run in parallel in the threaded model
+#define KEYSPACE_DEFAULT_SHARDS 16
+#define KEYSPACE_MAX_SHARDS 1024
+
+// one shard per cache line, so locking one never bounces its neighbours
+typedef struct keyspace_shard {
+    pthread_rwlock_t lock;
+    dict *d;
+} __attribute__((aligned(64))) keyspace_shard;
+
+typedef struct keyspace {
+    keyspace_shard *shards;
+    int nshards;           // power of two
+    int next_expire_shard; // where the next expire cycle starts
+} keyspace;
+
+// set of shards to lock for one command. shards are always locked in
+// ascending order, so commands on several keys can't deadlock
+typedef struct keyspace_lockset {
+    uint64_t shards[KEYSPACE_MAX_SHARDS / 64];
+    int write;             // exclusive locks instead of shared ones
+} keyspace_lockset;
+
+// totals over all shards, for INFO and MEMORY STATS
+typedef struct keyspace_stats {
+    size_t keys;
+    size_t expires;
+    size_t used_memory;
+    size_t entries_memory;
+    size_t payload_memory;
+    size_t tables_memory;
+    uint64_t evicted_keys;
+    uint64_t expired_keys;
+    uint64_t expire_cap_reached;
+    uint64_t expire_cycle_us;
+} keyspace_stats;
+
+keyspace *keyspace_create(int nshards, size_t initial_size);
+void keyspace_free(keyspace *ks);
+void keyspace_set_max_memory(keyspace *ks, size_t max_memory);
+// size the shards of an empty keyspace for about keys keys, before loading them
+void keyspace_reserve(keyspace *ks, size_t keys);
+// drop every key, e.g. what a failed load left behind
+void keyspace_empty(keyspace *ks);
+
+// the dict holding key. the caller must hold the shard's lock
+int keyspace_shard_index(const keyspace *ks, const char *key);
+dict *keyspace_dict(keyspace *ks, const char *key);
+
+void keyspace_lock_shard(keyspace *ks, int shard, int write);
+void keyspace_unlock_shard(keyspace *ks, int shard);
+
+void keyspace_lockset_init(keyspace_lockset *ls, int write);
+void keyspace_lockset_add(const keyspace *ks, keyspace_lockset *ls, const char *key);
+void keyspace_lockset_add_all(const keyspace *ks, keyspace_lockset *ls);
+void keyspace_lock(keyspace *ks, const keyspace_lockset *ls);
+void keyspace_unlock(keyspace *ks, const keyspace_lockset *ls);
+
+// lock ls for a batch of commands run by the calling thread, like EXEC.
+// until keyspace_release the thread's own locks on shards of ls are no-ops,
+// so the commands lock nothing they hold already. ls must stay valid, and
+// be exclusive if anything in the batch writes
+void keyspace_hold(keyspace *ks, const keyspace_lockset *ls);
+void keyspace_release(keyspace *ks, const keyspace_lockset *ls);
+
+// background work, each shard is locked only while it is worked on
+int keyspace_expire_cycle(keyspace *ks, long budget_us);
+void keyspace_rehash_ms(keyspace *ks, int ms);
+
+void keyspace_get_stats(keyspace *ks, keyspace_stats *stats);
+
+#endif /* KEYSPACE_H */
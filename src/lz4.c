@@ -0,0 +1,162 @@
+#include "lz4.h"
+#include <stdint.h>
+#include <string.h>
+
+// the block format is a run of sequences: a token byte with the literal
+// length in its high nibble and the match length - 4 in its low one (15
+// means more length bytes follow, each 255 meaning yet another), the
+// literals, then a 2-byte little-endian offset back to the match. the last
+// sequence is literals only, and the format wants the last 5 bytes to be
+// literals and no match to start within the last 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_LOG_MIN 6
+#define LZ4_HASH_LOG_MAX 12
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// write a length over 15 as its extra bytes
+static unsigned char *put_length(unsigned char *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+// append a sequence, match_len 0 for the closing literals. returns NULL if
+// it doesn't fit
+static unsigned char *put_sequence(unsigned char *op, const unsigned char *oend,
+                                   const unsigned char *literals, size_t literal_len,
+                                   size_t offset, size_t match_len) {
+    size_t needed = 1 + literal_len / 255 + 1 + literal_len + 2 + match_len / 255 + 1;
+    if ((size_t)(oend - op) < needed) return NULL;
+
+    unsigned char *token = op++;
+    if (literal_len >= 15) {
+        *token = 15 << 4;
+        op = put_length(op, literal_len - 15);
+    } else {
+        *token = (unsigned char)(literal_len << 4);
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (match_len == 0) return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    match_len -= LZ4_MIN_MATCH;
+    if (match_len >= 15) {
+        *token |= 15;
+        op = put_length(op, match_len - 15);
+    } else {
+        *token |= (unsigned char)match_len;
+    }
+    return op;
+}
+
+size_t lz4_compress(const char *src, size_t len, char *dst, size_t dst_cap) {
+    const unsigned char *in = (const unsigned char *)src;
+    const unsigned char *end = in + len;
+    const unsigned char *ip = in;
+    const unsigned char *anchor = in;   // start of the literals not written yet
+    unsigned char *op = (unsigned char *)dst;
+    const unsigned char *oend = op + dst_cap;
+
+    // positions by hash of the four bytes there. the table is sized to the
+    // input, clearing a large one would cost more than compressing a value
+    uint32_t table[1 << LZ4_HASH_LOG_MAX];
+    int hash_log = LZ4_HASH_LOG_MIN;
+    while (hash_log < LZ4_HASH_LOG_MAX && ((size_t)1 << hash_log) < len) hash_log++;
+    memset(table, 0, sizeof(uint32_t) << hash_log);
+
+    if (len > LZ4_MF_LIMIT) {
+        const unsigned char *mf_limit = end - LZ4_MF_LIMIT;          // matches start before
+        const unsigned char *match_limit = end - LZ4_LAST_LITERALS;  // and end before
+        while (ip < mf_limit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = (seq * 2654435761U) >> (32 - hash_log);
+            const unsigned char *match = in + table[h];
+            table[h] = (uint32_t)(ip - in);
+            if (match >= ip || ip - match > LZ4_MAX_OFFSET || read32(match) != seq) {
+                ip++;
+                continue;
+            }
+
+            // grow the match backwards into the pending literals, then forwards
+            while (ip > anchor && match > in && ip[-1] == match[-1]) {
+                ip--;
+                match--;
+            }
+            const unsigned char *p = ip + LZ4_MIN_MATCH;
+            const unsigned char *m = match + LZ4_MIN_MATCH;
+            while (p < match_limit && *p == *m) {
+                p++;
+                m++;
+            }
+
+            op = put_sequence(op, oend, anchor, ip - anchor, ip - match, p - ip);
+            if (!op) return 0;
+            ip = anchor = p;
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (!op) return 0;
+    return op - (unsigned char *)dst;
+}
+
+// read the extra bytes of a length of 15. returns 0 past the end of input
+static int get_length(const unsigned char **ip, const unsigned char *iend, size_t *len) {
+    unsigned char b;
+    do {
+        if (*ip >= iend) return 0;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+int lz4_decompress(const char *src, size_t len, char *dst, size_t dst_len) {
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *iend = ip + len;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *oend = op + dst_len;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !get_length(&ip, iend, &literal_len)) return 0;
+        if ((size_t)(iend - ip) < literal_len || (size_t)(oend - op) < literal_len) return 0;
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == iend) break;  // the closing literals
+
+        if (iend - ip < 2) return 0;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst)) return 0;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !get_length(&ip, iend, &match_len)) return 0;
+        match_len += LZ4_MIN_MATCH;
+        if ((size_t)(oend - op) < match_len) return 0;
+
+        const unsigned char *match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+        } else {
+            // the match overlaps what it produces, a run repeating offset bytes
+            for (size_t i = 0; i < match_len; i++) op[i] = match[i];
+        }
+        op += match_len;
+    }
+    return op == oend;
+}
@@ -0,0 +1,19 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+
+// compression in the lz4 block format, small and without a dependency.
+// the compressor is the plain greedy one: a hash of the next four bytes
+// finds an earlier occurrence, which is extended as far as it matches.
+// fast rather than thorough, meant for values in rdb files
+
+// compress len bytes of src into dst. returns the compressed size, or 0
+// if it wouldn't fit in dst_cap bytes (pass less than len to only take
+// compression that saves something)
+size_t lz4_compress(const char *src, size_t len, char *dst, size_t dst_cap);
+// decompress a block of len bytes that must expand to exactly dst_len
+// bytes. returns 0 if it is corrupt
+int lz4_decompress(const char *src, size_t len, char *dst, size_t dst_len);
+
+#endif /* LZ4_H */
@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // for SO_REUSEPORT
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,10 +18,19 @@
 #include "transaction.h"
 #include "pubsub.h"
 #include "config.h"
+#include "resp.h"
 #include "eventloop.h"
-
-// max_clients is now configured via crimsoncache.conf
-client_t **client_list;
+#include "io_threads.h"
+#include "workers.h"
+#include "reply.h"
+#include "aof.h"
+
+// clients indexed by socket, so finding one doesn't depend on how many are
+// connected. grown to fit the highest socket registered
+static client_t **client_table = NULL;
+static int client_table_size = 0;
+// client threads register and look up clients concurrently
+static pthread_mutex_t client_table_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // global variables for persistence, now configured via config.h
 struct {
@@ -29,33 +38,50 @@ struct {
     time_t last_save;
 } server_persistence;
 
+// make room for socket in the client table, called with the lock held
+static int client_table_reserve(int socket) {
+    if (socket < client_table_size) return 1;
+
+    int size = client_table_size ? client_table_size : 64;
+    while (size <= socket) size *= 2;
+    client_t **table = realloc(client_table, size * sizeof(client_t *));
+    if (!table) return 0;
+    memset(table + client_table_size, 0, (size - client_table_size) * sizeof(client_t *));
+    client_table = table;
+    client_table_size = size;
+    return 1;
+}
+
 void register_client(client_t *client) {
-    for (int i = 0; i < config.max_clients; i++) {
-        if (client_list[i] == NULL) {
-            client_list[i] = client;
-            // tx_init(client); // Initialized when client_t is created
-            break;
-        }
+    pthread_mutex_lock(&client_table_mutex);
+    if (client_table_reserve(client->socket)) {
+        client_table[client->socket] = client;
+    } else {
+        // replies to it are then written straight to the socket
+        fprintf(stderr, "failed to grow client table for socket %d\n", client->socket);
     }
+    pthread_mutex_unlock(&client_table_mutex);
 }
 
 void unregister_client(client_t *client) {
-    for (int i = 0; i < config.max_clients; i++) {
-        if (client_list[i] == client) {
-            tx_cleanup(client); // Clean up transaction resources
-            client_list[i] = NULL;
-            break;
-        }
+    pthread_mutex_lock(&client_table_mutex);
+    if (client->socket < client_table_size && client_table[client->socket] == client) {
+        client_table[client->socket] = NULL;
     }
+    pthread_mutex_unlock(&client_table_mutex);
+    tx_cleanup(client); // Clean up transaction resources
 }
 
+// only needed where the client isn't at hand already: the event loop gets
+// it from epoll and commands from execute_command
 client_t *get_client_by_socket(int socket) {
-    for (int i = 0; i < config.max_clients; i++) {
-        if (client_list[i] && client_list[i]->socket == socket) {
-            return client_list[i];
-        }
+    client_t *client = NULL;
+    pthread_mutex_lock(&client_table_mutex);
+    if (socket >= 0 && socket < client_table_size) {
+        client = client_table[socket];
     }
-    return NULL;
+    pthread_mutex_unlock(&client_table_mutex);
+    return client;
 }
 
 // background thread function prototypes
@@ -64,8 +90,8 @@ void *auto_save_thread(void *arg);
 void *replication_thread(void *arg);
 void track_command_change(void);
 
-// global dictionary (server database)
-dict *server_db = NULL;
+// global keyspace (server database)
+keyspace *server_db = NULL;
 
 volatile sig_atomic_t server_running = 1;
 void handle_signal(int sig) {
@@ -74,13 +100,29 @@ void handle_signal(int sig) {
         server_running = 0;
     }
 }
-// thread for cleaning expired keys from the database
+// share of each 1/hz period the active expire cycle may use, like redis
+#define ACTIVE_EXPIRE_CYCLE_PERC 25
+
+// thread for cleaning expired keys from the database, runs config.hz times
+// per second
 void *cleanup_expired_keys(void *arg) {
     (void)arg; // unused parameter
-    
+    long period_us = 1000000 / config.hz;
+    long budget_us = period_us * ACTIVE_EXPIRE_CYCLE_PERC / 100;
+
     while (server_running) {
-        dict_clear_expired(server_db);
-        sleep(1); // check every second
+        // keep in-progress rehashes moving even when no commands arrive
+        keyspace_rehash_ms(server_db, 1);
+
+        // expired keys are taken from the expiry index, soonest first. when
+        // the budget runs out with keys still due, come back after a pause
+        // as long as the cycle itself instead of a full period, so a backlog
+        // is cleared quickly without taking more than half the cpu
+        int timed_out = keyspace_expire_cycle(server_db, budget_us);
+
+        long sleep_us = timed_out ? budget_us : period_us;
+        struct timespec ts = {sleep_us / 1000000, (sleep_us % 1000000) * 1000};
+        nanosleep(&ts, NULL);
     }
     
     return NULL;
@@ -95,15 +137,17 @@ void *auto_save_thread(void *arg) {
         
         time_t now = time(NULL);
         int time_since_save = now - server_persistence.last_save;
+        int changes = __atomic_load_n(&server_persistence.changes_since_save, __ATOMIC_RELAXED);
 
-        if ((config.save_after_changes > 0 && server_persistence.changes_since_save >= config.save_after_changes) ||
-            (config.save_after_seconds > 0 && time_since_save >= config.save_after_seconds && server_persistence.changes_since_save > 0)) {
+        if ((config.save_after_changes > 0 && changes >= config.save_after_changes) ||
+            (config.save_after_seconds > 0 && time_since_save >= config.save_after_seconds && changes > 0)) {
             
             printf("auto-saving the database after %d changes and %d seconds...\n", 
-                   server_persistence.changes_since_save, time_since_save);
+                   changes, time_since_save);
             
             if (save_rdb_to_file(server_db, "dump.rdb")) {
-                server_persistence.changes_since_save = 0;
+                // changes made while saving count towards the next save
+                __atomic_sub_fetch(&server_persistence.changes_since_save, changes, __ATOMIC_RELAXED);
                 server_persistence.last_save = now;
             }
         }
@@ -116,8 +160,16 @@ void *auto_save_thread(void *arg) {
 void *replication_thread(void *arg) {
     (void)arg;
     
-    char buffer[config.buffer_size * 4]; // buffer for incoming data
-    int buffer_pos = 0;
+    // buffer for incoming data, it grows like a client's query buffer
+    size_t buffer_capacity = config.buffer_size;
+    char *buffer = malloc(buffer_capacity);
+    size_t buffer_pos = 0;
+    if (!buffer) {
+        perror("failed to allocate replication buffer");
+        return NULL;
+    }
+    resp_command cmd; // arguments of the command being applied, reused
+    resp_command_init(&cmd);
     
     while (server_running) {
         // handle replica duties
@@ -127,40 +179,44 @@ void *replication_thread(void *arg) {
                 server_repl.state == REPL_STATE_SYNC) {
                 
                 int bytes_read = recv(server_repl.primary_fd, buffer + buffer_pos, 
-                                     config.buffer_size - buffer_pos - 1, 0);
+                                     buffer_capacity - buffer_pos - 1, 0);
                 
                 if (bytes_read > 0) {
                     buffer_pos += bytes_read;
                     buffer[buffer_pos] = '\0';
                     
-                    // Process buffer line by line
-                    char *line = buffer;
-                    char *next_line;
-                    
-                    while ((next_line = strstr(line, "\r\n")) != NULL) {
-                        *next_line = '\0'; // Terminate the current line
-                        
+                    // the stream carries commands as clients sent them, inline or RESP
+                    size_t pos = 0;
+                    while (pos < buffer_pos) {
+                        size_t consumed;
+                        const char *error;
+                        resp_parse_result parsed = resp_parse_command(buffer + pos, buffer_pos - pos,
+                                                                      &consumed, &cmd, &error);
+                        if (parsed == RESP_PARSE_INCOMPLETE) break;
+                        if (parsed == RESP_PARSE_ERROR) {
+                            // can't find the next command boundary, start over from the next read
+                            fprintf(stderr, "replication: protocol error from primary: %s\n", error);
+                            pos = buffer_pos;
+                            break;
+                        }
+
                         // Skip empty lines
-                        if (strlen(line) > 0) {
+                        if (cmd.argc > 0) {
                             // Log the command we're about to execute
-                            printf("Replica executing: %s\n", line);
-                            
-                            // Process this command
-                            execute_command(-1, line, server_db);
+                            printf("Replica executing: %s\n", cmd.argv[0]);
+                            execute_command_argv(NULL, cmd.argc, cmd.argv, cmd.argv_len, server_db);
                         }
-                        
-                        // Move to the next line (skip \r\n)
-                        line = next_line + 2;
-                        
-                        // Update offset
-                        server_repl.repl_offset += (next_line + 2 - buffer);
+
+                        pos += consumed;
+                        server_repl.repl_offset += consumed;
                     }
                     
                     // Move any incomplete command to the beginning of the buffer
-                    if (line < buffer + buffer_pos) {
-                        buffer_pos = buffer + buffer_pos - line;
-                        memmove(buffer, line, buffer_pos);
-                    } else {
+                    buffer_pos -= pos;
+                    memmove(buffer, buffer + pos, buffer_pos);
+                    if (!query_buffer_reserve(&buffer, &buffer_capacity, buffer_pos, cmd.needed)) {
+                        fprintf(stderr, "replication: command from primary over client-query-buffer-limit, dropped\n");
+                        resp_command_drop_partial(&cmd);
                         buffer_pos = 0;
                     }
                     
@@ -197,20 +253,19 @@ void *replication_thread(void *arg) {
         nanosleep(&ts, NULL);
     }
     
+    resp_command_free(&cmd);
+    free(buffer);
     return NULL;
 }
 
-// track changes for persistence
+// track changes for persistence, called from every client thread
 void track_command_change(void) {
-    server_persistence.changes_since_save++;
+    __atomic_add_fetch(&server_persistence.changes_since_save, 1, __ATOMIC_RELAXED);
 }
 
 // handles client connections in threaded model
-void *handle_client(void *arg) {
-    client_t *client = (client_t *)arg;
-    int client_sock = client->socket;
+static void log_client_address(const client_t *client) {
     char client_ip_str[INET6_ADDRSTRLEN];
-    
     if (client->address.ss_family == AF_INET) {
         struct sockaddr_in *s = (struct sockaddr_in *)&client->address;
         inet_ntop(AF_INET, &s->sin_addr, client_ip_str, sizeof(client_ip_str));
@@ -224,39 +279,13 @@ void *handle_client(void *arg) {
     } else {
         printf("new client connected: unknown address family\n");
     }
-    
-    register_client(client);
-    
-    while (server_running) {
-        int bytes_read = recv(client_sock, client->buffer + client->buffer_pos, client->buffer_capacity - client->buffer_pos - 1, 0);
-        if (bytes_read <= 0) {
-            printf("client %s:%d disconnected\n", 
-                   client_ip_str, 
-                   (client->address.ss_family == AF_INET) ? ntohs(((struct sockaddr_in *)&client->address)->sin_port) : ntohs(((struct sockaddr_in6 *)&client->address)->sin6_port));
-            break;
-        }
-        
-        client->buffer_pos += bytes_read;
-        client->buffer[client->buffer_pos] = '\0';
-        
-        execute_command(client_sock, client->buffer, server_db);
-        client->buffer_pos = 0; // reset buffer for next command
-    }
-    pubsub_remove_client(client);
-    unregister_client(client);
-    close(client_sock);
-    free(client->buffer);
-    free(client);
-    return NULL;
 }
 
-// function to run threaded server with custom port
 void run_threaded_server(int port) {
     int server_sock, client_sock;
     struct sockaddr_in6 server_addr;
     struct sockaddr_storage client_addr; // Use sockaddr_storage for client_addr - handles both IPv4 and IPv6 well
     socklen_t client_len = sizeof(client_addr);
-    pthread_t thread_id;
     
     // now using the provided port parameter
     printf("CrimsonCache starting on port %d using threaded model\n", port);
@@ -297,35 +326,31 @@ void run_threaded_server(int port) {
     }
     
     // listen for connections
-    if (listen(server_sock, config.max_clients) < 0) {
+    if (listen(server_sock, config.tcp_backlog) < 0) {
         perror("Listen failed");
         exit(EXIT_FAILURE);
     }
     
     printf("Server is ready to accept connections\n");
     
-    // start background thread for key expiration
-    pthread_t cleanup_thread;
-    if (pthread_create(&cleanup_thread, NULL, cleanup_expired_keys, NULL) != 0) {
-        perror("Failed to create cleanup thread");
-    }
+    // the background threads are started by main, one set for both models
     
-    // start auto-save thread
-    pthread_t autosave_thread;
-    if (pthread_create(&autosave_thread, NULL, auto_save_thread, NULL) != 0) {
-        perror("failed to create auto-save thread");
+    // a fixed pool of workers serves every client, see workers.c
+    int workers = config.worker_threads;
+    if (workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (int)cpus : 4;
     }
-    
-    // Start replication thread
-    pthread_t repl_thread;
-    if (pthread_create(&repl_thread, NULL, replication_thread, NULL) != 0) {
-        perror("failed to create replication thread");
-        // Non-fatal, continue
+    if (!worker_pool_start(workers)) {
+        close(server_sock);
+        return;
     }
+    printf("serving clients with %d worker threads\n", workers);
     
-    // accept connections and handle clients
+    // accept connections and hand them to the workers
     while (server_running) {
-        client_sock = accept(server_sock, (struct sockaddr *)&client_addr, &client_len);
+        client_len = sizeof(client_addr);
+        client_sock = accept4(server_sock, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK);
         if (client_sock < 0) {
             if (server_running) perror("Accept failed");
             continue;
@@ -337,54 +362,45 @@ void run_threaded_server(int port) {
             close(client_sock);
             continue;
         }
-        
-        client->socket = client_sock;
-        // copy client address information
-        memcpy(&client->address, &client_addr, client_len);
-        client->addr_len = client_len;
-        client->buffer_pos = 0; // initialize buffer position
-        client->buffer = (char *)malloc(config.buffer_size);
-        if (client->buffer == NULL) {
-            perror("failed to allocate client buffer");
+        if (!event_loop_client_init(client, client_sock, &client_addr, client_len, -1)) {
             free(client);
             close(client_sock);
             continue;
         }
-        client->buffer_capacity = config.buffer_size;
-        tx_init(client); // initialize transaction state
-        
-        if (pthread_create(&thread_id, NULL, handle_client, (void *)client) != 0) {
-            perror("Failed to create thread");
-            free(client->buffer);
+        log_client_address(client);
+        if (!worker_pool_add(client)) {
+            event_loop_client_release(client);
             free(client);
             close(client_sock);
-        } else {
-            pthread_detach(thread_id);
         }
     }
     
+    worker_pool_stop();
     //clean
     close(server_sock);
     printf("Server shutdown complete\n");
 }
 
 
-// run the server using the event loop model
-void run_eventloop_server(int port) {
+// dual-stack listening socket for the event loop model. with reuseport
+// several sockets can be bound to the same port, one per reactor
+static int create_listener(int port, int reuseport) {
     int server_sock;
     struct sockaddr_in6 server_addr;
-    event_loop_t loop;
 
-    printf("CrimsonCache starting on port %d using eventloop model\n", port);
-
-    // Basic server setup (socket, bind, listen)
-    if ((server_sock = socket(AF_INET6, SOCK_STREAM, 0)) < 0) {
+    // non-blocking, the event loop accepts until the backlog is drained
+    if ((server_sock = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
         perror("Failed to create socket");
-        return;
+        return -1;
     }
 
     int opt = 1;
     setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport && setsockopt(server_sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT failed");
+        close(server_sock);
+        return -1;
+    }
 
     int ipv6_only = 0;
     setsockopt(server_sock, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6_only, sizeof(ipv6_only));
@@ -397,15 +413,79 @@ void run_eventloop_server(int port) {
     if (bind(server_sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         perror("Bind failed");
         close(server_sock);
-        return;
+        return -1;
     }
 
-    if (listen(server_sock, config.max_clients) < 0) {
+    if (listen(server_sock, config.tcp_backlog) < 0) {
         perror("Listen failed");
         close(server_sock);
+        return -1;
+    }
+    return server_sock;
+}
+
+// one event loop per reactor thread, each with its own listener
+static void run_reactors(int port) {
+    int count = config.reactors;
+    int *listeners = malloc(count * sizeof(int));
+    if (!listeners) {
+        perror("failed to allocate listeners");
+        return;
+    }
+
+    int opened = 0;
+    for (; opened < count; opened++) {
+        listeners[opened] = create_listener(port, 1);
+        if (listeners[opened] == -1) break;
+    }
+
+    if (opened == count) {
+        event_loop_run_reactors(listeners, count);
+    }
+
+    for (int i = 0; i < opened; i++) {
+        close(listeners[i]);
+    }
+    free(listeners);
+}
+
+// run the server using the event loop model
+void run_eventloop_server(int port) {
+    int server_sock;
+    event_loop_t loop;
+
+    int use_uring = config.concurrency_model == CONCURRENCY_URING;
+    printf("CrimsonCache starting on port %d using %s model\n", port, use_uring ? "io_uring" : "eventloop");
+
+    if (use_uring && config.reactors > 1) {
+        fprintf(stderr, "warning: the io_uring model runs a single loop, ignoring reactors %d\n", config.reactors);
+    } else if (config.reactors > 1) {
+        if (config.io_threads > 1) {
+            fprintf(stderr, "warning: io-threads only works with a single reactor, ignoring it\n");
+        }
+        run_reactors(port);
+        printf("Server shutdown complete\n");
         return;
     }
 
+    // Basic server setup (socket, bind, listen)
+    server_sock = create_listener(port, 0);
+    if (server_sock == -1) {
+        return;
+    }
+
+    if (use_uring) {
+        if (config.io_threads > 1) {
+            fprintf(stderr, "warning: the io_uring model does its own io, ignoring io-threads\n");
+        }
+        if (uring_loop_run(server_sock)) {
+            close(server_sock);
+            printf("Server shutdown complete\n");
+            return;
+        }
+        fprintf(stderr, "warning: io_uring is not available, falling back to epoll\n");
+    }
+
     // Initialize and run the event loop
     if (event_loop_init(&loop) != 0) {
         fprintf(stderr, "Failed to initialize event loop\n");
@@ -413,10 +493,25 @@ void run_eventloop_server(int port) {
         return;
     }
 
+    // the loop itself is the first io thread
+    if (config.io_threads > 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus > 0 && config.io_threads > cpus) {
+            fprintf(stderr, "warning: io-threads %d on %ld cpus, the threads will compete for them\n",
+                    config.io_threads, cpus);
+        }
+        if (io_threads_start(config.io_threads)) {
+            printf("using %d io threads\n", config.io_threads);
+        } else {
+            fprintf(stderr, "warning: could not start io threads, the event loop does its own io\n");
+        }
+    }
+
     // The background threads are still managed by main
     event_loop_run(&loop, server_sock);
 
     // Cleanup
+    io_threads_stop();
     event_loop_cleanup(&loop);
     close(server_sock);
     printf("Server shutdown complete\n");
@@ -460,17 +555,30 @@ int main(int argc, char *argv[]) {
     // initialize server database
 
 
-    server_db = dict_create(1024);
+    // every reactor owns at least one shard
+    int shards = config.keyspace_shards;
+    if (config.concurrency_model == CONCURRENCY_EVENTLOOP && shards < config.reactors) {
+        shards = config.reactors;
+    }
+    server_db = keyspace_create(shards, 1024);
     if (!server_db) {
         fprintf(stderr, "failed to create server database\n");
         return EXIT_FAILURE;
     }
+    keyspace_set_max_memory(server_db, config.maxmemory);
+    for (int i = 0; i < server_db->nshards; i++) {
+        dict *d = server_db->shards[i].d;
+        d->eviction_policy = config.maxmemory_policy;
+        d->eviction_samples = config.maxmemory_samples;
+        d->lfu_log_factor = config.lfu_log_factor;
+        d->lfu_decay_time = config.lfu_decay_time;
+    }
     
-    // allocate client list based on configured max_clients
-    client_list = (client_t **)calloc(config.max_clients, sizeof(client_t *));
-    if (!client_list) {
-        fprintf(stderr, "failed to allocate client list\n");
-        dict_free(server_db);
+    // size the client table for max_clients up front, the listening
+    // sockets and files take a few fds below the clients
+    if (!client_table_reserve(config.max_clients + 16)) {
+        fprintf(stderr, "failed to allocate client table\n");
+        keyspace_free(server_db);
         return EXIT_FAILURE;
     }
     
@@ -478,12 +586,32 @@ int main(int argc, char *argv[]) {
     server_persistence.changes_since_save = 0;
     server_persistence.last_save = time(NULL);
     
+    // build the command lookup table
+    commands_init();
+
     // initialize replication
     replication_init();
     
-    // load data from rdb file if it exists
-    if (!load_rdb_from_file(server_db, "dump.rdb")) {
-        fprintf(stderr, "warning: could not load rdb file, starting with empty db\n");
+    // the append-only file has every write since it was started, it is
+    // loaded instead of the rdb file when there is one
+    if (config.appendonly && access(config.aof_filename, F_OK) == 0) {
+        if (!aof_load(server_db, config.aof_filename)) {
+            // starting empty would log new writes after the ones not loaded
+            fprintf(stderr, "fatal: could not load %s, repair or move it away\n", config.aof_filename);
+            keyspace_free(server_db);
+            return EXIT_FAILURE;
+        }
+    } else if (!load_rdb_from_file(server_db, "dump.rdb")) {
+        // a missing file loads as empty. starting empty over one that is
+        // there would have the next save or aof base replace its data
+        fprintf(stderr, "fatal: could not load dump.rdb, repair or move it away\n");
+        keyspace_free(server_db);
+        return EXIT_FAILURE;
+    }
+    if (config.appendonly && !aof_start(server_db, config.aof_filename)) {
+        fprintf(stderr, "fatal: could not open the append-only file\n");
+        keyspace_free(server_db);
+        return EXIT_FAILURE;
     }
     
     // initialize pub/sub
@@ -506,10 +634,13 @@ int main(int argc, char *argv[]) {
     pthread_join(cleanup_thread, NULL);
     pthread_join(autosave_thread, NULL);
     pthread_join(repl_thread, NULL);
+
+    // whatever was logged last goes to disk before exiting
+    aof_stop();
     
     // clean up
-    dict_free(server_db);
-    free(client_list);
+    keyspace_free(server_db);
+    free(client_table);
     replication_cleanup();
     pubsub_cleanup();
     
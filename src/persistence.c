@@ -1,10 +1,16 @@
 #define _POSIX_C_SOURCE 200809L
 #include "persistence.h"
+#include "config.h"
+#include "crc64.h"
+#include "lz4.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/wait.h>
@@ -17,17 +23,6 @@ static uint64_t current_time_ms() {
     return (uint64_t)(tv.tv_sec) * 1000 + (tv.tv_usec / 1000);
 }
 
-// save a length-prefixed string
-int rdb_save_string(FILE *fp, const char *str, size_t len) {
-    if (fwrite(&len, sizeof(size_t), 1, fp) != 1) {
-        return 0;
-    }
-    if (len > 0 && fwrite(str, len, 1, fp) != 1) {
-        return 0;
-    }
-    return 1;
-}
-
 // load a length-prefixed string
 int rdb_load_string(FILE *fp, char **str, size_t *len) {
     if (fread(len, sizeof(size_t), 1, fp) != 1) {
@@ -46,85 +41,213 @@ int rdb_load_string(FILE *fp, char **str, size_t *len) {
     return 1;
 }
 
-// save the entire database to a file
-int save_rdb_to_file(dict *db, const char *filename) {
+#define RDB_IO_BUFFER (64 * 1024)
+
+// output buffered in memory, checksummed as it goes out
+typedef struct rdb_writer {
     FILE *fp;
+    uint64_t crc;           // of everything flushed
+    uint64_t flushed;       // bytes flushed
+    int ok;                 // no write failed
+    size_t len;             // bytes in buf
+    char *scratch;          // room for a compressed value
+    size_t scratch_cap;
+    char buf[RDB_IO_BUFFER];
+} rdb_writer;
+
+static void out_flush(rdb_writer *w) {
+    if (w->len > 0 && w->ok) {
+        w->crc = crc64(w->crc, w->buf, w->len);
+        if (fwrite(w->buf, w->len, 1, w->fp) != 1) w->ok = 0;
+    }
+    w->flushed += w->len;
+    w->len = 0;
+}
+
+// file offset of the next byte written
+static uint64_t out_offset(const rdb_writer *w) {
+    return w->flushed + w->len;
+}
+
+static void out_bytes(rdb_writer *w, const void *data, size_t len) {
+    if (w->len + len > RDB_IO_BUFFER) {
+        out_flush(w);
+        if (len >= RDB_IO_BUFFER) {
+            // large values go straight out
+            if (w->ok) {
+                w->crc = crc64(w->crc, data, len);
+                if (fwrite(data, len, 1, w->fp) != 1) w->ok = 0;
+            }
+            w->flushed += len;
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+static void out_byte(rdb_writer *w, unsigned char b) {
+    if (w->len == RDB_IO_BUFFER) out_flush(w);
+    w->buf[w->len++] = b;
+}
+
+static void out_varint(rdb_writer *w, uint64_t v) {
+    unsigned char bytes[10];
+    int n = 0;
+    while (v >= 0x80) {
+        bytes[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    bytes[n++] = v;
+    out_bytes(w, bytes, n);
+}
+
+static void out_u64(rdb_writer *w, uint64_t v) {
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++) bytes[i] = v >> (8 * i);
+    out_bytes(w, bytes, 8);
+}
+
+static void out_string(rdb_writer *w, const char *str, size_t len) {
+    out_varint(w, len);
+    out_bytes(w, str, len);
+}
+
+// compress a value into w->scratch. returns its compressed length, or 0
+// if it is better stored as is
+static size_t compress_value(rdb_writer *w, const char *str, size_t len) {
+    if (!config.rdb_compression || len < RDB_COMPRESS_MIN) return 0;
+    if (w->scratch_cap < len) {
+        char *grown = realloc(w->scratch, len);
+        if (!grown) return 0;
+        w->scratch = grown;
+        w->scratch_cap = len;
+    }
+    // worth it only if it pays for the length in front of it
+    return lz4_compress(str, len, w->scratch, len - 8);
+}
+
+// write the live entries of one dict
+static void write_rdb_entries(rdb_writer *w, dict *d, uint64_t now) {
+    dict_iterator it;
+    dict_entry *entry;
+
+    dict_iter_init(&it, d);
+    while (w->ok && (entry = dict_iter_next(&it)) != NULL) {
+        // skip expired keys
+        if (entry->val.expire != 0 && entry->val.expire < now) {
+            continue;
+        }
+        // add other data types here as we implement them
+        if (entry->val.type != CC_STRING && entry->val.type != CC_INT) {
+            continue;
+        }
+
+        if (entry->val.expire != 0) {
+            out_byte(w, RDB_OPCODE_EXPIRE_MS);
+            out_u64(w, entry->val.expire);
+        }
+
+        const char *key = entry->key;
+        size_t key_len = strlen(key);
+        if (entry->val.encoding == CC_ENC_INT) {
+            // zigzag keeps small negative numbers short too
+            uint64_t v = (uint64_t)entry->val.ival;
+            out_byte(w, RDB_TYPE_INT);
+            out_string(w, key, key_len);
+            out_varint(w, (v << 1) ^ (entry->val.ival < 0 ? ~(uint64_t)0 : 0));
+        } else {
+            char buf[CC_INT_STR_SIZE];
+            size_t len;
+            const char *str = cc_obj_str(&entry->val, buf, &len);
+            size_t compressed = compress_value(w, str, len);
+            out_byte(w, compressed ? RDB_TYPE_STRING_LZ4 : RDB_TYPE_STRING);
+            out_string(w, key, key_len);
+            if (compressed) {
+                out_varint(w, len);
+                out_string(w, w->scratch, compressed);
+            } else {
+                out_string(w, str, len);
+            }
+        }
+    }
+    dict_iter_release(&it);
+}
+
+// save every shard to filename. with lock set each shard is read-locked
+// while it is written; the child of background_save runs without them, its
+// parent holds all the locks across the fork
+static int write_rdb(keyspace *db, const char *filename, int lock) {
     char temp_filename[256];
     int result = 0;
     
     // create a temporary file first
     snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
     
-    fp = fopen(temp_filename, "wb");
-    if (!fp) {
+    rdb_writer *w = malloc(sizeof(rdb_writer));
+    uint64_t *sections = malloc(db->nshards * sizeof(uint64_t));
+    if (!w || !sections) {
+        free(w);
+        free(sections);
+        return 0;
+    }
+    w->fp = fopen(temp_filename, "wb");
+    if (!w->fp) {
         fprintf(stderr, "error: could not open %s for writing\n", temp_filename);
+        free(w);
+        free(sections);
         return 0;
     }
+    w->crc = 0;
+    w->flushed = 0;
+    w->ok = 1;
+    w->len = 0;
+    w->scratch = NULL;
+    w->scratch_cap = 0;
     
     // write header
-    if (fwrite(RDB_MAGIC, 4, 1, fp) != 1) goto cleanup;
-    int version = RDB_VERSION;
-    if (fwrite(&version, sizeof(int), 1, fp) != 1) goto cleanup;
-    
-    // write entries count
-    if (fwrite(&db->used, sizeof(size_t), 1, fp) != 1) goto cleanup;
+    out_bytes(w, RDB_MAGIC, 4);
+    unsigned char version[4] = {RDB_VERSION, 0, 0, 0};
+    out_bytes(w, version, 4);
+
+    // lets the loader size its tables up front. other shards may still
+    // change while one is saved, so it is only about right
+    size_t keys = 0;
+    for (int i = 0; i < db->nshards; i++) {
+        keys += __atomic_load_n(&db->shards[i].d->used, __ATOMIC_RELAXED);
+    }
+    out_byte(w, RDB_OPCODE_RESIZE);
+    out_varint(w, keys);
     
     // get current time
     uint64_t now = current_time_ms();
     
-    // iterate through all entries
-    for (size_t i = 0; i < db->size; i++) {
-        dict_entry *entry = db->table[i];
-        while (entry) {
-            // skip expired keys
-            if (entry->val->expire != 0 && entry->val->expire < now) {
-                entry = entry->next;
-                continue;
-            }
-            
-            // save key
-            size_t key_len = strlen(entry->key);
-            if (!rdb_save_string(fp, entry->key, key_len)) goto cleanup;
-            
-            // save value type
-            if (fwrite(&entry->val->type, sizeof(cc_type), 1, fp) != 1) goto cleanup;
-            
-            // save expiry (if any)
-            uint8_t has_expiry = entry->val->expire != 0;
-            if (fwrite(&has_expiry, sizeof(uint8_t), 1, fp) != 1) goto cleanup;
-            
-            if (has_expiry) {
-                if (fwrite(&entry->val->expire, sizeof(uint64_t), 1, fp) != 1) goto cleanup;
-            }
-            
-            // save value based on type
-            switch (entry->val->type) {
-                case CC_STRING: {
-                    uint8_t cmd = RDB_SET;
-                    if (fwrite(&cmd, sizeof(uint8_t), 1, fp) != 1) goto cleanup;
-                    
-                    // save string value
-                    size_t str_len = strlen((char*)entry->val->ptr);
-                    if (!rdb_save_string(fp, (char*)entry->val->ptr, str_len)) goto cleanup;
-                    break;
-                }
-                // add other data types here as we implement them
-                default:
-                    break;
-            }
-            
-            entry = entry->next;
-        }
+    // one shard at a time, so writers only wait for the shard being saved.
+    // each is a section of its own, for the loader to decode in parallel
+    for (int i = 0; i < db->nshards && w->ok; i++) {
+        sections[i] = out_offset(w);
+        if (lock) keyspace_lock_shard(db, i, 0);
+        write_rdb_entries(w, db->shards[i].d, now);
+        if (lock) keyspace_unlock_shard(db, i);
     }
+
+    uint64_t index = out_offset(w);
+    out_byte(w, RDB_OPCODE_SECTIONS);
+    out_varint(w, db->nshards);
+    for (int i = 0; i < db->nshards; i++) out_u64(w, sections[i]);
+    out_u64(w, index);
     
-    // write end marker
-    uint8_t end_marker = RDB_END;
-    if (fwrite(&end_marker, sizeof(uint8_t), 1, fp) != 1) goto cleanup;
-    
-    result = 1;
+    // write end marker, then the checksum of everything up to it
+    out_byte(w, RDB_END);
+    out_flush(w);
+    unsigned char crc[8];
+    for (int i = 0; i < 8; i++) crc[i] = w->crc >> (8 * i);
+    if (w->ok && fwrite(crc, 8, 1, w->fp) == 1) result = 1;
     
-cleanup:
-    fclose(fp);
+    if (fclose(w->fp) != 0) result = 0;
+    free(w->scratch);
+    free(w);
+    free(sections);
     
     if (result) {
         // rename temp file to actual file only if save was successful
@@ -140,81 +263,69 @@ cleanup:
     return result;
 }
 
-// load database from file
-int load_rdb_from_file(dict *db, const char *filename) {
-    FILE *fp;
-    char magic[5] = {0};
-    int version;
-    int result = 0;
-    
-    fp = fopen(filename, "rb");
-    if (!fp) {
-        // it's not an error if the file doesn't exist yet
-        if (errno == ENOENT) {
-            return 1;
-        }
-        fprintf(stderr, "error: could not open %s for reading\n", filename);
-        return 0;
-    }
-    
-    // read and verify header
-    if (fread(magic, 4, 1, fp) != 1 || memcmp(magic, RDB_MAGIC, 4) != 0) {
-        fprintf(stderr, "error: invalid rdb file format\n");
-        goto cleanup;
-    }
-    
-    if (fread(&version, sizeof(int), 1, fp) != 1 || version != RDB_VERSION) {
-        fprintf(stderr, "error: unsupported rdb version: %d\n", version);
-        goto cleanup;
-    }
-    
+// save the entire database to a file
+int save_rdb_to_file(keyspace *db, const char *filename) {
+    return write_rdb(db, filename, 1);
+}
+
+// the records of a version 1 file, after its header
+static int load_rdb_v1(keyspace *db, FILE *fp) {
     // read entries count
     size_t entries_count;
     if (fread(&entries_count, sizeof(size_t), 1, fp) != 1) {
         fprintf(stderr, "error: could not read entries count\n");
-        goto cleanup;
+        return 0;
+    }
+
+    // size the tables up front. an entry takes 22 bytes at least, a
+    // corrupt count can't size them for more keys than that
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0) {
+        size_t most = (size_t)st.st_size / 22;
+        keyspace_reserve(db, entries_count < most ? entries_count : most);
     }
+    uint64_t now = current_time_ms();
     
     // read all entries
     for (size_t i = 0; i < entries_count; i++) {
         // read key
         char *key;
         size_t key_len;
-        if (!rdb_load_string(fp, &key, &key_len)) goto cleanup;
+        if (!rdb_load_string(fp, &key, &key_len)) return 0;
         
         // read value type
         cc_type type;
         if (fread(&type, sizeof(cc_type), 1, fp) != 1) {
             free(key);
-            goto cleanup;
+            return 0;
         }
         
         // read expiry (if any)
         uint8_t has_expiry;
         if (fread(&has_expiry, sizeof(uint8_t), 1, fp) != 1) {
             free(key);
-            goto cleanup;
+            return 0;
         }
         
         uint64_t expire = 0;
         if (has_expiry) {
             if (fread(&expire, sizeof(uint64_t), 1, fp) != 1) {
                 free(key);
-                goto cleanup;
+                return 0;
             }
             
             // skip expired keys
-            if (expire < current_time_ms()) {
+            if (expire < now) {
                 free(key);
                 
                 // skip the value data
                 uint8_t cmd;
-                if (fread(&cmd, sizeof(uint8_t), 1, fp) != 1) goto cleanup;
+                if (fread(&cmd, sizeof(uint8_t), 1, fp) != 1) return 0;
                 
                 if (cmd == RDB_SET) {
                     char *val;
                     size_t val_len;
-                    if (!rdb_load_string(fp, &val, &val_len)) goto cleanup;
+                    if (!rdb_load_string(fp, &val, &val_len)) return 0;
                     free(val);
                 }
                 
@@ -226,7 +337,7 @@ int load_rdb_from_file(dict *db, const char *filename) {
         uint8_t cmd;
         if (fread(&cmd, sizeof(uint8_t), 1, fp) != 1) {
             free(key);
-            goto cleanup;
+            return 0;
         }
         
         switch (cmd) {
@@ -236,39 +347,26 @@ int load_rdb_from_file(dict *db, const char *filename) {
                 size_t val_len;
                 if (!rdb_load_string(fp, &val, &val_len)) {
                     free(key);
-                    goto cleanup;
-                }
-                
-                // create string object
-                cc_obj *obj = malloc(sizeof(cc_obj));
-                if (!obj) {
-                    free(key);
-                    free(val);
-                    goto cleanup;
+                    return 0;
                 }
                 
-                obj->ptr = val;
-                obj->type = CC_STRING;
-                obj->expire = expire;
-                obj->size = val_len + 1;
-                obj->last_access = current_time_ms();
-                
-                // add to dictionary
-                if (!dict_add(db, key, obj)) {
+                // add to its shard. loading happens at startup, before any
+                // other thread touches the keyspace
+                if (!dict_set(keyspace_dict(db, key), key, val, val_len, expire)) {
                     free(key);
                     free(val);
-                    free(obj);
-                    goto cleanup;
+                    return 0;
                 }
                 
-                free(key); // dict_add makes a copy
+                free(key); // dict_set makes a copy
+                free(val);
                 break;
             }
             // add other data types here as we implement them
             default:
                 free(key);
                 fprintf(stderr, "error: unknown command in rdb file: %d\n", cmd);
-                goto cleanup;
+                return 0;
         }
     }
     
@@ -276,19 +374,359 @@ int load_rdb_from_file(dict *db, const char *filename) {
     uint8_t end_marker;
     if (fread(&end_marker, sizeof(uint8_t), 1, fp) != 1 || end_marker != RDB_END) {
         fprintf(stderr, "error: missing end marker in rdb file\n");
+        return 0;
+    }
+    
+    return 1;
+}
+
+// a growable buffer, reused from entry to entry
+typedef struct rdb_buffer {
+    char *data;
+    size_t cap;
+} rdb_buffer;
+
+static int buffer_reserve(rdb_buffer *b, size_t len) {
+    if (len <= b->cap) return 1;
+    size_t cap = b->cap ? b->cap : 64;
+    while (cap < len) cap *= 2;
+    char *grown = realloc(b->data, cap);
+    if (!grown) return 0;
+    b->data = grown;
+    b->cap = cap;
+    return 1;
+}
+
+// version 2 files are decoded straight from a read-only mapping
+typedef struct rdb_cursor {
+    const unsigned char *p;
+    const unsigned char *end;
+} rdb_cursor;
+
+static uint64_t get_u64le(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static int get_varint(rdb_cursor *c, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64 && c->p < c->end; shift += 7) {
+        unsigned char b = *c->p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return 1;
+    }
+    return 0; // truncated, or longer than 64 bits
+}
+
+static int get_u64(rdb_cursor *c, uint64_t *v) {
+    if (c->end - c->p < 8) return 0;
+    *v = get_u64le(c->p);
+    c->p += 8;
+    return 1;
+}
+
+// a length and that many bytes, left where they are in the mapping
+static int get_string(rdb_cursor *c, const char **str, size_t *len) {
+    uint64_t n;
+    if (!get_varint(c, &n) || n > (uint64_t)(c->end - c->p)) return 0;
+    *str = (const char *)c->p;
+    *len = n;
+    c->p += n;
+    return 1;
+}
+
+#define RDB_LOAD_MAX_THREADS 64
+
+// a mapped version 2 file, shared by the threads loading it
+typedef struct rdb_load {
+    keyspace *db;
+    const unsigned char *map;
+    size_t size;
+    uint64_t now;           // keys expired by then are skipped
+    uint64_t *bounds;       // section i is bounds[i] up to bounds[i + 1]
+    int sections;
+    int next_section;       // the next one for a thread to take
+    int failed;
+} rdb_load;
+
+// what one loading thread keeps from record to record
+typedef struct rdb_decoder {
+    pthread_t thread;
+    rdb_load *load;
+    rdb_buffer key;         // NUL-terminated copy of the key
+    rdb_buffer val;         // decompressed value
+    int locked;             // shard whose write lock is held, -1 for none
+} rdb_decoder;
+
+// decode records from c->p up to c->end or RDB_END into the keyspace.
+// a key is added under its shard's write lock, which is kept while the
+// keys that follow are in the same shard. a section holds the keys of one
+// shard, so a thread locks once per section and never waits for another
+static int decode_records(rdb_decoder *dec, rdb_cursor *c) {
+    keyspace *db = dec->load->db;
+    uint64_t expire = 0;    // of the next key
+    while (c->p < c->end && *c->p != RDB_END) {
+        unsigned char type = *c->p++;
+        const char *key, *str = NULL;
+        size_t key_len, len = 0;
+        uint64_t n;
+        switch (type) {
+            case RDB_OPCODE_RESIZE:
+                if (!get_varint(c, &n)) goto truncated;
+                continue;
+            case RDB_OPCODE_EXPIRE_MS:
+                if (!get_u64(c, &expire)) goto truncated;
+                continue;
+            case RDB_OPCODE_SECTIONS:
+                // the index, of no use when reading in order
+                if (!get_varint(c, &n) || n >= (uint64_t)(c->end - c->p) / 8) goto truncated;
+                c->p += n * 8 + 8;
+                continue;
+            case RDB_TYPE_STRING:
+            case RDB_TYPE_INT:
+            case RDB_TYPE_STRING_LZ4:
+                break;
+            default:
+                fprintf(stderr, "error: unknown record in rdb file: %d\n", type);
+                return 0;
+        }
+
+        if (!get_string(c, &key, &key_len)) goto truncated;
+        if (!buffer_reserve(&dec->key, key_len + 1)) return 0;
+        memcpy(dec->key.data, key, key_len);
+        dec->key.data[key_len] = '\0';
+
+        long long ival = 0;
+        if (type == RDB_TYPE_INT) {
+            if (!get_varint(c, &n)) goto truncated;
+            ival = (long long)(n >> 1) ^ -(long long)(n & 1);
+        } else if (type == RDB_TYPE_STRING) {
+            if (!get_string(c, &str, &len)) goto truncated;
+        } else {
+            const char *packed;
+            size_t packed_len;
+            if (!get_varint(c, &n) || !get_string(c, &packed, &packed_len)) goto truncated;
+            // an lz4 block expands at most 255 times
+            if (n / 255 > packed_len || !buffer_reserve(&dec->val, n + 1) ||
+                !lz4_decompress(packed, packed_len, dec->val.data, n)) {
+                fprintf(stderr, "error: corrupt compressed value in rdb file\n");
+                return 0;
+            }
+            str = dec->val.data;
+            len = n;
+        }
+
+        // skip expired keys
+        if (expire == 0 || expire >= dec->load->now) {
+            int shard = keyspace_shard_index(db, dec->key.data);
+            if (shard != dec->locked) {
+                if (dec->locked >= 0) keyspace_unlock_shard(db, dec->locked);
+                keyspace_lock_shard(db, shard, 1);
+                dec->locked = shard;
+            }
+            dict *d = db->shards[shard].d;
+            cc_obj *obj = type == RDB_TYPE_INT ? dict_set_int(d, dec->key.data, ival, expire)
+                                               : dict_set(d, dec->key.data, str, len, expire);
+            if (!obj) return 0;
+        }
+        expire = 0;
+    }
+    return 1;
+
+truncated:
+    fprintf(stderr, "error: rdb file is truncated\n");
+    return 0;
+}
+
+// take sections until there are none left
+static void *load_sections(void *arg) {
+    rdb_decoder *dec = arg;
+    rdb_load *load = dec->load;
+    while (!__atomic_load_n(&load->failed, __ATOMIC_RELAXED)) {
+        int i = __atomic_fetch_add(&load->next_section, 1, __ATOMIC_RELAXED);
+        if (i >= load->sections) break;
+
+        // a section holds whole records and nothing else
+        rdb_cursor c = {load->map + load->bounds[i], load->map + load->bounds[i + 1]};
+        int ok = decode_records(dec, &c);
+        if (ok && c.p != c.end) {
+            fprintf(stderr, "error: corrupt section in rdb file\n");
+            ok = 0;
+        }
+        if (!ok) __atomic_store_n(&load->failed, 1, __ATOMIC_RELAXED);
+    }
+    if (dec->locked >= 0) keyspace_unlock_shard(load->db, dec->locked);
+    dec->locked = -1;
+    return NULL;
+}
+
+// find the section index of a file whose records start at offset records.
+// returns the number of sections, 0 if the file has none (it was written
+// before there were sections) and should be read in order
+static int read_sections(rdb_load *load, size_t records) {
+    if (load->size < records + RDB_SECTIONS_FOOTER) return 0;
+    size_t footer = load->size - RDB_SECTIONS_FOOTER;
+    uint64_t index = get_u64le(load->map + footer);
+    if (index < records || index >= footer || load->map[index] != RDB_OPCODE_SECTIONS) return 0;
+
+    rdb_cursor c = {load->map + index + 1, load->map + footer};
+    uint64_t count;
+    if (!get_varint(&c, &count) || count == 0 || count > KEYSPACE_MAX_SHARDS ||
+        count * 8 != (uint64_t)(c.end - c.p)) {
+        return 0;
+    }
+    load->bounds = malloc((count + 1) * sizeof(uint64_t));
+    if (!load->bounds) return 0;
+    load->bounds[count] = index;
+    for (uint64_t i = count; i-- > 0; ) {
+        load->bounds[i] = get_u64le(c.p + i * 8);
+        if (load->bounds[i] < records || load->bounds[i] > load->bounds[i + 1]) {
+            free(load->bounds);
+            load->bounds = NULL;
+            return 0;
+        }
+    }
+    return (int)count;
+}
+
+// the records of a version 2 file. the file is mapped and decoded from
+// memory; the tables are sized up front from the RDB_OPCODE_RESIZE hint,
+// and the sections are decoded by several threads once the checksum of
+// the whole file has been verified
+static int load_rdb_v2(keyspace *db, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 8 + 1 + 8) {
+        fprintf(stderr, "error: rdb file is truncated\n");
+        return 0;
+    }
+    rdb_load load = {.db = db, .size = st.st_size, .now = current_time_ms()};
+    void *map = mmap(NULL, load.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "error: could not map rdb file: %s\n", strerror(errno));
+        return 0;
+    }
+    load.map = map;
+    posix_madvise(map, load.size, POSIX_MADV_SEQUENTIAL);
+
+    int result = 0;
+    const unsigned char *end = load.map + load.size - 8 - 1;   // the end marker
+    if (*end != RDB_END) {
+        fprintf(stderr, "error: missing end marker in rdb file\n");
+        goto cleanup;
+    }
+    // nothing is decoded from a file that fails its checksum
+    if (crc64(0, load.map, load.size - 8) != get_u64le(load.map + load.size - 8)) {
+        fprintf(stderr, "error: rdb file checksum mismatch\n");
         goto cleanup;
     }
+
+    // a record takes 3 bytes at least, a corrupt hint can't size the
+    // tables for more keys than that
+    rdb_cursor c = {load.map + 8, end};
+    if (c.p < c.end && *c.p == RDB_OPCODE_RESIZE) {
+        rdb_cursor hint = {c.p + 1, c.end};
+        uint64_t keys;
+        if (get_varint(&hint, &keys)) keyspace_reserve(db, keys < load.size / 3 ? keys : load.size / 3);
+    }
+    load.sections = read_sections(&load, c.p - load.map);
+    if (load.sections > 0) c.end = load.map + load.bounds[0];
+
+    int threads = config.rdb_load_threads;
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > load.sections) threads = load.sections;
+    if (threads > RDB_LOAD_MAX_THREADS) threads = RDB_LOAD_MAX_THREADS;
+    if (threads < 1) threads = 1;
+    rdb_decoder decoders[RDB_LOAD_MAX_THREADS];
+    int started = 1;
+    for (int i = 0; i < threads; i++) {
+        decoders[i] = (rdb_decoder){.load = &load, .locked = -1};
+    }
+    for (; started < threads; started++) {
+        if (pthread_create(&decoders[started].thread, NULL, load_sections, &decoders[started]) != 0) {
+            break;  // this thread takes the rest
+        }
+    }
+
+    // the records ahead of the first section, all of them without sections
+    int ok = decode_records(&decoders[0], &c);
+    if (ok && c.p != c.end) {
+        fprintf(stderr, "error: corrupt rdb file\n");
+        ok = 0;
+    }
+    if (!ok) __atomic_store_n(&load.failed, 1, __ATOMIC_RELAXED);
+    load_sections(&decoders[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(decoders[i].thread, NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        free(decoders[i].key.data);
+        free(decoders[i].val.data);
+    }
+    result = ok && !load.failed;
+
+cleanup:
+    free(load.bounds);
+    munmap(map, load.size);
+    return result;
+}
+
+// load database from file
+int load_rdb_from_file(keyspace *db, const char *filename) {
+    FILE *fp;
+    char header[8];
+    int result = 0;
     
-    result = 1;
+    fp = fopen(filename, "rb");
+    if (!fp) {
+        // it's not an error if the file doesn't exist yet
+        if (errno == ENOENT) {
+            return 1;
+        }
+        fprintf(stderr, "error: could not open %s for reading\n", filename);
+        return 0;
+    }
+    
+    // read and verify header. version 1 wrote the version as a host int,
+    // little-endian on every machine it ran on
+    if (fread(header, 8, 1, fp) != 1 || memcmp(header, RDB_MAGIC, 4) != 0) {
+        fprintf(stderr, "error: invalid rdb file format\n");
+        goto cleanup;
+    }
+    
+    const unsigned char *v = (const unsigned char *)header + 4;
+    uint32_t version = v[0] | v[1] << 8 | v[2] << 16 | (uint32_t)v[3] << 24;
+    if (version == 1) {
+        result = load_rdb_v1(db, fp);
+    } else if (version == RDB_VERSION) {
+        result = load_rdb_v2(db, fileno(fp));
+    } else {
+        fprintf(stderr, "error: unsupported rdb version: %u\n", version);
+    }
     
 cleanup:
     fclose(fp);
+    // keys are added as they are read, so a file found corrupt part way
+    // (or only by its checksum) leaves nothing of it behind
+    if (!result) keyspace_empty(db);
     return result;
 }
 
 // fork a child process to save the database in the background
-int background_save(dict *db, const char *filename) {
+int background_save(keyspace *db, const char *filename) {
+    // no write may be half done when the child's copy of memory is taken
+    for (int i = 0; i < db->nshards; i++) {
+        keyspace_lock_shard(db, i, 0);
+    }
     pid_t child_pid = fork();
+    if (child_pid != 0) {
+        for (int i = 0; i < db->nshards; i++) {
+            keyspace_unlock_shard(db, i);
+        }
+    }
     
     if (child_pid == -1) {
         // fork failed
@@ -296,7 +734,7 @@ int background_save(dict *db, const char *filename) {
         return 0;
     } else if (child_pid == 0) {
         // child process
-        if (!save_rdb_to_file(db, filename)) {
+        if (!write_rdb(db, filename, 0)) {
             fprintf(stderr, "background save failed\n");
             exit(1);
         }
@@ -2,23 +2,48 @@
 #define PERSISTENCE_H
 
 #include <stdio.h>  // Required for FILE type
-#include "dict.h"
+#include "keyspace.h"
 
 // rdb file header constants
 #define RDB_MAGIC "CCDB"  // crimsoncache database 
-#define RDB_VERSION 1
+#define RDB_VERSION 2
 
-// commands related to persistence
+// version 2 files are portable: "CCDB", the version as 4 little-endian
+// bytes, then records each starting with one of the bytes below, then
+// RDB_END and the crc64 (see crc64.h) of everything before it as 8
+// little-endian bytes. lengths are varints (7 bits per byte, low bits
+// first, the high bit set on every byte but the last) and keys and values
+// are a length followed by their bytes
+#define RDB_TYPE_STRING 0        // key, value
+#define RDB_TYPE_INT 1           // key, the integer as a zigzag varint
+#define RDB_TYPE_STRING_LZ4 2    // key, length, compressed length, lz4 block (see lz4.h)
+#define RDB_OPCODE_SECTIONS 250  // section index, see below
+#define RDB_OPCODE_RESIZE 251    // about how many keys follow, a varint to size tables with
+#define RDB_OPCODE_EXPIRE_MS 252 // expire of the next key, unix time in ms as 8 little-endian bytes
+#define RDB_END 255              // end of file marker
+
+// the records are written in sections, one per shard, which can be
+// decoded independently. the last record before RDB_END is their index:
+// the count as a varint, the file offset of each section as 8
+// little-endian bytes, then the offset of the index record itself, so it
+// is found 17 bytes from the end of the file. each section ends where the
+// next one (or the index) starts. files without it are read in order
+#define RDB_SECTIONS_FOOTER 17
+
+// version 1 files, which are still loaded, have host-sized fields: a
+// size_t entries count, then per entry the key, a cc_type, an expiry flag
+// and expire, RDB_SET and the value, with size_t lengths
 #define RDB_SET 1   // string data 
-#define RDB_END 255 // end of file marker
+
+// values at least this long are compressed if it saves space
+#define RDB_COMPRESS_MIN 20
 
 // function prototypes
-int save_rdb_to_file(dict *db, const char *filename);
-int load_rdb_from_file(dict *db, const char *filename);
-int background_save(dict *db, const char *filename);
+int save_rdb_to_file(keyspace *db, const char *filename);
+int load_rdb_from_file(keyspace *db, const char *filename);
+int background_save(keyspace *db, const char *filename);
 
 // helper functions
-int rdb_save_string(FILE *fp, const char *str, size_t len);
 int rdb_load_string(FILE *fp, char **str, size_t *len);
 
 #endif /* PERSISTENCE_H */
\ No newline at end of file
@@ -1,10 +1,10 @@
 #define _POSIX_C_SOURCE 200809L
 #include "pubsub.h"
 #include "commands.h" // for reply functions
+#include "reply.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h> // for write
 
 pubsub_state_t server_pubsub;
 
@@ -66,6 +66,8 @@ static int subscribe_to_channel(client_t *client, const char *channel_name) {
     new_node->client = client;
     new_node->next = channel->subscribers;
     channel->subscribers = new_node;
+    // read by the output buffer limit check, which doesn't hold this lock
+    __atomic_add_fetch(&client->subscriptions, 1, __ATOMIC_RELAXED);
 
     pthread_mutex_unlock(&server_pubsub.mutex);
     return 1;
@@ -87,6 +89,7 @@ static int unsubscribe_from_channel(client_t *client, const char *channel_name)
                         channel->subscribers = curr->next;
                     }
                     free(curr);
+                    __atomic_sub_fetch(&client->subscriptions, 1, __ATOMIC_RELAXED);
                     pthread_mutex_unlock(&server_pubsub.mutex);
                     return 1; // successfully unsubscribed
                 }
@@ -115,7 +118,7 @@ int pubsub_subscribe_client(client_t *client, int argc, char **argv) {
             char resp[256];
             snprintf(resp, sizeof(resp), "*3\r\n$9\r\nsubscribe\r\n$%zu\r\n%s\r\n:%d\r\n",
                      strlen(argv[i]), argv[i], success_count); // this count is per-client, not global
-            write(client->socket, resp, strlen(resp));
+            client_add_reply(client, resp, strlen(resp));
         } else {
             reply_error(client->socket, "err failed to subscribe to channel");
             // potentially stop or report specific channel failure
@@ -141,12 +144,13 @@ int pubsub_unsubscribe_client(client_t *client, int argc, char **argv) {
                         channel->subscribers = curr->next;
                     }
                     free(curr);
+                    __atomic_sub_fetch(&client->subscriptions, 1, __ATOMIC_RELAXED);
                     success_count++;
                     // send confirmation for this channel
                     char resp[256];
                     snprintf(resp, sizeof(resp), "*3\r\n$11\r\nunsubscribe\r\n$%zu\r\n%s\r\n:%d\r\n",
                              strlen(channel->name), channel->name, 0); // count of remaining subscriptions for this client
-                    write(client->socket, resp, strlen(resp));
+                    client_add_reply(client, resp, strlen(resp));
                     break; // move to next channel
                 }
                 prev = curr;
@@ -158,7 +162,7 @@ int pubsub_unsubscribe_client(client_t *client, int argc, char **argv) {
         if (success_count == 0) { // if no channels were unsubscribed (was not subscribed to any)
              char resp[256];
              snprintf(resp, sizeof(resp), "*3\r\n$11\r\nunsubscribe\r\n$-1\r\n:0\r\n"); // nil channel, 0 subscriptions
-             write(client->socket, resp, strlen(resp));
+             client_add_reply(client, resp, strlen(resp));
         }
 
     } else { // unsubscribe from specific channels
@@ -168,16 +172,22 @@ int pubsub_unsubscribe_client(client_t *client, int argc, char **argv) {
                  char resp[256];
                  snprintf(resp, sizeof(resp), "*3\r\n$11\r\nunsubscribe\r\n$%zu\r\n%s\r\n:%d\r\n",
                          strlen(argv[i]), argv[i], 0); // count of remaining subscriptions for this client
-                 write(client->socket, resp, strlen(resp));
+                 client_add_reply(client, resp, strlen(resp));
             }
         }
     }
     return success_count;
 }
 
-// publish a message to a channel
-int pubsub_publish_message(const char *channel_name, const char *message) {
+// publish a message to a channel. each subscriber gets the message appended
+// to its output buffer, written right away unless it is the publisher
+int pubsub_publish_message(const char *channel_name, const char *message, size_t message_len) {
     int receivers = 0;
+    size_t channel_len = strlen(channel_name);
+    char small[1024];
+    char *resp = NULL;
+    size_t resp_len = 0;
+
     pthread_mutex_lock(&server_pubsub.mutex);
     pubsub_channel_t *channel = server_pubsub.channels;
     while (channel) {
@@ -185,11 +195,20 @@ int pubsub_publish_message(const char *channel_name, const char *message) {
             pubsub_client_node_t *node = channel->subscribers;
             while (node) {
                 if (node->client) {
-                    // format: "message", channel_name, message
-                    char resp[1024]; // ensure buffer is large enough
-                    snprintf(resp, sizeof(resp), "*3\r\n$7\r\nmessage\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n",
-                             strlen(channel_name), channel_name, strlen(message), message);
-                    write(node->client->socket, resp, strlen(resp));
+                    if (!resp) {
+                        // format: "message", channel_name, message. built once for all subscribers
+                        size_t size = channel_len + message_len + 64;
+                        resp = size <= sizeof(small) ? small : malloc(size);
+                        if (!resp) break;
+                        // the message may contain NULs, so it is copied in after the header
+                        resp_len = snprintf(resp, size, "*3\r\n$7\r\nmessage\r\n$%zu\r\n%s\r\n$%zu\r\n",
+                                            channel_len, channel_name, message_len);
+                        memcpy(resp + resp_len, message, message_len);
+                        resp_len += message_len;
+                        memcpy(resp + resp_len, "\r\n", 2);
+                        resp_len += 2;
+                    }
+                    client_add_reply(node->client, resp, resp_len);
                     receivers++;
                 }
                 node = node->next;
@@ -199,6 +218,8 @@ int pubsub_publish_message(const char *channel_name, const char *message) {
         channel = channel->next;
     }
     pthread_mutex_unlock(&server_pubsub.mutex);
+
+    if (resp != small) free(resp);
     return receivers;
 }
 
@@ -219,6 +240,7 @@ void pubsub_remove_client(client_t *client) {
                 pubsub_client_node_t *to_free = curr;
                 curr = curr->next; // advance before freeing
                 free(to_free);
+                __atomic_sub_fetch(&client->subscriptions, 1, __ATOMIC_RELAXED);
                 // do not break, client might be subscribed to multiple channels
                 // or rather, this loop is per channel, so we found the client in this channel
                 // and should continue to the next node in this channel's list
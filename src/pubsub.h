@@ -35,7 +35,7 @@ int pubsub_subscribe_client(client_t *client, int argc, char **argv);
 int pubsub_unsubscribe_client(client_t *client, int argc, char **argv);
 
 // publish a message to a channel
-int pubsub_publish_message(const char *channel_name, const char *message);
+int pubsub_publish_message(const char *channel_name, const char *message, size_t message_len);
 
 // remove a client from all subscriptions (e.g., on disconnect)
 void pubsub_remove_client(client_t *client);
@@ -2,6 +2,7 @@
 #include "replication.h"
 #include "persistence.h"
 #include "commands.h"
+#include "resp.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,7 +16,7 @@
 #include "crimsoncache.h"
 #include "config.h"
 
-extern dict *server_db; 
+extern keyspace *server_db;
 
 // get current time in milliseconds
 static uint64_t current_time_ms() {
@@ -45,6 +46,23 @@ void replication_init(void) {
     pthread_mutex_init(&server_repl.replicas_mutex, NULL);
 }
 
+// append argv as a RESP command to a growable buffer. binary safe, so
+// values reach the replica exactly as stored
+static int buffer_append_command(char **buf, size_t *len, size_t *cap,
+                                 int argc, char **argv, const size_t *argv_len) {
+    size_t n = resp_command_size(argc, argv_len);
+    if (*len + n > *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 4096;
+        while (new_cap < *len + n) new_cap *= 2;
+        char *new_buf = realloc(*buf, new_cap);
+        if (!new_buf) return 0;
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    *len = resp_encode_command(*buf + *len, argc, argv, argv_len) - *buf;
+    return 1;
+}
+
 void sync_replica(int fd) {
     printf("performing initial sync with replica...\n");
     
@@ -52,82 +70,75 @@ void sync_replica(int fd) {
     int total_keys = 0;
     int synced_keys = 0;
     
-    // Buffer for command formatting
-    char cmd_buffer[4096];
-    
-    // Debug output the current database contents
-    printf("primary database contains %zu active entries\n", server_db->used);
+    // commands for one shard are formatted while it is read-locked and sent
+    // after unlocking it, so a slow replica never holds up writers
+    char *out = NULL;
+    size_t out_len = 0, out_cap = 0;
     
-    // Iterate through all hash table buckets
-    for (size_t i = 0; i < server_db->size; i++) {
-        dict_entry *entry = server_db->table[i];
+    for (int shard = 0; shard < server_db->nshards; shard++) {
+        out_len = 0;
+        int shard_keys = 0;
+        
+        keyspace_lock_shard(server_db, shard, 0);
         
-        // Process all entries in this bucket
-        while (entry) {
+        // Iterate through all entries
+        dict_iterator it;
+        dict_entry *entry;
+        dict_iter_init(&it, server_db->shards[shard].d);
+        while ((entry = dict_iter_next(&it)) != NULL) {
+            uint64_t now = current_time_ms();
+            
             // Skip expired keys
-            if (entry->val->expire != 0 && entry->val->expire < current_time_ms()) {
-                entry = entry->next;
+            if (entry->val.expire != 0 && entry->val.expire < now) {
                 continue;
             }
             
             total_keys++;
             
-            // Only handle string values for now
-            if (entry->val->type == CC_STRING) {
-                // Format a SET command with proper quoting for string values
-                int cmd_len;
-                
-                // Check if the value needs quoting (contains spaces or special chars)
-                if (strchr((char*)entry->val->ptr, ' ') != NULL || 
-                    strchr((char*)entry->val->ptr, '\t') != NULL ||
-                    strchr((char*)entry->val->ptr, '"') != NULL) {
-                    cmd_len = snprintf(cmd_buffer, sizeof(cmd_buffer), 
-                                     "SET %s \"%s\"\r\n", 
-                                     entry->key, 
-                                     (char*)entry->val->ptr);
-                } else {
-                    cmd_len = snprintf(cmd_buffer, sizeof(cmd_buffer), 
-                                     "SET %s %s\r\n", 
-                                     entry->key, 
-                                     (char*)entry->val->ptr);
-                }
-                
-                // Log the exact command we're sending
-                printf("Sending to replica: %s", cmd_buffer);
-                
-                // Send to the replica
-                ssize_t written = write(fd, cmd_buffer, cmd_len);
-                if (written == cmd_len) {
-                    synced_keys++;
-                    
-                    struct timespec ts = {0, 10000000}; // 10ms
-                    nanosleep(&ts, NULL);
-                    
-                    // If the key has an expiry, send EXPIRE command too
-                    if (entry->val->expire != 0) {
-                        uint64_t now = current_time_ms();
-                        if (entry->val->expire > now) {
-                            long ttl_sec = (entry->val->expire - now) / 1000;
-                            if (ttl_sec > 0) {
-                                cmd_len = snprintf(cmd_buffer, sizeof(cmd_buffer), 
-                                                 "EXPIRE %s %ld\r\n", 
-                                                 entry->key, ttl_sec);
-                                write(fd, cmd_buffer, cmd_len);
-                                
-                                // Small delay for this command too
-                                nanosleep(&ts, NULL);
-                            }
-                        }
-                    }
-                } else {
-                    fprintf(stderr, "error syncing key %s: wrote %zd of %d bytes\n", 
-                            entry->key, written, cmd_len);
+            // Only handle string values for now (integers are sent as strings)
+            if (entry->val.type != CC_STRING && entry->val.type != CC_INT) {
+                continue;
+            }
+            
+            // send a SET with the value and its stored length
+            char num_buf[CC_INT_STR_SIZE];
+            size_t val_len;
+            const char *val = cc_obj_str(&entry->val, num_buf, &val_len);
+            char *set_argv[3] = {"SET", entry->key, (char *)val};
+            size_t set_len[3] = {3, strlen(entry->key), val_len};
+            if (!buffer_append_command(&out, &out_len, &out_cap, 3, set_argv, set_len)) break;
+            shard_keys++;
+            
+            // If the key has an expiry, send EXPIRE command too
+            if (entry->val.expire != 0) {
+                long ttl_sec = (entry->val.expire - now) / 1000;
+                if (ttl_sec > 0) {
+                    char ttl[32];
+                    char *expire_argv[3] = {"EXPIRE", entry->key, ttl};
+                    size_t expire_len[3] = {6, set_len[1], snprintf(ttl, sizeof(ttl), "%ld", ttl_sec)};
+                    if (!buffer_append_command(&out, &out_len, &out_cap, 3, expire_argv, expire_len)) break;
                 }
             }
+        }
+        dict_iter_release(&it);
+        keyspace_unlock_shard(server_db, shard);
+        
+        if (out_len == 0) continue;
+        
+        // Send to the replica
+        ssize_t written = write(fd, out, out_len);
+        if (written == (ssize_t)out_len) {
+            synced_keys += shard_keys;
             
-            entry = entry->next;
+            // give the replica a moment to apply the batch
+            struct timespec ts = {0, 10000000}; // 10ms
+            nanosleep(&ts, NULL);
+        } else {
+            fprintf(stderr, "error syncing shard %d: wrote %zd of %zu bytes\n", 
+                    shard, written, out_len);
         }
     }
+    free(out);
     
     printf("initial sync completed: %d of %d keys synced\n", synced_keys, total_keys);
 }
@@ -355,6 +366,27 @@ void replication_feed_slaves(char *cmd, size_t cmd_len) {
     }
 }
 
+// propagate a parsed command as a RESP multibulk. nothing is encoded while
+// no replica is connected
+void replication_feed_command(int argc, char **argv, const size_t *argv_len) {
+    if (server_repl.role != ROLE_PRIMARY) return;
+
+    pthread_mutex_lock(&server_repl.replicas_mutex);
+    int have_replicas = server_repl.replicas != NULL;
+    pthread_mutex_unlock(&server_repl.replicas_mutex);
+    if (!have_replicas) return;
+
+    size_t len = resp_command_size(argc, argv_len);
+    char *buf = malloc(len);
+    if (!buf) {
+        fprintf(stderr, "replication: out of memory encoding a command\n");
+        return;
+    }
+    resp_encode_command(buf, argc, argv, argv_len);
+    replication_feed_slaves(buf, len);
+    free(buf);
+}
+
 // get replication info for the INFO command
 void replication_info_append(char *info, size_t *len) {
     char buf[1024];
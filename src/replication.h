@@ -58,6 +58,7 @@ void replication_unset_primary(void);
 
 // process commands when in replica mode
 void replication_feed_slaves(char *cmd, size_t cmd_len);
+void replication_feed_command(int argc, char **argv, const size_t *argv_len);
 
 // get replication info for the INFO command
 void replication_info_append(char *info, size_t *len);
@@ -0,0 +1,282 @@
+#define _POSIX_C_SOURCE 200809L
+#include "reply.h"
+#include "config.h"
+#include "aof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+extern client_t *get_client_by_socket(int socket);
+
+// the client whose command is running on this thread
+static __thread client_t *current_client = NULL;
+
+// first allocation of an output buffer. a buffer grown past the idle size
+// is freed once everything in it has been sent
+#define REPLY_MIN_CAPACITY  4096
+#define REPLY_IDLE_CAPACITY (64 * 1024)
+
+void client_reply_init(client_t *client, int epoll_fd) {
+    pthread_mutex_init(&client->reply_lock, NULL);
+    client->reply = NULL;
+    client->reply_len = 0;
+    client->reply_sent = 0;
+    client->reply_capacity = 0;
+    client->reply_soft_limit_since = 0;
+    client->reply_closing = 0;
+    client->epoll_fd = epoll_fd;
+    client->write_registered = 0;
+    client->reply_handoff = NULL;
+}
+
+void client_reply_free(client_t *client) {
+    pthread_mutex_destroy(&client->reply_lock);
+    free(client->reply);
+    client->reply = NULL;
+}
+
+client_t *reply_set_current_client(client_t *client) {
+    client_t *previous = current_client;
+    current_client = client;
+    return previous;
+}
+
+// the hard limit is hit as soon as pending output goes over it, the soft
+// limit only once it has stayed over it for soft_seconds
+static int over_output_limit(client_t *client, size_t pending) {
+    int subscribed = __atomic_load_n(&client->subscriptions, __ATOMIC_RELAXED) > 0;
+    client_class_t class = subscribed ? CLIENT_CLASS_PUBSUB : CLIENT_CLASS_NORMAL;
+    const output_buffer_limit_t *limit = &config.output_limits[class];
+
+    if (limit->hard && pending > limit->hard) return 1;
+    if (limit->soft && pending > limit->soft) {
+        time_t now = time(NULL);
+        if (client->reply_soft_limit_since == 0) {
+            client->reply_soft_limit_since = now;
+            return 0;
+        }
+        return now - client->reply_soft_limit_since >= limit->soft_seconds;
+    }
+    client->reply_soft_limit_since = 0;
+    return 0;
+}
+
+// drop the client's output and shut its socket down. whichever thread reads
+// the socket then sees the hangup and disconnects it the usual way
+static void close_client_output(client_t *client, const char *reason) {
+    if (client->reply_closing) return;
+
+    fprintf(stderr, "closing client on socket %d: %s (%zu bytes of output pending)\n",
+            client->socket, reason, client->reply_len - client->reply_sent);
+    client->reply_closing = 1;
+    free(client->reply);
+    client->reply = NULL;
+    client->reply_len = 0;
+    client->reply_sent = 0;
+    client->reply_capacity = 0;
+    shutdown(client->socket, SHUT_RDWR);
+}
+
+// watch for the socket becoming writable only while output is waiting
+static void update_write_interest(client_t *client) {
+    if (client->epoll_fd == -1) return;
+
+    int want = client->reply_sent < client->reply_len;
+    if (want == client->write_registered) return;
+
+    struct epoll_event event;
+    event.data.ptr = client;
+    event.events = EPOLLIN | EPOLLET | (want ? EPOLLOUT : 0);
+    if (epoll_ctl(client->epoll_fd, EPOLL_CTL_MOD, client->socket, &event) == 0) {
+        client->write_registered = want;
+    }
+}
+
+void client_reply_rearm(client_t *client, int epoll_fd) {
+    pthread_mutex_lock(&client->reply_lock);
+    struct epoll_event event;
+    event.data.ptr = client;
+    event.events = EPOLLIN | EPOLLONESHOT | (client->reply_sent < client->reply_len ? EPOLLOUT : 0);
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->socket, &event);
+    pthread_mutex_unlock(&client->reply_lock);
+}
+
+static void append_locked(client_t *client, const char **parts, const size_t *lens, int count) {
+    if (client->reply_closing) return;
+
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        len += lens[i];
+    }
+
+    size_t pending = client->reply_len - client->reply_sent + len;
+    if (over_output_limit(client, pending)) {
+        close_client_output(client, "output buffer limit reached");
+        return;
+    }
+
+    if (client->reply_len + len > client->reply_capacity) {
+        // reuse the space of output already sent before growing
+        if (client->reply_sent > 0) {
+            memmove(client->reply, client->reply + client->reply_sent, client->reply_len - client->reply_sent);
+            client->reply_len -= client->reply_sent;
+            client->reply_sent = 0;
+        }
+        if (client->reply_len + len > client->reply_capacity) {
+            size_t capacity = client->reply_capacity ? client->reply_capacity : REPLY_MIN_CAPACITY;
+            while (capacity < client->reply_len + len) capacity *= 2;
+            char *reply = realloc(client->reply, capacity);
+            if (!reply) {
+                close_client_output(client, "out of memory for output");
+                return;
+            }
+            client->reply = reply;
+            client->reply_capacity = capacity;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        memcpy(client->reply + client->reply_len, parts[i], lens[i]);
+        client->reply_len += lens[i];
+    }
+}
+
+static int flush_locked(client_t *client) {
+    if (client->reply_closing) return 0;
+
+    while (client->reply_sent < client->reply_len) {
+        ssize_t n = send(client->socket, client->reply + client->reply_sent,
+                         client->reply_len - client->reply_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            close_client_output(client, strerror(errno));
+            return 0;
+        }
+        client->reply_sent += n;
+    }
+
+    if (client->reply_sent == client->reply_len) {
+        client->reply_len = 0;
+        client->reply_sent = 0;
+        if (client->reply_capacity > REPLY_IDLE_CAPACITY) {
+            free(client->reply);
+            client->reply = NULL;
+            client->reply_capacity = 0;
+        }
+    }
+    update_write_interest(client);
+    return 1;
+}
+
+// a reply is appended as a whole, so output another thread adds to the
+// same client (a published message) never lands in the middle of it
+static void client_add_reply_parts(client_t *client, const char **parts, const size_t *lens, int count) {
+    pthread_mutex_lock(&client->reply_lock);
+    append_locked(client, parts, lens, count);
+    // nobody else is going to flush another thread's client, do it now
+    // or have its event loop do it
+    if (client != current_client) {
+        if (client->reply_handoff) {
+            client->reply_handoff(client);
+        } else {
+            flush_locked(client);
+        }
+    }
+    pthread_mutex_unlock(&client->reply_lock);
+}
+
+void client_add_reply(client_t *client, const char *data, size_t len) {
+    client_add_reply_parts(client, &data, &len, 1);
+}
+
+client_t *lookup_client(int client_sock) {
+    if (current_client && current_client->socket == client_sock) {
+        return current_client;
+    }
+    return get_client_by_socket(client_sock);
+}
+
+void add_reply(int client_sock, const char *data, size_t len) {
+    if (client_sock < 0) return;
+
+    client_t *client = lookup_client(client_sock);
+    if (!client) {
+        if (write(client_sock, data, len) < 0) {
+            perror("write reply failed");
+        }
+        return;
+    }
+    client_add_reply(client, data, len);
+}
+
+// a bulk reply is its header, the data and a CRLF, added in one piece
+void add_reply_bulk(int client_sock, const char *header, size_t header_len, const char *data, size_t len) {
+    if (client_sock < 0) return;
+
+    const char *parts[3] = {header, data, "\r\n"};
+    size_t lens[3] = {header_len, len, 2};
+    client_t *client = lookup_client(client_sock);
+    if (!client) {
+        for (int i = 0; i < 3; i++) {
+            if (write(client_sock, parts[i], lens[i]) < 0) {
+                perror("write reply failed");
+                return;
+            }
+        }
+        return;
+    }
+    client_add_reply_parts(client, parts, lens, 3);
+}
+
+int client_flush_replies(client_t *client) {
+    aof_wait_synced();
+    pthread_mutex_lock(&client->reply_lock);
+    int ok = flush_locked(client);
+    pthread_mutex_unlock(&client->reply_lock);
+    return ok;
+}
+
+char *client_reply_take(client_t *client, size_t *len, size_t *capacity) {
+    char *taken = NULL;
+    pthread_mutex_lock(&client->reply_lock);
+    if (!client->reply_closing && client->reply_sent < client->reply_len) {
+        if (client->reply_sent > 0) {
+            memmove(client->reply, client->reply + client->reply_sent, client->reply_len - client->reply_sent);
+            client->reply_len -= client->reply_sent;
+        }
+        taken = client->reply;
+        *len = client->reply_len;
+        *capacity = client->reply_capacity;
+        client->reply = NULL;
+        client->reply_len = 0;
+        client->reply_sent = 0;
+        client->reply_capacity = 0;
+    }
+    pthread_mutex_unlock(&client->reply_lock);
+    return taken;
+}
+
+void client_reply_recycle(client_t *client, char *buf, size_t capacity) {
+    pthread_mutex_lock(&client->reply_lock);
+    // reused unless new output started a buffer of its own meanwhile
+    if (!client->reply && !client->reply_closing && capacity <= REPLY_IDLE_CAPACITY) {
+        client->reply = buf;
+        client->reply_capacity = capacity;
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&client->reply_lock);
+    free(buf);
+}
+
+int client_has_pending_replies(client_t *client) {
+    pthread_mutex_lock(&client->reply_lock);
+    int pending = client->reply_sent < client->reply_len;
+    pthread_mutex_unlock(&client->reply_lock);
+    return pending;
+}
@@ -0,0 +1,48 @@
+#ifndef REPLY_H
+#define REPLY_H
+
+#include "crimsoncache.h"
+#include <stddef.h>
+
+// replies are gathered in the client's output buffer while its input is
+// processed and written with one send per batch. what the socket doesn't
+// take stays buffered, with EPOLLOUT registered in the event loop model
+
+// epoll_fd is the event loop the client is registered with, -1 if none
+void client_reply_init(client_t *client, int epoll_fd);
+void client_reply_free(client_t *client);
+
+// the client whose command runs on this thread. replies to its socket go
+// to its output buffer without looking it up. returns the previous one
+client_t *reply_set_current_client(client_t *client);
+// the client on client_sock: the current client when it's that one (no
+// search), otherwise found in the client table. NULL if it isn't a client
+client_t *lookup_client(int client_sock);
+
+// append to the output buffer of the client on client_sock. sockets that
+// aren't clients (or client_sock < 0) are written to directly
+void add_reply(int client_sock, const char *data, size_t len);
+void client_add_reply(client_t *client, const char *data, size_t len);
+// header, data and the trailing CRLF of a bulk reply, appended in one piece
+void add_reply_bulk(int client_sock, const char *header, size_t header_len, const char *data, size_t len);
+
+// write as much buffered output as the socket takes without blocking.
+// with appendfsync always, the writes replied to are fsynced first.
+// returns 0 if the client should be disconnected: the connection failed or
+// it went over its output buffer limit
+int client_flush_replies(client_t *client);
+int client_has_pending_replies(client_t *client);
+
+// re-arm a client registered one-shot (the threaded model's workers) for
+// input, and for room to write while output is waiting. under the reply
+// lock, so it can't drop the output interest a publisher just added
+void client_reply_rearm(client_t *client, int epoll_fd);
+
+// for event loops that write the output themselves: take the pending
+// output (NULL if there is none), write it, then hand the buffer back
+// for reuse. output added in between goes to a new buffer after it.
+// the caller calls aof_wait_synced before the output is sent
+char *client_reply_take(client_t *client, size_t *len, size_t *capacity);
+void client_reply_recycle(client_t *client, char *buf, size_t capacity);
+
+#endif /* REPLY_H */
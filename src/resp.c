@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+#include "resp.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// longest "*<n>\r\n" or "$<n>\r\n" line we accept
+#define RESP_MAX_LENGTH_LINE 32
+
+void resp_command_init(resp_command *cmd) {
+    cmd->argc = 0;
+    cmd->argv = NULL;
+    cmd->argv_len = NULL;
+    cmd->capacity = 0;
+    cmd->needed = 0;
+    cmd->scan_pos = 0;
+    cmd->scan_args = 0;
+    cmd->scan_count = 0;
+}
+
+void resp_command_drop_partial(resp_command *cmd) {
+    cmd->needed = 0;
+    cmd->scan_pos = 0;
+}
+
+void resp_command_free(resp_command *cmd) {
+    free(cmd->argv);
+    free(cmd->argv_len);
+    resp_command_init(cmd);
+}
+
+// make room for count arguments. the arrays only ever grow, so a client
+// sending commands of similar size stops allocating after the first one
+static int reserve_args(resp_command *cmd, int count) {
+    if (count <= cmd->capacity) return 1;
+
+    int capacity = cmd->capacity ? cmd->capacity : 8;
+    while (capacity < count) capacity *= 2;
+
+    char **argv = realloc(cmd->argv, capacity * sizeof(char*));
+    if (!argv) return 0;
+    cmd->argv = argv;
+    size_t *argv_len = realloc(cmd->argv_len, capacity * sizeof(size_t));
+    if (!argv_len) return 0;
+    cmd->argv_len = argv_len;
+    cmd->capacity = capacity;
+    return 1;
+}
+
+static int add_arg(resp_command *cmd, char *arg, size_t len) {
+    if (!reserve_args(cmd, cmd->argc + 1)) return 0;
+    cmd->argv[cmd->argc] = arg;
+    cmd->argv_len[cmd->argc] = len;
+    cmd->argc++;
+    return 1;
+}
+
+// read the "<n>\r\n" following the '*' or '$' at buf[pos]. returns 1 and
+// sets *value and *next (the position after the line), 0 if the line isn't
+// complete yet, -1 if it is malformed
+static int parse_length(const char *buf, size_t len, size_t pos, long long *value, size_t *next) {
+    size_t avail = len - pos;
+    const char *cr = memchr(buf + pos, '\r', avail < RESP_MAX_LENGTH_LINE ? avail : RESP_MAX_LENGTH_LINE);
+    if (!cr) {
+        return avail < RESP_MAX_LENGTH_LINE ? 0 : -1;
+    }
+    if ((size_t)(cr - buf) + 1 >= len) return 0; // the '\n' hasn't arrived
+    if (cr[1] != '\n') return -1;
+
+    const char *p = buf + pos + 1;
+    int negative = 0;
+    if (p < cr && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (p == cr) return -1;
+
+    long long n = 0;
+    for (; p < cr; p++) {
+        if (*p < '0' || *p > '9' || n > RESP_MAX_BULK) return -1;
+        n = n * 10 + (*p - '0');
+    }
+    *value = negative ? -n : n;
+    *next = (size_t)(cr - buf) + 2;
+    return 1;
+}
+
+// check that buf holds a whole multibulk command before touching it, so a
+// large command arriving over many reads is only split once it is complete.
+// when it isn't, *needed is the length up to the end of the last bulk
+// argument whose header has arrived, and cmd keeps how far the headers
+// were checked: the next read resumes there, so a command of many small
+// arguments is scanned once overall, not once per read. the data of the
+// arguments is skipped, never scanned
+static resp_parse_result scan_multibulk(const char *buf, size_t len, resp_command *cmd,
+                                        long long *count, size_t *end, const char **error) {
+    size_t pos;
+    long long i = 0;
+    if (cmd->scan_pos > 0 && cmd->scan_pos <= len) {
+        pos = cmd->scan_pos;
+        i = cmd->scan_args;
+        *count = cmd->scan_count;
+    } else {
+        int r = parse_length(buf, len, 0, count, &pos);
+        if (r == 0) return RESP_PARSE_INCOMPLETE;
+        if (r < 0 || *count > RESP_MAX_MULTIBULK) {
+            *error = "invalid multibulk length";
+            return RESP_PARSE_ERROR;
+        }
+    }
+
+    for (; i < *count; i++) {
+        if (pos >= len) break;
+        if (buf[pos] != '$') {
+            *error = "expected '$' before a bulk argument";
+            return RESP_PARSE_ERROR;
+        }
+
+        long long bulk_len;
+        size_t data;
+        int r = parse_length(buf, len, pos, &bulk_len, &data);
+        if (r == 0) break;
+        if (r < 0 || bulk_len < 0 || bulk_len > RESP_MAX_BULK) {
+            *error = "invalid bulk length";
+            return RESP_PARSE_ERROR;
+        }
+
+        if (len - data < (size_t)bulk_len + 2) {
+            cmd->needed = data + bulk_len + 2;
+            break;
+        }
+        if (buf[data + bulk_len] != '\r' || buf[data + bulk_len + 1] != '\n') {
+            *error = "bulk argument not followed by CRLF";
+            return RESP_PARSE_ERROR;
+        }
+        pos = data + bulk_len + 2;
+    }
+
+    if (i < *count) {
+        cmd->scan_pos = pos;
+        cmd->scan_args = i;
+        cmd->scan_count = *count;
+        return RESP_PARSE_INCOMPLETE;
+    }
+    *end = pos;
+    return RESP_PARSE_OK;
+}
+
+static resp_parse_result parse_multibulk(char *buf, size_t len, size_t *consumed,
+                                         resp_command *cmd, const char **error) {
+    long long count;
+    size_t end;
+    resp_parse_result result = scan_multibulk(buf, len, cmd, &count, &end, error);
+    if (result != RESP_PARSE_OK) return result;
+
+    if (count > 0 && !reserve_args(cmd, (int)count)) {
+        *error = "out of memory";
+        return RESP_PARSE_ERROR;
+    }
+
+    // the frame is known to be well formed, only the lengths are needed.
+    // each argument is terminated by overwriting the '\r' after it
+    size_t pos = (const char *)memchr(buf, '\n', end) - buf + 1;
+    for (long long i = 0; i < count; i++) {
+        long long bulk_len;
+        parse_length(buf, len, pos, &bulk_len, &pos);
+
+        buf[pos + bulk_len] = '\0';
+        cmd->argv[i] = buf + pos;
+        cmd->argv_len[i] = bulk_len;
+        pos += bulk_len + 2;
+    }
+
+    // *0 and *-1 are empty commands
+    cmd->argc = count > 0 ? (int)count : 0;
+    *consumed = end;
+    return RESP_PARSE_OK;
+}
+
+// split like commands typed into telnet: whitespace separates arguments and
+// an argument starting with '"' runs to the next unescaped '"'
+int resp_split_inline(char *line, resp_command *cmd) {
+    char *p = line;
+    cmd->argc = 0;
+
+    while (*p) {
+        if (isspace((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+
+        char *start;
+        if (*p == '"') {
+            start = ++p;
+            while (*p && !(*p == '"' && *(p-1) != '\\')) p++;
+        } else {
+            start = p;
+            while (*p && !isspace((unsigned char)*p)) p++;
+        }
+
+        if (!add_arg(cmd, start, p - start)) return 0;
+        if (*p) *p++ = '\0';
+    }
+    return 1;
+}
+
+static resp_parse_result parse_inline(char *buf, size_t len, size_t *consumed,
+                                      resp_command *cmd, const char **error) {
+    char *newline = memchr(buf, '\n', len);
+    if (!newline) {
+        if (len > RESP_MAX_INLINE) {
+            *error = "too big inline request";
+            return RESP_PARSE_ERROR;
+        }
+        return RESP_PARSE_INCOMPLETE;
+    }
+
+    *newline = '\0';
+    if (newline > buf && newline[-1] == '\r') newline[-1] = '\0';
+
+    if (!resp_split_inline(buf, cmd)) {
+        *error = "out of memory";
+        return RESP_PARSE_ERROR;
+    }
+    *consumed = newline - buf + 1;
+    return RESP_PARSE_OK;
+}
+
+resp_parse_result resp_parse_command(char *buf, size_t len, size_t *consumed,
+                                     resp_command *cmd, const char **error) {
+    if (len == 0) return RESP_PARSE_INCOMPLETE;
+
+    cmd->argc = 0;
+    cmd->needed = 0;
+    resp_parse_result result;
+    if (buf[0] == '*') {
+        result = parse_multibulk(buf, len, consumed, cmd, error);
+    } else {
+        result = parse_inline(buf, len, consumed, cmd, error);
+    }
+    if (result != RESP_PARSE_INCOMPLETE) cmd->scan_pos = 0;
+    return result;
+}
+
+// digits of a length, for sizing the "$<len>\r\n" headers
+static size_t digits(size_t n) {
+    size_t d = 1;
+    while (n >= 10) {
+        n /= 10;
+        d++;
+    }
+    return d;
+}
+
+size_t resp_command_size(int argc, const size_t *argv_len) {
+    size_t size = 1 + digits(argc) + 2;
+    for (int i = 0; i < argc; i++) {
+        size += 1 + digits(argv_len[i]) + 2 + argv_len[i] + 2;
+    }
+    return size;
+}
+
+// write "<prefix><n>\r\n"
+static char *encode_length(char *out, char prefix, size_t n) {
+    size_t d = digits(n);
+    *out++ = prefix;
+    for (size_t i = d; i > 0; i--) {
+        out[i - 1] = '0' + n % 10;
+        n /= 10;
+    }
+    out += d;
+    *out++ = '\r';
+    *out++ = '\n';
+    return out;
+}
+
+char *resp_encode_command(char *out, int argc, char **argv, const size_t *argv_len) {
+    out = encode_length(out, '*', argc);
+    for (int i = 0; i < argc; i++) {
+        out = encode_length(out, '$', argv_len[i]);
+        memcpy(out, argv[i], argv_len[i]);
+        out += argv_len[i];
+        *out++ = '\r';
+        *out++ = '\n';
+    }
+    return out;
+}
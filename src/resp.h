@@ -0,0 +1,61 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stddef.h>
+
+// limits on what a client may send, anything larger is a protocol error
+#define RESP_MAX_INLINE     (64 * 1024)           // inline command line, and a multibulk header line
+#define RESP_MAX_MULTIBULK  (1024 * 1024)         // arguments in one multibulk command
+#define RESP_MAX_BULK       (512L * 1024 * 1024)  // one bulk argument
+
+typedef enum {
+    RESP_PARSE_INCOMPLETE,  // the buffer ends inside a command, read more
+    RESP_PARSE_OK,          // a whole command was parsed (argc may be 0 for an empty line)
+    RESP_PARSE_ERROR        // malformed input, the rest of the stream can't be trusted
+} resp_parse_result;
+
+// a parsed command. the arguments are slices of the parsed buffer, NUL
+// terminated in place, so they are only valid until the buffer changes.
+// the arrays are kept and reused for the next command
+typedef struct resp_command {
+    int argc;
+    char **argv;
+    size_t *argv_len;
+    int capacity;
+    size_t needed;  // after RESP_PARSE_INCOMPLETE: bytes the command is known to take, 0 if unknown
+    // after RESP_PARSE_INCOMPLETE on a multibulk: how far its headers were
+    // checked, so parsing it again with more data resumes there
+    size_t scan_pos;        // offset of the next bulk header, 0 if nothing was checked
+    long long scan_args;    // bulk arguments checked before scan_pos
+    long long scan_count;   // arguments in the command
+} resp_command;
+
+void resp_command_init(resp_command *cmd);
+void resp_command_free(resp_command *cmd);
+
+// parse one command from the start of buf, either a RESP multibulk
+// (*<n>\r\n$<len>\r\n<arg>\r\n...) or an inline line (SET key "a value"\r\n).
+// on RESP_PARSE_OK *consumed is the length of the command in buf, which has
+// been modified in place. an incomplete command is left untouched and
+// cmd->needed says how much of it the bulk lengths read so far account for,
+// so the caller can make room for a large argument in one go. cmd also
+// remembers how far it got, the next call must pass the same command again
+// (moved is fine) with at least as many bytes of it, or drop it first with
+// resp_command_drop_partial. on RESP_PARSE_ERROR *error describes the problem
+resp_parse_result resp_parse_command(char *buf, size_t len, size_t *consumed,
+                                     resp_command *cmd, const char **error);
+
+// forget an incomplete command the caller gives up on, the next parse
+// starts from scratch
+void resp_command_drop_partial(resp_command *cmd);
+
+// split an inline command line (without its line ending) in place.
+// returns 0 if out of memory
+int resp_split_inline(char *line, resp_command *cmd);
+
+// bytes needed to encode argv as a RESP multibulk, and the encoding itself.
+// resp_encode_command writes exactly that many bytes and returns the end
+size_t resp_command_size(int argc, const size_t *argv_len);
+char *resp_encode_command(char *out, int argc, char **argv, const size_t *argv_len);
+
+#endif /* RESP_H */
@@ -0,0 +1,41 @@
+#include "spsc.h"
+#include <stdlib.h>
+
+int spsc_init(spsc_queue *q, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) size *= 2;
+
+    q->slots = calloc(size, sizeof(void*));
+    if (!q->slots) return 0;
+    q->mask = size - 1;
+    q->head = 0;
+    q->tail = 0;
+    return 1;
+}
+
+void spsc_free(spsc_queue *q) {
+    free(q->slots);
+    q->slots = NULL;
+}
+
+// the release store of tail publishes the slot (and whatever item points
+// to) to the consumer's acquire load
+int spsc_push(spsc_queue *q, void *item) {
+    size_t tail = q->tail;
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (tail - head > q->mask) return 0;
+
+    q->slots[tail & q->mask] = item;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void *spsc_pop(spsc_queue *q) {
+    size_t head = q->head;
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) return NULL;
+
+    void *item = q->slots[head & q->mask];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
@@ -0,0 +1,24 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stddef.h>
+
+// bounded lock-free ring of pointers between exactly one producer thread
+// and one consumer thread. head and tail live on their own cache lines so
+// the two sides don't invalidate each other on every push and pop
+typedef struct spsc_queue {
+    void **slots;
+    size_t mask;   // capacity - 1, capacity is a power of two
+    size_t head __attribute__((aligned(64)));  // next slot to pop, owned by the consumer
+    size_t tail __attribute__((aligned(64)));  // next slot to push, owned by the producer
+} spsc_queue;
+
+int spsc_init(spsc_queue *q, size_t capacity);
+void spsc_free(spsc_queue *q);
+
+// producer side, returns 0 if the queue is full
+int spsc_push(spsc_queue *q, void *item);
+// consumer side, returns NULL if the queue is empty
+void *spsc_pop(spsc_queue *q);
+
+#endif /* SPSC_H */
@@ -1,6 +1,8 @@
 #define _POSIX_C_SOURCE 200809L
 #include "transaction.h"
 #include "commands.h"
+#include "resp.h"
+#include "reply.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,14 +13,14 @@ void tx_init(client_t *client) {
     client->in_transaction = 0;
     client->transaction_errors = 0;
     client->queued_commands = NULL;
+    client->queued_lens = NULL;
     client->queue_size = 0;
     client->queue_capacity = 0;
+    keyspace_lockset_init(&client->tx_locks, 0);
 }
 
 // clean up transaction resources
 void tx_cleanup(client_t *client) {
-    printf("Cleaning up transaction state for client %p\n", (void*)client);
-    
     if (!client) {
         printf("ERROR: Null client in tx_cleanup\n");
         return;
@@ -33,18 +35,19 @@ void tx_cleanup(client_t *client) {
         free(client->queued_commands);
         client->queued_commands = NULL;
     }
+    free(client->queued_lens);
+    client->queued_lens = NULL;
     
     // Reset ALL transaction-related fields - CRITICAL
     client->queue_size = 0;
     client->queue_capacity = 0;
     client->in_transaction = 0;      // Most important field to reset
     client->transaction_errors = 0;
-    
-    printf("Transaction cleanup complete, in_transaction=%d\n", client->in_transaction);
+    keyspace_lockset_init(&client->tx_locks, 0);
 }
 
 // queue a command for later execution
-int tx_queue_command(client_t *client, char *cmd) {
+int tx_queue_command(client_t *client, int argc, char **argv, const size_t *argv_len) {
     // expand queue if needed
     if (client->queue_size >= client->queue_capacity) {
         int new_capacity = client->queue_capacity == 0 ? 10 : client->queue_capacity * 2;
@@ -53,23 +56,29 @@ int tx_queue_command(client_t *client, char *cmd) {
             return 0;  // out of memory
         }
         client->queued_commands = new_queue;
+        size_t *new_lens = realloc(client->queued_lens, new_capacity * sizeof(size_t));
+        if (!new_lens) {
+            return 0;  // out of memory
+        }
+        client->queued_lens = new_lens;
         client->queue_capacity = new_capacity;
     }
     
-    // add debug output to see the exact command being queued
-    printf("Queueing full command: '%s'\n", cmd);
-    
-    // store the full command
-    client->queued_commands[client->queue_size] = strdup(cmd);
-    if (!client->queued_commands[client->queue_size]) {
+    // the arguments point into the query buffer, keep a RESP copy of the command
+    size_t len = resp_command_size(argc, argv_len);
+    char *copy = malloc(len + 1);
+    if (!copy) {
         return 0;  // out of memory
     }
+    *resp_encode_command(copy, argc, argv, argv_len) = '\0';
+    client->queued_commands[client->queue_size] = copy;
+    client->queued_lens[client->queue_size] = len;
     client->queue_size++;
     return 1;
 }
 
 // execute all queued commands
-void tx_execute_commands(client_t *client, dict *db) {
+void tx_execute_commands(client_t *client, keyspace *db) {
     if (client->transaction_errors) {
         reply_error(client->socket, "EXECABORT Transaction discarded because of previous errors");
         tx_cleanup(client);
@@ -77,43 +86,37 @@ void tx_execute_commands(client_t *client, dict *db) {
     }
     
     int queue_size = client->queue_size;
-    printf("Executing transaction with %d commands\n", queue_size);
-    
-    char **commands = malloc(sizeof(char*) * queue_size);
-    if (!commands) {
-        reply_error(client->socket, "ERR out of memory during transaction execution");
-        tx_cleanup(client);
-        return;
-    }
     
-    for (int i = 0; i < queue_size; i++) {
-        commands[i] = strdup(client->queued_commands[i]);
-        if (!commands[i]) {
-            for (int j = 0; j < i; j++) {
-                free(commands[j]);
-            }
-            free(commands);
-            reply_error(client->socket, "ERR out of memory during transaction execution");
-            tx_cleanup(client);
-            return;
-        }
-        printf("Command to execute: '%s'\n", commands[i]);
-    }
+    // take the queue over, the commands run once the client has left the
+    // transaction. they are RESP and may hold NULs, so lengths go with them
+    char **commands = client->queued_commands;
+    size_t *lens = client->queued_lens;
+    keyspace_lockset locks = client->tx_locks;
+    client->queued_commands = NULL;
+    client->queued_lens = NULL;
+    client->queue_size = 0;
     
     char buffer[32];
-    snprintf(buffer, sizeof(buffer), "*%d\r\n", queue_size);
-    write(client->socket, buffer, strlen(buffer));
+    int len = snprintf(buffer, sizeof(buffer), "*%d\r\n", queue_size);
+    client_add_reply(client, buffer, len);
     
     tx_cleanup(client);
     
+    // the shards of every queued command stay locked for the whole batch,
+    // so no other client's command (forwarded by another reactor or not)
+    // runs in between and nobody sees the transaction half applied
+    keyspace_hold(db, &locks);
+    for (int i = 0; i < queue_size; i++) {
+        execute_command(client, commands[i], lens[i], db);
+    }
+    keyspace_release(db, &locks);
+
     for (int i = 0; i < queue_size; i++) {
-        printf("Executing full command: '%s'\n", commands[i]);
-        execute_command(client->socket, commands[i], db);
         free(commands[i]);
     }
     
     free(commands);
-    printf("Transaction execution complete\n");
+    free(lens);
 }
 
 // discard all queued commands
@@ -2,7 +2,7 @@
 #define TRANSACTION_H
 
 #include "crimsoncache.h"
-#include "dict.h"
+#include "keyspace.h"
 
 void tx_init(client_t *client);
 
@@ -10,10 +10,10 @@ void tx_init(client_t *client);
 void tx_cleanup(client_t *client);
 
 
-int tx_queue_command(client_t *client, char *cmd);
+int tx_queue_command(client_t *client, int argc, char **argv, const size_t *argv_len);
 
 
-void tx_execute_commands(client_t *client, dict *db);
+void tx_execute_commands(client_t *client, keyspace *db);
 
 
 void tx_discard_commands(client_t *client);
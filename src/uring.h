@@ -0,0 +1,60 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+// just enough of io_uring for the network backend, on the raw system calls
+// (no liburing). multishot recv into provided buffer rings came with the
+// linux 6.0 headers, without them the backend isn't built
+#ifdef IORING_RECV_MULTISHOT
+#define HAVE_IO_URING 1
+#endif
+
+#ifdef HAVE_IO_URING
+
+typedef struct uring {
+    int fd;
+
+    // submission queue, shared with the kernel
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;   // sqes handed out, published to the kernel on submit
+
+    // completion queue, shared with the kernel
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;       // == sq_ring when the kernel maps both at once
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring;
+
+// entries is the submission queue size, the completion queue gets four
+// times as many since multishot requests complete over and over.
+// returns -errno on failure
+int uring_init(uring *ring, unsigned entries);
+void uring_free(uring *ring);
+
+// a zeroed sqe to fill in, NULL if the submission queue is full
+struct io_uring_sqe *uring_get_sqe(uring *ring);
+// submit everything queued and wait for at least wait_nr completions, in a
+// single system call. returns the number submitted or -errno
+int uring_submit_and_wait(uring *ring, unsigned wait_nr);
+
+// completions: peek the oldest, then mark it seen
+struct io_uring_cqe *uring_peek_cqe(uring *ring);
+void uring_cqe_seen(uring *ring);
+
+int uring_register(uring *ring, unsigned opcode, const void *arg, unsigned nr_args);
+
+#endif /* HAVE_IO_URING */
+
+#endif /* URING_H */
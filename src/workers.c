@@ -0,0 +1,273 @@
+#include "workers.h"
+#include "commands.h"
+#include "eventloop.h" // for event_loop_client_release
+#include "pubsub.h" // for pubsub_remove_client
+#include "reply.h"
+#include "aof.h" // for aof_flush
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+extern volatile sig_atomic_t server_running;
+extern keyspace *server_db;
+
+// clients are registered one-shot and level-triggered: an event disables
+// the client until the worker serving it re-arms it, so normally a single
+// worker ever sees it, and re-arming reports whatever input is still
+// waiting. a publisher re-arms a client to get its output written, which
+// may hand it to a second worker while the first is still busy with it;
+// client->worker_events sorts that out (see serve_client)
+
+#define WORKER_EVENTS 16              // clients a worker takes per epoll_wait
+#define WORKER_READ_BUDGET (64 * 1024) // bytes read from a client per turn
+// how often a worker with nothing to do looks up, to notice shutdown and
+// to let closed clients be freed
+#define WORKER_TICK_MS 100
+
+typedef struct worker {
+    pthread_t thread;
+    unsigned long rounds;  // epoll_wait rounds done, see reclaim_clients
+    // appendfsync always: clients of this round waiting for the fsync of
+    // their writes before they get their replies, with the events handled
+    client_t *waiting[WORKER_EVENTS];
+    int waiting_handled[WORKER_EVENTS];
+    int waiting_count;
+} __attribute__((aligned(64))) worker;
+
+static int pool_epfd = -1;
+static worker *workers = NULL;
+static int worker_count = 0;
+
+// a closed client may still be in the events another worker got from
+// epoll_wait before it was closed, so it is freed only after every worker
+// has finished the round it was in: clients closed since grace_start are
+// retiring, the ones closed before it are retired, and freed as soon as
+// each worker's rounds moved past grace_start
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static client_t *retiring = NULL;
+static client_t *retired = NULL;
+static unsigned long *grace_start = NULL;
+
+static void retire_client(client_t *client) {
+    pthread_mutex_lock(&retire_lock);
+    client->next_closed = retiring;
+    retiring = client;
+    pthread_mutex_unlock(&retire_lock);
+}
+
+static void free_client_list(client_t *client) {
+    while (client) {
+        client_t *next = client->next_closed;
+        free(client);
+        client = next;
+    }
+}
+
+static void reclaim_clients(void) {
+    client_t *done = NULL;
+    pthread_mutex_lock(&retire_lock);
+    int passed = 1;
+    for (int i = 0; i < worker_count && passed; i++) {
+        passed = __atomic_load_n(&workers[i].rounds, __ATOMIC_ACQUIRE) != grace_start[i];
+    }
+    if (passed && (retired || retiring)) {
+        done = retired;
+        retired = retiring;
+        retiring = NULL;
+        for (int i = 0; i < worker_count; i++) {
+            grace_start[i] = __atomic_load_n(&workers[i].rounds, __ATOMIC_ACQUIRE);
+        }
+    }
+    pthread_mutex_unlock(&retire_lock);
+    free_client_list(done);
+}
+
+// output added by another thread (a published message): have a worker
+// write it. called under the client's reply lock, like client_reply_rearm,
+// so the two never undo each other's interest in output
+static void worker_handoff(client_t *client) {
+    struct epoll_event event;
+    event.data.ptr = client;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLONESHOT;
+    epoll_ctl(pool_epfd, EPOLL_CTL_MOD, client->socket, &event);
+}
+
+static void close_client(client_t *client) {
+    printf("client on socket %d disconnected.\n", client->socket);
+    pubsub_remove_client(client);
+    unregister_client(client);
+    epoll_ctl(pool_epfd, EPOLL_CTL_DEL, client->socket, NULL);
+    close(client->socket);
+    event_loop_client_release(client);
+    retire_client(client);
+}
+
+// read what the client sent, up to its budget, running the commands as
+// they come in. a client with more to read is re-armed and reported again
+// behind the others. returns 0 if the client is to be disconnected
+static int read_client(client_t *client) {
+    size_t budget = WORKER_READ_BUDGET;
+    while (budget > 0) {
+        ssize_t bytes_read = recv(client->socket, client->buffer + client->buffer_pos,
+                                  client->buffer_capacity - client->buffer_pos - 1, 0);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        if (bytes_read <= 0) {
+            // 0 means client closed connection, < 0 is an error
+            if (bytes_read < 0) perror("read from client failed");
+            return 0;
+        }
+        client->buffer_pos += bytes_read;
+        client->buffer[client->buffer_pos] = '\0';
+        budget = (size_t)bytes_read < budget ? budget - bytes_read : 0;
+
+        // run every complete command, then write out all their replies,
+        // unless they wait for the fsync at the end of the round
+        int ok = process_client_buffer(client, server_db, NULL, NULL);
+        if (ok && aof_unsynced()) continue;
+        if (!client_flush_replies(client) || !ok) return 0;
+    }
+    return 1;
+}
+
+// the worker that counts a client's events up from 0 serves it, and keeps
+// serving it until it has accounted for every event counted meanwhile by
+// workers the client was handed to as well. those just count and leave.
+// a closed client's count never drops back to 0, so nobody touches it again
+static void serve_events(worker *self, client_t *client, uint32_t events) {
+    int handled = 0;
+    do {
+        handled = __atomic_load_n(&client->worker_events, __ATOMIC_ACQUIRE);
+        int open = 1;
+        if (events & EPOLLOUT) open = client_flush_replies(client);
+        if (open && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) open = read_client(client);
+        if (!open) {
+            close_client(client);
+            return;
+        }
+        if (aof_unsynced()) {
+            // still ours, see reply_synced
+            self->waiting[self->waiting_count] = client;
+            self->waiting_handled[self->waiting_count++] = handled;
+            return;
+        }
+        client_reply_rearm(client, pool_epfd);
+        // whatever the other events were, the socket is ready for both now
+        events = EPOLLIN | EPOLLOUT;
+    } while (__atomic_sub_fetch(&client->worker_events, handled, __ATOMIC_ACQ_REL) != 0);
+}
+
+static void serve_client(worker *self, client_t *client, uint32_t events) {
+    if (__atomic_fetch_add(&client->worker_events, 1, __ATOMIC_ACQUIRE) != 0) return;
+    serve_events(self, client, events);
+}
+
+// appendfsync always: one fsync covers the writes of every client of the
+// round, then they get their replies and are re-armed
+static void reply_synced(worker *self) {
+    while (self->waiting_count > 0) {
+        aof_wait_synced();
+        client_t *waiting[WORKER_EVENTS];
+        int handled[WORKER_EVENTS];
+        int count = self->waiting_count;
+        memcpy(waiting, self->waiting, count * sizeof(client_t *));
+        memcpy(handled, self->waiting_handled, count * sizeof(int));
+        self->waiting_count = 0;
+
+        for (int i = 0; i < count; i++) {
+            client_t *client = waiting[i];
+            if (!client_flush_replies(client)) {
+                close_client(client);
+                continue;
+            }
+            client_reply_rearm(client, pool_epfd);
+            // serve what was counted while it waited, which may queue it again
+            if (__atomic_sub_fetch(&client->worker_events, handled[i], __ATOMIC_ACQ_REL) != 0) {
+                serve_events(self, client, EPOLLIN | EPOLLOUT);
+            }
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    worker *self = arg;
+    struct epoll_event events[WORKER_EVENTS];
+
+    while (server_running) {
+        int ready = epoll_wait(pool_epfd, events, WORKER_EVENTS, WORKER_TICK_MS);
+        if (ready < 0 && errno != EINTR) {
+            perror("epoll_wait failed");
+        }
+        for (int i = 0; i < ready; i++) {
+            serve_client(self, events[i].data.ptr, events[i].events);
+        }
+        reply_synced(self);
+        aof_flush();
+        __atomic_add_fetch(&self->rounds, 1, __ATOMIC_RELEASE);
+        reclaim_clients();
+    }
+    return NULL;
+}
+
+int worker_pool_start(int threads) {
+    pool_epfd = epoll_create1(0);
+    workers = calloc(threads, sizeof(worker));
+    grace_start = calloc(threads, sizeof(unsigned long));
+    if (pool_epfd == -1 || !workers || !grace_start) {
+        perror("failed to set up worker pool");
+        worker_pool_stop();
+        return 0;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            perror("failed to create worker thread");
+            break;
+        }
+        // reclaim_clients waits for the workers counted so far
+        pthread_mutex_lock(&retire_lock);
+        worker_count++;
+        pthread_mutex_unlock(&retire_lock);
+    }
+    if (worker_count == 0) {
+        worker_pool_stop();
+        return 0;
+    }
+    return 1;
+}
+
+int worker_pool_add(client_t *client) {
+    client->worker_events = 0;
+    client->reply_handoff = worker_handoff;
+    register_client(client);
+
+    struct epoll_event event;
+    event.data.ptr = client;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    if (epoll_ctl(pool_epfd, EPOLL_CTL_ADD, client->socket, &event) == -1) {
+        perror("epoll_ctl for client failed");
+        unregister_client(client);
+        return 0;
+    }
+    return 1;
+}
+
+void worker_pool_stop(void) {
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    // clients still connected are left to the exit, like the event loop does
+    free_client_list(retired);
+    free_client_list(retiring);
+    retired = retiring = NULL;
+    if (pool_epfd != -1) close(pool_epfd);
+    pool_epfd = -1;
+    free(workers);
+    free(grace_start);
+    workers = NULL;
+    grace_start = NULL;
+    worker_count = 0;
+}
@@ -0,0 +1,19 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include "crimsoncache.h"
+
+// the threaded model: a fixed pool of worker threads serves every client.
+// idle clients wait in a shared epoll set and cost no thread; whichever
+// worker is free takes the next client that has input (or room for output
+// it couldn't write before) and runs its commands under the shard locks
+
+// start threads workers, returns 0 on failure
+int worker_pool_start(int threads);
+// hand over an accepted, non-blocking client. returns 0 if it can't be
+// watched, the caller then still owns it
+int worker_pool_add(client_t *client);
+// stop the workers (server_running is 0 by now) and free what is left
+void worker_pool_stop(void);
+
+#endif /* WORKERS_H */
@@ -0,0 +1,5 @@
+#include <stdio.h>
+int main() {
+		printf("Dummy test passed\n");
+		return 0;
+}